@@ -36,16 +36,16 @@ typedef struct CommData {
 } CommData;
 
 
-ParData GatherParData(time_t t0, time_t t1) {
+// Statistics of a per-process value, valid on rank 0.
+ParData GatherParData(double val) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::GatherParData");
 #endif
     int mpirank, mpisize;
     getMPIInfo(&mpirank, &mpisize);
-    double diff = difftime(t1, t0);
     double *rbuf = new double[mpisize];
 
-    MPI_Gather((void *)&diff, 1, MPI_DOUBLE, rbuf, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather((void *)&val, 1, MPI_DOUBLE, rbuf, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
     ParData data = {0., 0., 0., 0.};
     if (mpirank == 0) {
@@ -70,6 +70,10 @@ ParData GatherParData(time_t t0, time_t t1) {
     return data;
 }
 
+ParData GatherParData(time_t t0, time_t t1) {
+    return GatherParData(difftime(t1, t0));
+}
+
 // TODO (Austin): Combine this with GatherParData
 CommData GatherCommData(int amt) {
 #ifndef RELEASE
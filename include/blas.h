@@ -35,6 +35,18 @@ extern "C" {
     void zgemv_(char *trans, int *m, int *n, cpx16 *alpha, cpx16 *a, int *lda,
 		cpx16 *x, int *incx, cpx16 *beta, cpx16 *y, int *incy);
     void dscal_(int* n, double* alpha, double* X, int* incr);
+
+    // LAPACK
+    void zgesvd_(char *jobu, char *jobvt, int *m, int *n, cpx16 *a, int *lda,
+		 double *s, cpx16 *u, int *ldu, cpx16 *vt, int *ldvt, cpx16 *work,
+		 int *lwork, double *rwork, int *info);
+    void zgeqp3_(int *m, int *n, cpx16 *a, int *lda, int *jpvt, cpx16 *tau,
+		 cpx16 *work, int *lwork, double *rwork, int *info);
+    void zgeqrf_(int *m, int *n, cpx16 *a, int *lda, cpx16 *tau,
+		 cpx16 *work, int *lwork, int *info);
+    void zungqr_(int *m, int *n, int *k, cpx16 *a, int *lda, cpx16 *tau,
+		 cpx16 *work, int *lwork, int *info);
+    void ztrtri_(char *uplo, char *diag, int *n, cpx16 *a, int *lda, int *info);
 }
 
 #endif  // _BLAS_H_
@@ -0,0 +1,81 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _BUFSTREAM_HPP_
+#define _BUFSTREAM_HPP_
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+
+// Streams over raw byte buffers, used by ParVec to serialize directly into
+// its per-peer MPI send buffers and to deserialize in place from the receive
+// buffers, without the std::string copies of the stringstream classes.
+
+//--------------------------------------------
+// Appends everything written to the end of a std::vector<char>.  The vector
+// is not cleared, so a buffer that is reused keeps its capacity.
+class VecOStreamBuf : public std::streambuf
+{
+public:
+    VecOStreamBuf(std::vector<char>& vec): _vec(vec) {;}
+protected:
+    virtual int_type overflow(int_type c) {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            _vec.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+        _vec.insert(_vec.end(), s, s + n);
+        return n;
+    }
+private:
+    std::vector<char>& _vec;
+};
+
+class VecOStream : public std::ostream
+{
+public:
+    VecOStream(std::vector<char>& vec): std::ostream(NULL), _buf(vec) { rdbuf(&_buf); }
+private:
+    VecOStreamBuf _buf;
+};
+
+//--------------------------------------------
+// Reads from the bytes [begin, begin + n), which are not copied and must stay
+// alive while the stream is in use.
+class MemIStreamBuf : public std::streambuf
+{
+public:
+    MemIStreamBuf(const char* begin, std::size_t n) {
+        char* p = const_cast<char*>(begin);
+        setg(p, p, p + n);
+    }
+};
+
+class MemIStream : public std::istream
+{
+public:
+    MemIStream(const char* begin, std::size_t n): std::istream(NULL), _buf(begin, n) {
+        rdbuf(&_buf);
+    }
+private:
+    MemIStreamBuf _buf;
+};
+
+#endif  // _BUFSTREAM_HPP_
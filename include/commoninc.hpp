@@ -70,6 +70,23 @@ int getMPIRank();
 int getMPISize();
 int getMPIInfo(int *mpirank, int *mpisize);
 
+// Node layout of MPI_COMM_WORLD: nodecomm holds the processes that share a
+// node, leadercomm the process of local rank 0 of every node (MPI_COMM_NULL
+// on the others), and nodeof[p] and localof[p] give the node of process p and
+// its rank in the nodecomm of that node.  Nodes are numbered by the rank of
+// their leader in leadercomm.
+struct MPINodeInfo {
+    MPI_Comm nodecomm;
+    MPI_Comm leadercomm;
+    int nnodes;
+    int maxnodesize;
+    std::vector<int> nodeof;
+    std::vector<int> localof;
+};
+// Collective on the first call, which builds the layout; later calls return
+// the same one.
+int getMPINodeInfo(MPINodeInfo*& info);
+
 #ifndef RELEASE
 void PushCallStack( std::string s );
 void PopCallStack();
@@ -21,11 +21,53 @@
 #include "nummat.hpp"
 #include "vec3t.hpp"
 
+// Tile sizes for Kernel3d::kernel and Kernel3d::apply.  One tile of each of
+// the four work arrays is KERNEL_TILE_TRG * KERNEL_TILE_SRC doubles (8 KB),
+// so the working set stays in L1/L2.
+#define KERNEL_TILE_TRG (16)
+#define KERNEL_TILE_SRC (64)
+
 enum {
   KERNEL_HELM = 0,
   KERNEL_EXPR = 1
 };
 
+//---------------------------------------------------------------------------
+// Compile-time kernel policies.  Every kernel has the form
+// G(r) = amp(r) * exp(i*K*r); a policy supplies amp(r) for a tile of
+// distances.  Kernel3d dispatches on its type once per call and then runs
+// tile loops instantiated for the policy, so the type switch stays out of
+// the per-entry work.
+class HelmKernel {
+public:
+  enum { TYPE = KERNEL_HELM };
+  // amp = 1/r
+  template <class T>
+  static inline void amplitude(int n, const T* r, T* amp) {
+    for (int k = 0; k < n; ++k) {
+      amp[k] = T(1) / r[k];
+    }
+  }
+  template <class T>
+  static inline void scale(int n, const T* amp, T* re, T* im) {
+    for (int k = 0; k < n; ++k) {
+      re[k] *= amp[k];
+      im[k] *= amp[k];
+    }
+  }
+};
+
+class ExprKernel {
+public:
+  enum { TYPE = KERNEL_EXPR };
+  // amp = 1
+  template <class T>
+  static inline void amplitude(int, const T*, T*) {;}
+  template <class T>
+  static inline void scale(int, const T*, T*, T*) {;}
+};
+
+//---------------------------------------------------------------------------
 class Kernel3d
 {
 protected:
@@ -42,6 +84,33 @@ public:
   
   int kernel(const DblNumMat& trgpos, const DblNumMat& srcpos,
              const DblNumMat& srcnor, CpxNumMat& mat);
+
+  // val += G(trgpos, srcpos) * den, without forming the kernel matrix.
+  // The interaction is evaluated in cache-sized tiles and accumulated
+  // directly into val.  With several columns in den and val, each tile is
+  // evaluated once and applied to all of them.
+  int apply(const DblNumMat& trgpos, const DblNumMat& srcpos,
+            const CpxNumMat& den, CpxNumMat& val);
+  int apply(const DblNumMat& trgpos, const DblNumMat& srcpos,
+            const CpxNumVec& den, CpxNumVec& val);
+
+  // Same as apply, but the kernel is evaluated and accumulated in single
+  // precision.  Positions are shifted to the first target before rounding
+  // to float and each tile's partial sums are added into val in double,
+  // so the result is accurate to about 1e-5 relative to the near field.
+  // Meant for the near-field interactions at ACCU=1.
+  int apply_float(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                  const CpxNumMat& den, CpxNumMat& val);
+  int apply_float(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                  const CpxNumVec& den, CpxNumVec& val);
+
+  // Both directions of the interaction between the point sets a and b:
+  // aval += G(apos, bpos) * bden and bval += G(bpos, apos) * aden.  Uses
+  // G(x, y) = G(y, x) to evaluate each kernel entry once.  If single is
+  // true, the evaluation is done as in apply_float.
+  int apply_sym(const DblNumMat& apos, const DblNumMat& bpos,
+                const CpxNumMat& aden, const CpxNumMat& bden,
+                CpxNumMat& aval, CpxNumMat& bval, bool single);
 };
 
 #endif
@@ -24,13 +24,55 @@
 #include "kernel3d.hpp"
 #include "vecmatop.hpp"
 
+#include <list>
+
+// Low frequency V list interaction tensors of one level, compressed with the
+// 48 element octahedral group.  The kernel is radial, so the tensor of offset
+// (a-3, b-3, c-3) is the tensor of the sorted absolute offset with its
+// frequency index transformed by the signed permutation that sorts the
+// offset.  The mapped tensor is not equal to the stored one: a reflection
+// maps the spatial sample P (offset -P*step) to itself, so the two differ on
+// that plane, which in frequency touches every sample.  The circular
+// convolution only reads the offsets with |i-j| <= P-1, though, so the
+// check point values are unchanged.  16 tensors are stored instead of 316.
+class Ue2dcTable
+{
+public:
+    NumVec<CpxNumTns> _tns;   // one per sorted absolute offset
+    IntNumTns _uid;           // 7x7x7, index into _tns, -1 if adjacent
+    IntNumTns _sid;           // 7x7x7, index into _maps, -1 for the identity
+    NumVec<IntNumVec> _maps;  // frequency index maps of the symmetries used
+    NumVec<Cpx8NumTns> _ftns; // single precision tensors, if _tns was demoted
+public:
+    Ue2dcTable() {;}
+    ~Ue2dcTable() {;}
+    // Build from the full 7x7x7 table as stored in the data files.
+    int setup(NumTns<CpxNumTns>& ue2dc);
+    // Stored tensor and index map (NULL for the identity) for offset index
+    // (a, b, c), 0 <= a, b, c < 7.  ue2dc(a,b,c)[i] = tensor(a,b,c)[map[i]].
+    CpxNumTns& tensor(int a, int b, int c) { return _tns(_uid(a,b,c)); }
+    const int* map(int a, int b, int c) {
+        return _sid(a,b,c) < 0 ? NULL : _maps(_sid(a,b,c)).data();
+    }
+    // Replace the tensors by single precision copies.  tensor() is then
+    // empty and ftensor() gives the interleaved (re, im) floats.
+    int demote();
+    bool single() { return _ftns.m() > 0; }
+    const float* ftensor(int a, int b, int c) {
+        return (const float*) (_ftns(_uid(a,b,c)).data());
+    }
+    double bytes();
+};
+
 class LowFreqEntry
 {
 public:
     DblNumMat _uep;
     DblNumMat _ucp;
     NumVec<CpxNumMat> _uc2ue;
-    NumTns<CpxNumTns> _ue2dc;
+    NumVec<Cpx8NumMat> _fuc2ue;  // replaces _uc2ue with -mlib3d_FLOATTABLES
+    NumTns<CpxNumTns> _ue2dc;  // only as read, emptied by Mlib3d::setup
+    Ue2dcTable _ue2dctbl;
 public:
     LowFreqEntry() {;}
     ~LowFreqEntry() {;}
@@ -38,6 +80,7 @@ public:
     DblNumMat& ucp() { return _ucp; }
     NumVec<CpxNumMat>& uc2ue() { return _uc2ue; }
     NumTns<CpxNumTns>& ue2dc() { return _ue2dc; }
+    Ue2dcTable& ue2dctbl() { return _ue2dctbl; }
 };
 
 class HghFreqDirEntry
@@ -46,6 +89,7 @@ public:
     DblNumMat _uep;
     DblNumMat _ucp;
     NumVec<CpxNumMat> _uc2ue;
+    NumVec<Cpx8NumMat> _fuc2ue;  // replaces _uc2ue with -mlib3d_FLOATTABLES
 public:
     HghFreqDirEntry() {;}
     ~HghFreqDirEntry() {;}
@@ -54,6 +98,70 @@ public:
     NumVec<CpxNumMat>& uc2ue() { return _uc2ue; }
 };
 
+//-----------------------------------
+// Translation data of one level (low frequency) or of one level and
+// direction (high frequency), as built by the fetch functions.  The upward
+// fetches set uep, ucp, uc2ue and ue2uc; the downward fetches set dep, dcp,
+// uc2ue, de2dc and uep, and ue2dc at low frequency.  Points and factors that
+// are stored as such in the table entry are non-owning views of it; only
+// the shuffled high frequency points and the child translation matrices are
+// owned.  bytes() counts the owned data.
+//
+// uc2ue is the product of its three factors, (0) (1) (2), with (1) a
+// diagonal (stored as a column) at low frequency.  dc2de is its transpose
+// and is applied from the same factors, with transposed products.  With
+// single precision tables the factors stay in single precision (fuc2ue) and
+// are upcast one at a time, while applied, into a buffer of the library.
+class FetchDat
+{
+public:
+    DblNumMat _uep;
+    DblNumMat _ucp;
+    NumVec<CpxNumMat> _uc2ue;
+    NumVec<Cpx8NumMat> _fuc2ue;  // replaces _uc2ue with -mlib3d_FLOATTABLES
+    std::vector<cpx>* _upcast;  // held by the library
+    NumTns<CpxNumMat> _ue2uc;
+    DblNumMat _dep;
+    DblNumMat _dcp;
+    NumTns<CpxNumMat> _de2dc;
+    Ue2dcTable* _ue2dc;  // held by the library
+    bool _low;  // low frequency: uc2ue(1) is a diagonal
+    double _secs;  // time to build
+public:
+    FetchDat(): _upcast(NULL), _ue2dc(NULL), _low(false), _secs(0) {;}
+    ~FetchDat() {;}
+    const DblNumMat& uep() const { return _uep; }
+    const DblNumMat& ucp() const { return _ucp; }
+    const NumTns<CpxNumMat>& ue2uc() const { return _ue2uc; }
+    const DblNumMat& dep() const { return _dep; }
+    const DblNumMat& dcp() const { return _dcp; }
+    const NumTns<CpxNumMat>& de2dc() const { return _de2dc; }
+    Ue2dcTable* ue2dc() const { return _ue2dc; }
+    // number of equivalent (rows of uc2ue) and check (columns) points
+    int neqn() const { return rows(0); }
+    int nchk() const { return cols(2); }
+    // out = uc2ue * in (out = dc2de * in), out is resized
+    int uc2ue_apply(const CpxNumMat& in, CpxNumMat& out) const;
+    int dc2de_apply(const CpxNumMat& in, CpxNumMat& out) const;
+    // complex multiplications of one apply per column of in
+    double applymuls() const;
+    double bytes() const;
+private:
+    // factor i in double precision: the view itself, or upcast into the
+    // library buffer, which view then points to
+    const CpxNumMat& factor(int i, CpxNumMat& view) const;
+    int rows(int i) const;
+    int cols(int i) const;
+};
+
+//-----------------------------------
+// Index of a table file in the indexed format: (W, sorted direction) ->
+// (offset, size) of the serialized entry, with direction 0 at low frequency.
+// The file is TABLE_MAGIC, the serialized index, then the entries in index
+// order; offsets are from the end of the index.
+typedef std::map<std::pair<double, Index3>, std::pair<long, long> > table_index_t;
+#define TABLE_MAGIC "DDFMMIDX"
+
 //-----------------------------------
 class Mlib3d: public ComObject
 {
@@ -64,7 +172,12 @@ public:
     std::string _ldname;
     std::string _hdname;
   
-    Mlib3d(const std::string& p): ComObject(p) {}
+    Mlib3d(const std::string& p): ComObject(p), _fetchbudget(0), _fetchbytes(0),
+                                  _fetchhits(0), _fetchmisses(0), _fetchsecs(0),
+                                  _fetchsaved(0), _tablewin(MPI_WIN_NULL),
+                                  _nodecomm(MPI_COMM_NULL), _sharedbytes(0), _lazy(0),
+                                  _ldstart(0), _hdstart(0), _loadcount(0), _loadbytes(0),
+                                  _loadsecs(0), _floattables(0) {}
     ~Mlib3d() {}
   
     Kernel3d& kernel() { return _kernel; }
@@ -76,17 +189,66 @@ public:
     std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap() { return _w2hdmap; }
   
     int setup(std::map<std::string, std::string>& opts);
+
+    // With -mlib3d_SHAREDTABLES 1, setup moves the table arrays into one
+    // MPI_Win_allocate_shared segment per node, held by the node's first
+    // process, and the entries become read-only views of it.  Call
+    // ReleaseTables before MPI_Finalize to free the segment.
+    int ReleaseTables();
+    double sharedbytes() { return _sharedbytes; }
+
+    // Table files in the indexed format are read entry by entry.  With
+    // -mlib3d_LAZY 1, setup only reads the indices, and an entry is read
+    // the first time a fetch needs it.  Prefetch reads, in one go, the
+    // entries needed by the low frequency levels lws and the high frequency
+    // directions hdirs (and by their children), and reports what was read.
+    int Prefetch(const std::set<double>& lws, const std::set<Index3>& hdirs);
+    long loadcount() { return _loadcount; }
+
+    // With -mlib3d_FLOATTABLES 1 the uc2ue factors and the V list tensors
+    // are kept in single precision.  The factors are upcast one at a time
+    // into a buffer when applied; the tensors are upcast inside the V list
+    // products.
+    int floattables() { return _floattables; }
+    double tablebytes();
+    // Translation data held by this process: the tables, unless they are in
+    // the shared segment, and the fetch cache.
+    double residentbytes() {
+        return (_tablewin == MPI_WIN_NULL ? tablebytes() : 0) + _fetchbytes
+            + _upcast.capacity() * sizeof(cpx);
+    }
+    double loadbytes() { return _loadbytes; }
+    double loadsecs() { return _loadsecs; }
+
+    // Compute the translation tables instead of reading them (as the MATLAB
+    // scripts aug3d_lowdata.m and aug3d_hghdata.m do), for the levels in Ws,
+    // with the kernel set above.  The work is spread over MPI_COMM_WORLD
+    // and every process gets the full result.  The high frequency levels
+    // must be 1, 2, 4, ...
+    int GenerateLowFreq(int ACCU, std::vector<double>& Ws,
+                        std::map<double, LowFreqEntry>& w2ldmap);
+    int GenerateHghFreq(int ACCU, int NPQ, std::vector<double>& Ws,
+                        std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap);
   
-    int UpwardLowFetch(double W, DblNumMat& uep, DblNumMat& ucp,
-                        NumVec<CpxNumMat>& uc2ue, NumTns<CpxNumMat>& ue2uc);
-    int DownwardLowFetch(double W, DblNumMat& dep, DblNumMat& dcp,
-                         NumVec<CpxNumMat>& dc2de, NumTns<CpxNumMat>& de2dc,
-                         NumTns<CpxNumTns>& ue2dc, DblNumMat& uep);
-    int UpwardHighFetch(double W, Index3 dir, DblNumMat& uep, DblNumMat& ucp,
-                        NumVec<CpxNumMat>& uc2ue, NumTns<CpxNumMat>& ue2uc);
-    int DownwardHighFetch(double W, Index3 dir, DblNumMat& dep, DblNumMat& dcp,
-                          NumVec<CpxNumMat>& dc2de, NumTns<CpxNumMat>& de2dc,
-                          DblNumMat& uep);
+    // The fetches are memoized by (W, dir, upward or downward): dat points
+    // into the cache and stays valid until the next fetch.  With a budget,
+    // the least recently used entries are dropped when it is exceeded.
+    int UpwardLowFetch(double W, const FetchDat*& dat);
+    int DownwardLowFetch(double W, const FetchDat*& dat);
+    int UpwardHighFetch(double W, Index3 dir, const FetchDat*& dat);
+    int DownwardHighFetch(double W, Index3 dir, const FetchDat*& dat);
+
+    double& fetchbudget() { return _fetchbudget; }
+    double fetchbytes() { return _fetchbytes; }
+    long fetchhits() { return _fetchhits; }
+    long fetchmisses() { return _fetchmisses; }
+    // seconds spent building entries, and build time of the entries that
+    // were found in the cache instead
+    double fetchsecs() { return _fetchsecs; }
+    double fetchsaved() { return _fetchsaved; }
+    void reset_fetch_counts() {
+        _fetchhits = 0; _fetchmisses = 0; _fetchsecs = 0; _fetchsaved = 0;
+    }
   
     int HighFetchShuffle(Index3 prm, Index3 sgn, DblNumMat& tmp, DblNumMat& res);
     int HighFetchIndex3Sort(Index3 val, Index3& srt, Index3& sgn, Index3& prm);
@@ -94,8 +256,60 @@ public:
     Index3 predir(Index3);
 
 private:
+    // (upward 0 or downward 1, (W, dir)), dir = 0 at low frequency
+    typedef std::pair<int, std::pair<double, Index3> > fetch_key_t;
+
+    int ShareTables();
+
+    // Table entry, read from the file first if lazy; NULL if not in the tables
+    int LowEntry(double W, LowFreqEntry*& le);
+    int HghEntry(double W, Index3 srt, HghFreqDirEntry*& he);
+    int LoadEntry(const std::string& name, long start, std::pair<long, long> pos,
+                  std::string& buf);
+
+    int LowFreqEntryGen(int ACCU, double W, LowFreqEntry& le);
+    // sfts and ns are the far field box centers of level W and their
+    // directions, respre the entries of level W/2
+    int HghFreqDirEntryGen(int ACCU, int NPQ, double W, Index3 dir,
+                           std::vector<Point3>& sfts, std::vector<Point3>& ns,
+                           std::map<Index3, HghFreqDirEntry>& respre,
+                           HghFreqDirEntry& he);
+
+    int UpwardLowBuild(double W, FetchDat& dat);
+    int DownwardLowBuild(double W, FetchDat& dat);
+    int UpwardHighBuild(double W, Index3 dir, FetchDat& dat);
+    int DownwardHighBuild(double W, Index3 dir, FetchDat& dat);
+    // Cached entry for key, or NULL.  Counts a hit or a miss.
+    FetchDat* FetchFind(const fetch_key_t& key);
+    // New empty entry for key, to be built in place, then charged to the
+    // cache with FetchCharge, which evicts the least recently used other
+    // entries while over the budget.
+    FetchDat* FetchAdd(const fetch_key_t& key);
+    int FetchCharge(FetchDat& dat);
+
     std::map<double, LowFreqEntry> _w2ldmap;
     std::map<double, std::map<Index3, HghFreqDirEntry> > _w2hdmap;
+    std::map<fetch_key_t, std::pair<FetchDat, std::list<fetch_key_t>::iterator> > _fetchmap;
+    std::list<fetch_key_t> _fetchlru;  // most recently used first
+    double _fetchbudget;  // bytes, 0 for no limit
+    double _fetchbytes;
+    long _fetchhits;
+    long _fetchmisses;
+    double _fetchsecs;
+    double _fetchsaved;
+    std::vector<cpx> _upcast;  // single precision factors, upcast to be applied
+    MPI_Win _tablewin;  // shared table segment, MPI_WIN_NULL if private
+    MPI_Comm _nodecomm;
+    double _sharedbytes;
+    int _lazy;
+    table_index_t _ldindex;  // empty if not in the indexed format
+    table_index_t _hdindex;
+    long _ldstart;
+    long _hdstart;
+    long _loadcount;
+    double _loadbytes;
+    double _loadsecs;
+    int _floattables;
 };
 
 //-------------------
@@ -105,4 +319,13 @@ int deserialize(LowFreqEntry&, std::istream&, const std::vector<int>&);
 int serialize(const HghFreqDirEntry&, std::ostream&, const std::vector<int>&);
 int deserialize(HghFreqDirEntry&, std::istream&, const std::vector<int>&);
 
+//-------------------
+// Write tables in the indexed format, from process 0, to data/name
+int SharedWriteIndexed(std::string name, const std::map<double, LowFreqEntry>& w2ldmap);
+int SharedWriteIndexed(std::string name,
+                       const std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap);
+// Read the index of data/name on process 0 and broadcast it.  indexed is
+// false, and the index empty, if the file is in the plain format.
+int SharedReadIndex(std::string name, bool& indexed, table_index_t& index, long& start);
+
 #endif
@@ -121,6 +121,7 @@ public:
     F* data() const { return _data; }
     int m() const { return _m; }
     int n() const { return _n; }
+    bool owndata() const { return _owndata; }
 
 private:
     int _m;
@@ -205,5 +206,6 @@ typedef NumMat<bool>   BolNumMat;
 typedef NumMat<int>    IntNumMat;
 typedef NumMat<double> DblNumMat;
 typedef NumMat<cpx>    CpxNumMat;
+typedef NumMat<cpx8>   Cpx8NumMat;
 
 #endif
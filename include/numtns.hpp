@@ -229,5 +229,6 @@ typedef NumTns<bool>   BolNumTns;
 typedef NumTns<int>    IntNumTns;
 typedef NumTns<double> DblNumTns;
 typedef NumTns<cpx>    CpxNumTns;
+typedef NumTns<cpx8>   Cpx8NumTns;
 
 #endif
@@ -25,5 +25,7 @@ int SeparateWrite(std::string name, std::ostringstream& os);
 
 int SharedRead(std::string name, std::istringstream& is);
 int SharedWrite(std::string name, std::ostringstream& os);
+// Whether the file read by SharedRead(name, ...) exists, on every process
+int SharedExists(std::string name, bool& exists);
 
 #endif
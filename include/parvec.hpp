@@ -20,6 +20,259 @@
 
 #include "commoninc.hpp"
 #include "serialize.hpp"
+#include "bufstream.hpp"
+
+//--------------------------------------------
+// How ParVec moves its messages.  PARVEC_EXCHANGE_DENSE exchanges the sizes
+// with MPI_Alltoall and posts a send and a receive for every process.
+// PARVEC_EXCHANGE_SPARSE only sends the nonempty messages, with synchronous
+// sends and a nonblocking barrier to detect the end of the exchange (the NBX
+// protocol of Hoefler, Siebert and Lumsdaine), so each process only talks to
+// its actual neighbors.  PARVEC_EXCHANGE_NODE aggregates the messages by
+// node: every process hands its messages to the leader of its node, the
+// leaders exchange one message per pair of nodes and hand the messages out on
+// the receiving node, so only the leaders talk across nodes.
+// PARVEC_EXCHANGE_AUTO takes the sparse path when no process has more than
+// 1/PARVEC_SPARSE_RATIO of the others as neighbors and there are at least
+// PARVEC_SPARSE_MINSIZE processes, and the node path instead when the pattern
+// is not sparse, there are several nodes and one of them runs at least
+// PARVEC_NODE_MINSIZE processes.
+enum {
+    PARVEC_EXCHANGE_AUTO = 0,
+    PARVEC_EXCHANGE_DENSE = 1,
+    PARVEC_EXCHANGE_SPARSE = 2,
+    PARVEC_EXCHANGE_NODE = 3,
+};
+
+enum {
+    PARVEC_SPARSE_MINSIZE = 16,
+    PARVEC_SPARSE_RATIO = 4,
+    PARVEC_NODE_MINSIZE = 8,
+    PARVEC_SPARSE_TAG = 4096,
+    PARVEC_PLAN_TAG = 4098,
+    PARVEC_ASYNC_TAG = 4099,
+};
+
+// Tag of the next sparse exchange.  A process can be at most one sparse
+// exchange ahead of the others (it cannot get past the barrier of the next
+// one), so alternating two tags keeps consecutive exchanges apart.
+inline int ParVecSparseTag() {
+    static int count = 0;
+    return PARVEC_SPARSE_TAG + (count++ & 1);
+}
+
+// Pointer to the data of buf, NULL if it is empty.
+inline char* ParVecBufPtr(std::vector<char>& buf) {
+    return buf.empty() ? NULL : &(buf[0]);
+}
+
+// The node exchange moves records (dst, src, nbytes) followed by nbytes
+// bytes.  Append every record of buf to out[group[dst]].
+inline int ParVecRegroup(std::vector<char>& buf, const std::vector<int>& group,
+                         std::vector< std::vector<char> >& out) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVecRegroup");
+#endif
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        int hdr[3];
+        CHECK_TRUE( pos + sizeof(hdr) <= buf.size() );
+        MemIStream iss(&(buf[pos]), sizeof(hdr));
+        iss.read((char*)hdr, sizeof(hdr));
+        size_t len = sizeof(hdr) + hdr[2];
+        CHECK_TRUE( pos + len <= buf.size() );
+        std::vector<char>& dst = out[group[hdr[0]]];
+        dst.insert(dst.end(), buf.begin() + pos, buf.begin() + pos + len);
+        pos += len;
+    }
+    return 0;
+}
+
+// Concatenate the sbuf of every process of comm into rbuf on its rank 0.
+inline int ParVecGatherBufs(std::vector<char>& sbuf, std::vector<char>& rbuf, MPI_Comm comm) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVecGatherBufs");
+#endif
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int ssz = sbuf.size();
+    std::vector<int> rszvec(size, 0);
+    std::vector<int> displs(size, 0);
+    SAFE_FUNC_EVAL( MPI_Gather(&ssz, 1, MPI_INT, &(rszvec[0]), 1, MPI_INT, 0, comm) );
+    for (int k = 1; k < size; k++) {
+        displs[k] = displs[k - 1] + rszvec[k - 1];
+    }
+    rbuf.resize(rank == 0 ? displs[size - 1] + rszvec[size - 1] : 0);
+    SAFE_FUNC_EVAL( MPI_Gatherv(ParVecBufPtr(sbuf), ssz, MPI_BYTE, ParVecBufPtr(rbuf),
+                                &(rszvec[0]), &(displs[0]), MPI_BYTE, 0, comm) );
+    return 0;
+}
+
+// Send sbufs[k] from rank 0 of comm to its rank k, into rbuf.
+inline int ParVecScatterBufs(std::vector< std::vector<char> >& sbufs, std::vector<char>& rbuf,
+                             MPI_Comm comm) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVecScatterBufs");
+#endif
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    std::vector<int> sszvec(size, 0);
+    std::vector<int> displs(size, 0);
+    std::vector<char> sbuf;
+    if (rank == 0) {
+        for (int k = 0; k < size; k++) {
+            sszvec[k] = sbufs[k].size();
+            displs[k] = sbuf.size();
+            sbuf.insert(sbuf.end(), sbufs[k].begin(), sbufs[k].end());
+        }
+    }
+    int rsz = 0;
+    SAFE_FUNC_EVAL( MPI_Scatter(&(sszvec[0]), 1, MPI_INT, &rsz, 1, MPI_INT, 0, comm) );
+    rbuf.resize(rsz);
+    SAFE_FUNC_EVAL( MPI_Scatterv(ParVecBufPtr(sbuf), &(sszvec[0]), &(displs[0]), MPI_BYTE,
+                                 ParVecBufPtr(rbuf), rsz, MPI_BYTE, 0, comm) );
+    return 0;
+}
+
+// Send sbufs[k] to rank k of comm and concatenate what arrives into rbuf.
+inline int ParVecAlltoallBufs(std::vector< std::vector<char> >& sbufs, std::vector<char>& rbuf,
+                              MPI_Comm comm) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVecAlltoallBufs");
+#endif
+    int size;
+    MPI_Comm_size(comm, &size);
+    std::vector<int> sszvec(size, 0), sdispls(size, 0);
+    std::vector<int> rszvec(size, 0), rdispls(size, 0);
+    std::vector<char> sbuf;
+    for (int k = 0; k < size; k++) {
+        sszvec[k] = sbufs[k].size();
+        sdispls[k] = sbuf.size();
+        sbuf.insert(sbuf.end(), sbufs[k].begin(), sbufs[k].end());
+    }
+    SAFE_FUNC_EVAL( MPI_Alltoall(&(sszvec[0]), 1, MPI_INT, &(rszvec[0]), 1, MPI_INT, comm) );
+    for (int k = 1; k < size; k++) {
+        rdispls[k] = rdispls[k - 1] + rszvec[k - 1];
+    }
+    rbuf.resize(rdispls[size - 1] + rszvec[size - 1]);
+    SAFE_FUNC_EVAL( MPI_Alltoallv(ParVecBufPtr(sbuf), &(sszvec[0]), &(sdispls[0]), MPI_BYTE,
+                                  ParVecBufPtr(rbuf), &(rszvec[0]), &(rdispls[0]), MPI_BYTE,
+                                  comm) );
+    return 0;
+}
+
+template <class Key, class Data, class Partition> class ParVec;
+
+//--------------------------------------------
+// Communication plan of a getBegin(keyvec)/putBegin(keyvec) call that is
+// repeated with the same keys, e.g. once per Wave3d::eval on a fixed
+// geometry.  The first call goes through the usual key and size exchanges
+// and records who sends how many entries and bytes to whom, and, for a get,
+// which keys every other process asks for.  Later calls only pack the
+// entries and move them with persistent requests (MPI_Send_init and
+// MPI_Recv_init, created once per buffer).  If the keys or any message size
+// change on any process, the plan is rebuilt.  Calls that take the node path
+// are not recorded, since a replay would send point to point and give up the
+// aggregation; they go through the full exchange every time.
+template <class Key>
+class ParVecPlan
+{
+public:
+    ParVecPlan(): _valid(false), _replays(0), _skips(0) {;}
+    ~ParVecPlan() { clear(); }
+    bool valid() { return _valid; }
+    // number of calls served by the recorded plan
+    int replays() { return _replays; }
+    // number of calls that took the node path and were not recorded
+    int skips() { return _skips; }
+    // forget the plan and free its requests
+    int clear() {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        for (int i = 0; i < _reqs.size(); i++) {
+            if (!finalized && _reqs[i] != MPI_REQUEST_NULL) {
+                MPI_Request_free(&(_reqs[i]));
+            }
+        }
+        _reqs.clear();
+        _bufs.clear();
+        _keyvec.clear();
+        _skeyvec.clear();
+        _speers.clear();  _sbytes.clear();  _snb.clear();
+        _rpeers.clear();  _rbytes.clear();  _rnb.clear();
+        _valid = false;
+        _replays = 0;
+        _skips = 0;
+        return 0;
+    }
+private:
+    template <class K, class D, class P> friend class ParVec;
+    // the requests hold on to the buffers, so copies are not allowed
+    ParVecPlan(const ParVecPlan&);
+    ParVecPlan& operator=(const ParVecPlan&);
+
+    bool _valid;
+    int _replays;
+    int _skips;
+    std::vector<Key> _keyvec;  // keys of the recorded call
+    std::vector< std::vector<Key> > _skeyvec;  // get: keys sent to each process
+    std::vector<int> _speers, _sbytes, _snb;  // processes we send to, bytes, entries
+    std::vector<int> _rpeers, _rbytes, _rnb;  // processes we receive from, bytes, entries
+    std::vector<MPI_Request> _reqs;  // receives (as in _rpeers), then sends
+    std::vector<char*> _bufs;  // buffer each request was created on
+};
+
+//--------------------------------------------
+// Handle of an exchange started with ParVec::getStart or putStart.  The
+// exchange runs while the caller computes; test() progresses it, and wait()
+// completes it and unpacks the received entries (as getEnd/putEnd).  The
+// handle also measures how much of the communication was hidden: the time
+// from the start to the first test() that found it complete, or to wait()
+// if none did.
+template <class Key, class Data, class Partition>
+class ParVecHandle
+{
+public:
+    ParVecHandle(): _pv(NULL), _put(false), _startsecs(0), _waitsecs(0), _hiddensecs(0) {;}
+    bool active() { return _pv != NULL; }
+    int test(bool& done) {
+        done = true;
+        if (_pv == NULL) {
+            return 0;
+        }
+        SAFE_FUNC_EVAL( _pv->testExchange(done) );
+        if (done && _tdone < 0) {
+            _tdone = MPI_Wtime();
+        }
+        return 0;
+    }
+    int wait() {
+        CHECK_TRUE(_pv != NULL);
+        double t0 = MPI_Wtime();
+        _hiddensecs = (_tdone < 0 ? t0 : _tdone) - _tstart;
+        if (_put) {
+            SAFE_FUNC_EVAL( _pv->putEnd(_mask) );
+        } else {
+            SAFE_FUNC_EVAL( _pv->getEnd(_mask) );
+        }
+        _waitsecs = MPI_Wtime() - t0;
+        _pv = NULL;
+        return 0;
+    }
+    // seconds spent in the start call, in wait(), and overlapped with other work
+    double startsecs() { return _startsecs; }
+    double waitsecs() { return _waitsecs; }
+    double hiddensecs() { return _hiddensecs; }
+private:
+    friend class ParVec<Key, Data, Partition>;
+    ParVec<Key, Data, Partition>* _pv;
+    std::vector<int> _mask;
+    bool _put;
+    double _tstart, _tdone;
+    double _startsecs, _waitsecs, _hiddensecs;
+};
 
 //--------------------------------------------
 template <class Key, class Data, class Partition>
@@ -29,11 +282,21 @@ public:
     std::map<Key,Data> _lclmap;
     Partition _prtn; //has function owner:Key->pid
 
-    ParVec() {;}
+    ParVec(): _exchange(PARVEC_EXCHANGE_AUTO), _sparse(false), _node(false), _trailer(false),
+              _replayed(false), _plan(NULL), _record(NULL), _async(false) {;}
     ~ParVec() {;}
     //
     std::map<Key,Data>& lclmap() { return _lclmap; }
     Partition& prtn() { return _prtn; }
+    // PARVEC_EXCHANGE_AUTO (default), PARVEC_EXCHANGE_DENSE, PARVEC_EXCHANGE_SPARSE
+    // or PARVEC_EXCHANGE_NODE
+    int& exchange() { return _exchange; }
+    // whether the last exchange took the sparse path
+    bool sparse() { return _sparse; }
+    // whether the last exchange was aggregated by node
+    bool node() { return _node; }
+    // whether the last exchange replayed a recorded plan
+    bool replayed() { return _replayed; }
     int insert(Key, Data&);
     
     // Get the data associated with Key from the local map
@@ -54,6 +317,27 @@ public:
     // put data for all entries with key in keyvec
     int putBegin(std::vector<Key>& keyvec, const std::vector<int>& mask);    
 
+    // Same as getBegin(keyvec, mask) and putBegin(keyvec, mask), recording
+    // the communication in plan on the first call and replaying it after.
+    // Finish with getEnd and putEnd as usual.
+    int getBegin(std::vector<Key>& keyvec, const std::vector<int>& mask,
+                 ParVecPlan<Key>& plan);
+    int putBegin(std::vector<Key>& keyvec, const std::vector<int>& mask,
+                 ParVecPlan<Key>& plan);
+
+    // Asynchronous versions of getBegin(keyvec, ...) and putBegin(keyvec,
+    // ...), with an optional plan.  Neither waits for the other processes
+    // once the messages are posted; finish with h.wait().  The key exchange
+    // of a get, the size exchange and the plan check are still collective,
+    // so every process must start the same exchanges in the same order, and
+    // only one exchange per ParVec can be in flight.
+    int getStart(std::vector<Key>& keyvec, const std::vector<int>& mask,
+                 ParVecHandle<Key,Data,Partition>& h, ParVecPlan<Key>* plan = NULL);
+    int putStart(std::vector<Key>& keyvec, const std::vector<int>& mask,
+                 ParVecHandle<Key,Data,Partition>& h, ParVecPlan<Key>* plan = NULL);
+    // done is set if all messages of the exchange in flight have arrived
+    int testExchange(bool& done);
+
     int putEnd(const std::vector<int>& mask);
 
     int expand(std::vector<Key>& keyvec); //allocate space for not-owned entries
@@ -63,28 +347,60 @@ public:
     int initialize_data() {
 	_kbytes_received = 0;
 	_kbytes_sent = 0;
+	_kbytes_copy_saved = 0;
+	return 0;
     }
     int kbytes_received() { return _kbytes_received; }
     int kbytes_sent() { return _kbytes_sent; }
+    // Memory traffic avoided by packing straight into the send buffers and
+    // unpacking in place: the stringstream path copied every sent byte twice
+    // more (str() and into _sbufvec) and every received byte twice more
+    // (into a string and into the istringstream).
+    int kbytes_copy_saved() { return _kbytes_copy_saved; }
 
 private:
     int resetVecs();
     int getSizes(std::vector<int>& rszvec, std::vector<int>& sifvec);
     int makeBufReqs(std::vector<int>& rszvec, std::vector<int>& sszvec);
-    int strs2vec(std::vector<std::ostringstream*>& ossvec);
+    int openSendBufs(std::vector<VecOStream*>& ossvec);
+    int closeSendBufs(std::vector<VecOStream*>& ossvec);
+    int packGet(std::vector< std::vector<Key> >& rkeyvec, const std::vector<int>& mask);
+    int packPut(std::vector<Key>& keyvec, const std::vector<int>& mask);
+    int recordPlan(std::vector<Key>& keyvec, std::vector< std::vector<Key> >* rkeyvec);
+    int startPlan(ParVecPlan<Key>& plan, std::vector<Key>& keyvec, bool& ok);
+    int chooseExchange(const std::vector<int>& snbvec);
+    int sendBufs();
+    template <class T>
+    int sparseExchange(std::vector< std::vector<T> >& svec,
+                       std::vector< std::vector<T> >& rvec);
+    template <class T>
+    int nodeExchange(std::vector< std::vector<T> >& svec,
+                     std::vector< std::vector<T> >& rvec);
 
     //temporary data
     std::vector<int> _snbvec;
     std::vector<int> _rnbvec;
+    // Per-peer message buffers.  They are kept between exchanges (the send
+    // buffers are only emptied, the receive buffers resized), so their
+    // capacity is reused by the next exchange.
     std::vector< std::vector<char> > _sbufvec;
     std::vector< std::vector<char> > _rbufvec;
     MPI_Request *_reqs;
     MPI_Status  *_stats;
     std::string _tag;
+    int _exchange;
+    bool _sparse;
+    bool _node;
+    bool _trailer;  // the send buffers of the last exchange end with the entry count
+    bool _replayed;
+    ParVecPlan<Key>* _plan;  // plan whose requests are in flight
+    ParVecPlan<Key>* _record;  // plan to record the current exchange in
+    bool _async;  // current exchange started by getStart/putStart
 
     // ANALYSIS INFO
     int _kbytes_received;
     int _kbytes_sent;
+    int _kbytes_copy_saved;
 };
 
 //--------------------------------------------
@@ -142,40 +458,494 @@ int ParVec<Key,Data,Partition>::makeBufReqs(std::vector<int>& rszvec,
     CallStackEntry entry("ParVec::makeBufReqs");
 #endif
     int mpisize = getMPISize();
+    // asynchronous exchanges have their own tag, so that blocking exchanges
+    // that run in the meantime cannot take their messages
+    int tag = _async ? PARVEC_ASYNC_TAG : 0;
     for (int k = 0; k < mpisize; k++) {
         _rbufvec[k].resize(rszvec[k]);
     }
     for (int k = 0; k < mpisize; k++) {
         // TODO (Austin): Is there a problem if rszvec or sszvec is 0?
-        SAFE_FUNC_EVAL( MPI_Irecv((void *)&(_rbufvec[k][0]), rszvec[k], MPI_BYTE, k, 0,
+        SAFE_FUNC_EVAL( MPI_Irecv((void *)&(_rbufvec[k][0]), rszvec[k], MPI_BYTE, k, tag,
                       MPI_COMM_WORLD, &_reqs[2 * k] ) );
-        SAFE_FUNC_EVAL( MPI_Isend((void *)&(_sbufvec[k][0]), sszvec[k], MPI_BYTE, k, 0,
+        SAFE_FUNC_EVAL( MPI_Isend((void *)&(_sbufvec[k][0]), sszvec[k], MPI_BYTE, k, tag,
                       MPI_COMM_WORLD, &_reqs[2 * k + 1] ) );
 	_kbytes_received += rszvec[k] / 1024;
 	_kbytes_sent += sszvec[k] / 1024;
+	_kbytes_copy_saved += 2 * (rszvec[k] + sszvec[k]) / 1024;
     }
     return 0;
 }
 
 //--------------------------------------------
 template <class Key, class Data, class Partition>
-int ParVec<Key,Data,Partition>::strs2vec(std::vector<std::ostringstream *>& ossvec) {
+int ParVec<Key,Data,Partition>::openSendBufs(std::vector<VecOStream *>& ossvec) {
 #ifndef RELEASE
-    CallStackEntry entry("ParVec::strs2vec");
+    CallStackEntry entry("ParVec::openSendBufs");
 #endif
     int mpisize = getMPISize();
+    _sbufvec.resize(mpisize);
+    _rbufvec.resize(mpisize);
+    ossvec.resize(mpisize);
     for (int k = 0; k < mpisize; k++) {
-        std::string tmp( ossvec[k]->str() );
         _sbufvec[k].clear();
-        _sbufvec[k].insert(_sbufvec[k].end(), tmp.begin(), tmp.end());
+        ossvec[k] = new VecOStream(_sbufvec[k]);
     }
+    return 0;
+}
+
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::closeSendBufs(std::vector<VecOStream *>& ossvec) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::closeSendBufs");
+#endif
+    int mpisize = getMPISize();
     for(int k = 0; k < mpisize; k++) {
+        CHECK_TRUE( ossvec[k]->good() );
         delete ossvec[k];
         ossvec[k] = NULL;
     }
     return 0;
 }
 
+//--------------------------------------------
+// Pack the entries with the keys rkeyvec[k] asked for by process k.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::packGet(std::vector< std::vector<Key> >& rkeyvec,
+                                        const std::vector<int>& mask) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::packGet");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    std::vector<VecOStream*> ossvec;
+    openSendBufs(ossvec);
+    for(int k = 0; k < mpisize; k++) {
+        for(int g = 0; g < rkeyvec[k].size(); g++) {
+            Key curkey = rkeyvec[k][g];
+            typename std::map<Key, Data>::iterator mi = _lclmap.find(curkey);
+            CHECK_TRUE( mi!=_lclmap.end() );
+            CHECK_TRUE( _prtn.owner(curkey) == mpirank );
+            Key key = mi->first;
+            const Data& dat = mi->second;
+            SAFE_FUNC_EVAL( serialize(key, *(ossvec[k]), mask) );
+            SAFE_FUNC_EVAL( serialize(dat, *(ossvec[k]), mask) );
+            _snbvec[k]++; //LEXING: VERY IMPORTANT
+        }
+    }
+    closeSendBufs(ossvec);
+    return 0;
+}
+
+//--------------------------------------------
+// Pack the entries with keys in keyvec that other processes own.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::packPut(std::vector<Key>& keyvec,
+                                        const std::vector<int>& mask) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::packPut");
+#endif
+    int mpirank = getMPIRank();
+    std::vector<VecOStream*> ossvec;
+    openSendBufs(ossvec);
+    for (int i=0; i<keyvec.size(); i++) {
+        Key key = keyvec[i];
+        int k = _prtn.owner(key); //the owner
+        if (k != mpirank) {
+            typename std::map<Key, Data>::iterator mi = _lclmap.find(key);
+            CHECK_TRUE( mi!=_lclmap.end() );
+            CHECK_TRUE( key == mi->first );
+            Data& dat = mi->second;
+            SAFE_FUNC_EVAL( serialize(key, *(ossvec[k]), mask) );
+            SAFE_FUNC_EVAL( serialize(dat, *(ossvec[k]), mask) );
+            _snbvec[k]++;
+        }
+    }
+    closeSendBufs(ossvec);
+    return 0;
+}
+
+//--------------------------------------------
+// Record the exchange that sendBufs just started in _record.  rkeyvec holds
+// the keys each process asked for (get), or is NULL (put).  A node exchange
+// is only counted, and leaves the plan invalid.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::recordPlan(std::vector<Key>& keyvec,
+                                           std::vector< std::vector<Key> >* rkeyvec) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::recordPlan");
+#endif
+    int mpisize = getMPISize();
+    ParVecPlan<Key>& plan = *_record;
+    int skips = plan._skips;
+    plan.clear();
+    if (_node) {
+        // chooseExchange agrees on every process, so the plan stays invalid
+        // everywhere
+        plan._skips = skips + 1;
+        return 0;
+    }
+    plan._skips = skips;
+    plan._keyvec = keyvec;
+    if (rkeyvec != NULL) {
+        plan._skeyvec.resize(mpisize);
+    }
+    for (int k = 0; k < mpisize; k++) {
+        if (_snbvec[k] > 0) {
+            // the blocking sparse path appended the entry count
+            int nbytes = _sbufvec[k].size() - (_trailer ? sizeof(int) : 0);
+            plan._speers.push_back(k);
+            plan._sbytes.push_back(nbytes);
+            plan._snb.push_back(_snbvec[k]);
+            if (rkeyvec != NULL) {
+                plan._skeyvec[k] = (*rkeyvec)[k];
+            }
+        }
+        if (_rnbvec[k] > 0) {
+            plan._rpeers.push_back(k);
+            plan._rbytes.push_back(_rbufvec[k].size());
+            plan._rnb.push_back(_rnbvec[k]);
+        }
+    }
+    int nreqs = plan._rpeers.size() + plan._speers.size();
+    plan._reqs.resize(nreqs, MPI_REQUEST_NULL);
+    plan._bufs.resize(nreqs, NULL);
+    plan._valid = true;
+    return 0;
+}
+
+//--------------------------------------------
+// Start the recorded exchange on the packed send buffers.  ok is set, on
+// every process, to whether the plan still holds, that is, whether the keys
+// and all message sizes are the ones recorded.  Nothing is sent otherwise.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::startPlan(ParVecPlan<Key>& plan, std::vector<Key>& keyvec,
+                                          bool& ok) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::startPlan");
+#endif
+    int mpisize = getMPISize();
+    int lclok = (keyvec == plan._keyvec);
+    int nsent = 0;
+    for (int k = 0; k < mpisize; k++) {
+        if (_snbvec[k] > 0) {
+            nsent++;
+        }
+    }
+    lclok = lclok && (nsent == plan._speers.size());
+    for (int i = 0; lclok && i < plan._speers.size(); i++) {
+        int k = plan._speers[i];
+        lclok = (_snbvec[k] == plan._snb[i] && _sbufvec[k].size() == plan._sbytes[i]);
+    }
+    int allok = 0;
+    SAFE_FUNC_EVAL( MPI_Allreduce(&lclok, &allok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD) );
+    ok = (allok != 0);
+    if (!ok) {
+        return 0;
+    }
+    int nrecv = plan._rpeers.size();
+    for (int i = 0; i < plan._reqs.size(); i++) {
+        bool isrecv = (i < nrecv);
+        int k = isrecv ? plan._rpeers[i] : plan._speers[i - nrecv];
+        int nbytes = isrecv ? plan._rbytes[i] : plan._sbytes[i - nrecv];
+        if (isrecv) {
+            _rbufvec[k].resize(nbytes);
+            _rnbvec[k] = plan._rnb[i];
+            _kbytes_received += nbytes / 1024;
+        } else {
+            _kbytes_sent += nbytes / 1024;
+        }
+        _kbytes_copy_saved += 2 * nbytes / 1024;
+        char* buf = isrecv ? &(_rbufvec[k][0]) : &(_sbufvec[k][0]);
+        if (plan._bufs[i] != buf) {
+            // first use, or the buffer moved
+            if (plan._reqs[i] != MPI_REQUEST_NULL) {
+                SAFE_FUNC_EVAL( MPI_Request_free(&(plan._reqs[i])) );
+            }
+            if (isrecv) {
+                SAFE_FUNC_EVAL( MPI_Recv_init(buf, nbytes, MPI_BYTE, k, PARVEC_PLAN_TAG,
+                                              MPI_COMM_WORLD, &(plan._reqs[i])) );
+            } else {
+                SAFE_FUNC_EVAL( MPI_Send_init(buf, nbytes, MPI_BYTE, k, PARVEC_PLAN_TAG,
+                                              MPI_COMM_WORLD, &(plan._reqs[i])) );
+            }
+            plan._bufs[i] = buf;
+        }
+    }
+    if (!plan._reqs.empty()) {
+        SAFE_FUNC_EVAL( MPI_Startall(plan._reqs.size(), &(plan._reqs[0])) );
+    }
+    for (int k = 0; k < 2 * mpisize; k++) {
+        _reqs[k] = MPI_REQUEST_NULL;
+    }
+    plan._replays++;
+    _plan = &plan;
+    _sparse = false;
+    _node = false;
+    _replayed = true;
+    return 0;
+}
+
+//--------------------------------------------
+// Decide, collectively, whether this exchange takes the sparse or the node
+// path.  snbvec holds the number of entries this process sends to each
+// process.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::chooseExchange(const std::vector<int>& snbvec) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::chooseExchange");
+#endif
+    int mpisize = getMPISize();
+    _replayed = false;
+    if (_exchange != PARVEC_EXCHANGE_AUTO) {
+        _sparse = (_exchange == PARVEC_EXCHANGE_SPARSE);
+        _node = (_exchange == PARVEC_EXCHANGE_NODE);
+        return 0;
+    }
+    _sparse = false;
+    _node = false;
+    if (mpisize < PARVEC_SPARSE_MINSIZE) {
+        return 0;
+    }
+    int npeers = 0;
+    for (int k = 0; k < mpisize; k++) {
+        if (snbvec[k] > 0) {
+            npeers++;
+        }
+    }
+    int maxpeers = 0;
+    SAFE_FUNC_EVAL( MPI_Allreduce(&npeers, &maxpeers, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD) );
+    _sparse = (maxpeers * PARVEC_SPARSE_RATIO <= mpisize);
+    if (!_sparse) {
+        MPINodeInfo* info;
+        SAFE_FUNC_EVAL( getMPINodeInfo(info) );
+        _node = (info->nnodes > 1 && info->maxnodesize >= PARVEC_NODE_MINSIZE);
+    }
+    return 0;
+}
+
+//--------------------------------------------
+// Send svec[k] to every process k for which it is nonempty and receive the
+// messages of the processes that send to us into rvec (the others get an
+// empty rvec[k]).  Synchronous sends complete only once they are matched, so
+// a process that has completed all of them enters a nonblocking barrier, and
+// the exchange is over when the barrier completes.
+template <class Key, class Data, class Partition>
+template <class T>
+int ParVec<Key,Data,Partition>::sparseExchange(std::vector< std::vector<T> >& svec,
+                                               std::vector< std::vector<T> >& rvec) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::sparseExchange");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    int tag = ParVecSparseTag();
+    rvec.resize(mpisize);
+    for (int k = 0; k < mpisize; k++) {
+        rvec[k].clear();
+    }
+    std::vector<MPI_Request> sreqs;
+    for (int k = 0; k < mpisize; k++) {
+        if (k != mpirank && !svec[k].empty()) {
+            sreqs.push_back(MPI_REQUEST_NULL);
+            SAFE_FUNC_EVAL( MPI_Issend((void *)&(svec[k][0]), svec[k].size() * sizeof(T),
+                                       MPI_BYTE, k, tag, MPI_COMM_WORLD, &sreqs.back()) );
+        }
+    }
+    MPI_Request breq = MPI_REQUEST_NULL;
+    bool inbarrier = false;
+    while (true) {
+        int flag = 0;
+        MPI_Status stat;
+        SAFE_FUNC_EVAL( MPI_Iprobe(MPI_ANY_SOURCE, tag, MPI_COMM_WORLD, &flag, &stat) );
+        if (flag) {
+            int k = stat.MPI_SOURCE;
+            int nbytes = 0;
+            SAFE_FUNC_EVAL( MPI_Get_count(&stat, MPI_BYTE, &nbytes) );
+            CHECK_TRUE( nbytes % sizeof(T) == 0 );
+            rvec[k].resize(nbytes / sizeof(T));
+            SAFE_FUNC_EVAL( MPI_Recv((void *)&(rvec[k][0]), nbytes, MPI_BYTE, k, tag,
+                                     MPI_COMM_WORLD, MPI_STATUS_IGNORE) );
+            continue;
+        }
+        if (!inbarrier) {
+            int done = 1;
+            if (!sreqs.empty()) {
+                SAFE_FUNC_EVAL( MPI_Testall(sreqs.size(), &(sreqs[0]), &done,
+                                            MPI_STATUSES_IGNORE) );
+            }
+            if (done) {
+                SAFE_FUNC_EVAL( MPI_Ibarrier(MPI_COMM_WORLD, &breq) );
+                inbarrier = true;
+            }
+        } else {
+            int done = 0;
+            SAFE_FUNC_EVAL( MPI_Test(&breq, &done, MPI_STATUS_IGNORE) );
+            if (done) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+//--------------------------------------------
+// Same as sparseExchange, aggregated by node (see PARVEC_EXCHANGE_NODE).  Each
+// nonempty svec[k] becomes a record (k, this process, bytes) followed by the
+// bytes; the records are gathered on the node leader, regrouped by
+// destination node, exchanged between the leaders, regrouped by destination
+// process and scattered on the receiving nodes.  A process only sends one
+// message and receives one, and a leader exchanges one per node.
+template <class Key, class Data, class Partition>
+template <class T>
+int ParVec<Key,Data,Partition>::nodeExchange(std::vector< std::vector<T> >& svec,
+                                             std::vector< std::vector<T> >& rvec) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::nodeExchange");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    MPINodeInfo* info;
+    SAFE_FUNC_EVAL( getMPINodeInfo(info) );
+    int noderank, nodesize;
+    MPI_Comm_rank(info->nodecomm, &noderank);
+    MPI_Comm_size(info->nodecomm, &nodesize);
+    rvec.resize(mpisize);
+    for (int k = 0; k < mpisize; k++) {
+        rvec[k].clear();
+    }
+    rvec[mpirank] = svec[mpirank];
+
+    //1. records of this process, to the node leader
+    std::vector<char> mybuf;
+    {
+        VecOStream os(mybuf);
+        for (int k = 0; k < mpisize; k++) {
+            if (k != mpirank && !svec[k].empty()) {
+                int hdr[3] = { k, mpirank, int(svec[k].size() * sizeof(T)) };
+                os.write((char*)hdr, sizeof(hdr));
+                os.write((char*)&(svec[k][0]), hdr[2]);
+            }
+        }
+    }
+    std::vector<char> nodebuf;
+    SAFE_FUNC_EVAL( ParVecGatherBufs(mybuf, nodebuf, info->nodecomm) );
+
+    //2. leaders: one message per destination node, then one per local process
+    std::vector< std::vector<char> > localbufs;
+    if (noderank == 0) {
+        std::vector< std::vector<char> > nodebufs(info->nnodes);
+        SAFE_FUNC_EVAL( ParVecRegroup(nodebuf, info->nodeof, nodebufs) );
+        SAFE_FUNC_EVAL( ParVecAlltoallBufs(nodebufs, nodebuf, info->leadercomm) );
+        localbufs.resize(nodesize);
+        SAFE_FUNC_EVAL( ParVecRegroup(nodebuf, info->localof, localbufs) );
+    }
+    SAFE_FUNC_EVAL( ParVecScatterBufs(localbufs, mybuf, info->nodecomm) );
+
+    //3. records for this process
+    size_t pos = 0;
+    while (pos < mybuf.size()) {
+        int hdr[3];
+        CHECK_TRUE( pos + sizeof(hdr) <= mybuf.size() );
+        MemIStream iss(&(mybuf[pos]), mybuf.size() - pos);
+        iss.read((char*)hdr, sizeof(hdr));
+        CHECK_TRUE( hdr[0] == mpirank && hdr[2] % sizeof(T) == 0 );
+        CHECK_TRUE( pos + sizeof(hdr) + hdr[2] <= mybuf.size() );
+        std::vector<T>& dst = rvec[hdr[1]];
+        dst.resize(hdr[2] / sizeof(T));
+        if (hdr[2] > 0) {
+            iss.read((char*)&(dst[0]), hdr[2]);
+        }
+        pos += sizeof(hdr) + hdr[2];
+    }
+    return 0;
+}
+
+//--------------------------------------------
+// Move the packed send buffers to their destinations, either through
+// getSizes and makeBufReqs or with sparseExchange or nodeExchange.  In the
+// last two cases the entry count travels as a trailing int of each message
+// and the exchange is complete on return.  An asynchronous sparse exchange
+// only runs sparseExchange on the (entries, bytes) of each message and then
+// posts the messages themselves, to be completed later; the node exchange is
+// always complete on return.
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::sendBufs() {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::sendBufs");
+#endif
+    int mpisize = getMPISize();
+    _trailer = false;
+    if (!_sparse && !_node) {
+        std::vector<int> sszvec;
+        std::vector<int> rszvec;
+        SAFE_FUNC_EVAL( getSizes(rszvec, sszvec) );
+        SAFE_FUNC_EVAL( makeBufReqs(rszvec, sszvec) );
+        return 0;
+    }
+    if (_sparse && _async) {
+        std::vector< std::vector<int> > sinfvec(mpisize);
+        std::vector< std::vector<int> > rinfvec;
+        for (int k = 0; k < mpisize; k++) {
+            if (_snbvec[k] > 0) {
+                sinfvec[k].push_back(_snbvec[k]);
+                sinfvec[k].push_back(_sbufvec[k].size());
+            }
+        }
+        SAFE_FUNC_EVAL( sparseExchange(sinfvec, rinfvec) );
+        for (int k = 0; k < mpisize; k++) {
+            _reqs[2 * k] = MPI_REQUEST_NULL;
+            _reqs[2 * k + 1] = MPI_REQUEST_NULL;
+            _rnbvec[k] = 0;
+            if (!rinfvec[k].empty()) {
+                CHECK_TRUE( rinfvec[k].size() == 2 );
+                _rnbvec[k] = rinfvec[k][0];
+                _rbufvec[k].resize(rinfvec[k][1]);
+                SAFE_FUNC_EVAL( MPI_Irecv((void *)&(_rbufvec[k][0]), rinfvec[k][1], MPI_BYTE, k,
+                                          PARVEC_ASYNC_TAG, MPI_COMM_WORLD, &_reqs[2 * k]) );
+                _kbytes_received += rinfvec[k][1] / 1024;
+                _kbytes_copy_saved += 2 * rinfvec[k][1] / 1024;
+            }
+            if (_snbvec[k] > 0) {
+                SAFE_FUNC_EVAL( MPI_Isend((void *)&(_sbufvec[k][0]), _sbufvec[k].size(), MPI_BYTE,
+                                          k, PARVEC_ASYNC_TAG, MPI_COMM_WORLD, &_reqs[2 * k + 1]) );
+                _kbytes_sent += _sbufvec[k].size() / 1024;
+                _kbytes_copy_saved += 2 * _sbufvec[k].size() / 1024;
+            }
+        }
+        return 0;
+    }
+    _trailer = true;
+    for (int k = 0; k < mpisize; k++) {
+        _reqs[2 * k] = MPI_REQUEST_NULL;
+        _reqs[2 * k + 1] = MPI_REQUEST_NULL;
+        if (_snbvec[k] > 0) {
+            VecOStream os(_sbufvec[k]);
+            os.write((char*)&(_snbvec[k]), sizeof(int));
+            _kbytes_sent += _sbufvec[k].size() / 1024;
+            _kbytes_copy_saved += 2 * _sbufvec[k].size() / 1024;
+        }
+    }
+    if (_node) {
+        SAFE_FUNC_EVAL( nodeExchange(_sbufvec, _rbufvec) );
+    } else {
+        SAFE_FUNC_EVAL( sparseExchange(_sbufvec, _rbufvec) );
+    }
+    for (int k = 0; k < mpisize; k++) {
+        _rnbvec[k] = 0;
+        int nbytes = _rbufvec[k].size();
+        if (nbytes > 0) {
+            CHECK_TRUE( nbytes >= sizeof(int) );
+            MemIStream iss(&(_rbufvec[k][nbytes - sizeof(int)]), sizeof(int));
+            iss.read((char*)&(_rnbvec[k]), sizeof(int));
+            _rbufvec[k].resize(nbytes - sizeof(int));
+            _kbytes_received += nbytes / 1024;
+            _kbytes_copy_saved += 2 * nbytes / 1024;
+        }
+    }
+    return 0;
+}
 
 //--------------------------------------------
 template <class Key, class Data, class Partition>
@@ -226,15 +996,11 @@ int ParVec<Key,Data,Partition>::getBegin(int (*e2ps)(Key, Data&, std::vector<int
     getMPIInfo(&mpirank, &mpisize);
     //---------
     resetVecs();
-    _sbufvec.resize(mpisize);
-    _rbufvec.resize(mpisize);
     _reqs = new MPI_Request[2 * mpisize];
     _stats = new MPI_Status[2 * mpisize];
     //---------
-    std::vector<std::ostringstream*> ossvec(mpisize);
-    for(int k = 0; k < mpisize; k++)        {
-        ossvec[k] = new std::ostringstream();
-    }
+    std::vector<VecOStream*> ossvec;
+    openSendBufs(ossvec);
 
     //1. serialize
     for (typename std::map<Key,Data>::iterator mi = _lclmap.begin();
@@ -256,16 +1022,11 @@ int ParVec<Key,Data,Partition>::getBegin(int (*e2ps)(Key, Data&, std::vector<int
         }
     }
 
-    // to vector
-    strs2vec(ossvec);
+    closeSendBufs(ossvec);
 
-    //2. all the sendsize of the message
-    std::vector<int> sszvec;
-    std::vector<int> rszvec;
-    getSizes(rszvec, sszvec);
-
-    //3. allocate space, send and receive
-    makeBufReqs(rszvec, sszvec);
+    //2. send and receive
+    SAFE_FUNC_EVAL( chooseExchange(_snbvec) );
+    SAFE_FUNC_EVAL( sendBufs() );
     SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
     return 0;
 }
@@ -281,8 +1042,6 @@ int ParVec<Key,Data,Partition>::getBegin(std::vector<Key>& keyvec,
     getMPIInfo(&mpirank, &mpisize);
     //---------
     resetVecs();
-    _sbufvec.resize(mpisize);
-    _rbufvec.resize(mpisize);
     _reqs = new MPI_Request[2 * mpisize];
     _stats = new MPI_Status[2 * mpisize];
 
@@ -302,56 +1061,78 @@ int ParVec<Key,Data,Partition>::getBegin(std::vector<Key>& keyvec,
     for(int k = 0; k < mpisize; k++) {
         sszvec[k] = skeyvec[k].size();
     }
-    SAFE_FUNC_EVAL( MPI_Alltoall( (void*)&(sszvec[0]), 1, MPI_INT, (void*)&(rszvec[0]), 1,
-                       MPI_INT, MPI_COMM_WORLD ) );
+    SAFE_FUNC_EVAL( chooseExchange(sszvec) );
 
     //3. allocate space for the keys, send and receive
     std::vector< std::vector<Key> > rkeyvec(mpisize);
-    for (int k = 0; k < mpisize; k++) {
-        rkeyvec[k].resize(rszvec[k]);
-    }
+    if (_sparse) {
+        SAFE_FUNC_EVAL( sparseExchange(skeyvec, rkeyvec) );
+    } else if (_node) {
+        SAFE_FUNC_EVAL( nodeExchange(skeyvec, rkeyvec) );
+    } else {
+        SAFE_FUNC_EVAL( MPI_Alltoall( (void*)&(sszvec[0]), 1, MPI_INT, (void*)&(rszvec[0]), 1,
+                           MPI_INT, MPI_COMM_WORLD ) );
+        for (int k = 0; k < mpisize; k++) {
+            rkeyvec[k].resize(rszvec[k]);
+        }
 
-    MPI_Request *reqs = new MPI_Request[2 * mpisize];
-    MPI_Status  *stats = new MPI_Status[2 * mpisize];
-    for(int k = 0; k < mpisize; k++) {
-        SAFE_FUNC_EVAL( MPI_Irecv( (void*)&(rkeyvec[k][0]), rszvec[k] * sizeof(Key), MPI_BYTE,
-                        k, 0, MPI_COMM_WORLD, &reqs[2 * k] ) );
-        SAFE_FUNC_EVAL( MPI_Isend( (void*)&(skeyvec[k][0]), sszvec[k] * sizeof(Key), MPI_BYTE,
-                       k, 0, MPI_COMM_WORLD, &reqs[2 * k + 1] ) );
+        MPI_Request *reqs = new MPI_Request[2 * mpisize];
+        MPI_Status  *stats = new MPI_Status[2 * mpisize];
+        for(int k = 0; k < mpisize; k++) {
+            SAFE_FUNC_EVAL( MPI_Irecv( (void*)&(rkeyvec[k][0]), rszvec[k] * sizeof(Key), MPI_BYTE,
+                            k, 0, MPI_COMM_WORLD, &reqs[2 * k] ) );
+            SAFE_FUNC_EVAL( MPI_Isend( (void*)&(skeyvec[k][0]), sszvec[k] * sizeof(Key), MPI_BYTE,
+                           k, 0, MPI_COMM_WORLD, &reqs[2 * k + 1] ) );
+        }
+        SAFE_FUNC_EVAL( MPI_Waitall(2 * mpisize, &(reqs[0]), &(stats[0])) );
+        delete[] reqs;
+        delete[] stats;
     }
-    SAFE_FUNC_EVAL( MPI_Waitall(2 * mpisize, &(reqs[0]), &(stats[0])) );
-    delete[] reqs;
-    delete[] stats;
 
     skeyvec.clear(); //save space
 
     //4. prepare the streams
-    std::vector<std::ostringstream*> ossvec(mpisize);
-    for(int k = 0; k < mpisize; k++) {
-        ossvec[k] = new std::ostringstream();
+    SAFE_FUNC_EVAL( packGet(rkeyvec, mask) );
+
+    //5. send and receive, the same way as the keys
+    SAFE_FUNC_EVAL( sendBufs() );
+    if (_record != NULL) {
+        SAFE_FUNC_EVAL( recordPlan(keyvec, &rkeyvec) );
     }
-    for(int k = 0; k < mpisize; k++) {
-        for(int g = 0; g < rkeyvec[k].size(); g++) {
-            Key curkey = rkeyvec[k][g];
-            typename std::map<Key, Data>::iterator mi = _lclmap.find(curkey);
-            CHECK_TRUE( mi!=_lclmap.end() );
-            CHECK_TRUE( _prtn.owner(curkey) == mpirank );
-            Key key = mi->first;
-            const Data& dat = mi->second;
-            SAFE_FUNC_EVAL( serialize(key, *(ossvec[k]), mask) );
-            SAFE_FUNC_EVAL( serialize(dat, *(ossvec[k]), mask) );
-            _snbvec[k]++; //LEXING: VERY IMPORTANT
-        }
+    if (!_async) {
+        SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
     }
-    // to vector
-    strs2vec(ossvec);
-
-    //5. all the sendsize of the message
-    getSizes(rszvec, sszvec);
+    return 0;
+}
 
-    //6. allocate space, send and receive
-    makeBufReqs(rszvec, sszvec);
-    SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::getBegin(std::vector<Key>& keyvec,
+                                         const std::vector<int>& mask,
+                                         ParVecPlan<Key>& plan) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::getBegin");
+#endif
+    int mpisize = getMPISize();
+    if (plan.valid()) {
+        resetVecs();
+        _reqs = new MPI_Request[2 * mpisize];
+        _stats = new MPI_Status[2 * mpisize];
+        bool ok = false;
+        if (keyvec == plan._keyvec) {
+            SAFE_FUNC_EVAL( packGet(plan._skeyvec, mask) );
+        }
+        SAFE_FUNC_EVAL( startPlan(plan, keyvec, ok) );
+        if (ok) {
+            return 0;
+        }
+        delete[] _reqs;
+        delete[] _stats;
+        plan.clear();
+    }
+    _record = &plan;
+    SAFE_FUNC_EVAL( getBegin(keyvec, mask) );
+    _record = NULL;
     return 0;
 }
 
@@ -366,37 +1147,32 @@ int ParVec<Key,Data,Partition>::getEnd( const std::vector<int>& mask ) {
     SAFE_FUNC_EVAL( MPI_Waitall(2*mpisize, &(_reqs[0]), &(_stats[0])) );
     delete[] _reqs;
     delete[] _stats;
-    _sbufvec.clear(); //save space
-    //4. write back
-    //to stream
-    std::vector<std::istringstream*> issvec(mpisize);
-    for (int k = 0; k < mpisize; k++) {
-        issvec[k] = new std::istringstream();
-    }
-    for (int k = 0; k < mpisize; k++) {
-        std::string tmp(_rbufvec[k].begin(), _rbufvec[k].end());
-        issvec[k]->str(tmp);
+    if (_plan != NULL) {
+        std::vector<MPI_Request>& reqs = _plan->_reqs;
+        if (!reqs.empty()) {
+            SAFE_FUNC_EVAL( MPI_Waitall(reqs.size(), &(reqs[0]), MPI_STATUSES_IGNORE) );
+        }
+        _plan = NULL;
     }
-    _rbufvec.clear(); //save space
-  
+    //4. write back, reading in place from the receive buffers
     for (int k = 0; k < mpisize; k++) {
+        MemIStream iss(_rbufvec[k].empty() ? NULL : &(_rbufvec[k][0]), _rbufvec[k].size());
         for (int i = 0; i < _rnbvec[k]; i++) {
-            Key key;  deserialize(key, *(issvec[k]), mask);
+            Key key;  deserialize(key, iss, mask);
             typename std::map<Key, Data>::iterator mi = _lclmap.find(key);
             if (mi == _lclmap.end()) { //do not exist
                 Data dat;
-                deserialize(dat, *(issvec[k]), mask);
+                deserialize(dat, iss, mask);
                 _lclmap[key] = dat;
             } else { //exist already
-                deserialize(mi->second, *(issvec[k]), mask);
+                deserialize(mi->second, iss, mask);
             }
         }
     }
-    for (int k = 0; k < mpisize; k++) {
-        delete issvec[k];
-        issvec[k] = NULL;
+    if (!_async) {
+        SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
     }
-    SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
+    _async = false;
     return 0;
 }
 
@@ -411,43 +1187,51 @@ int ParVec<Key,Data,Partition>::putBegin(std::vector<Key>& keyvec,
     getMPIInfo(&mpirank, &mpisize);
     //---------
     resetVecs();
-    _sbufvec.resize(mpisize);
-    _rbufvec.resize(mpisize);
     _reqs = new MPI_Request[2 * mpisize];
     _stats = new MPI_Status[2 * mpisize];
-    //1.
-    std::vector<std::ostringstream*> ossvec(mpisize);
-    for (int k = 0; k < mpisize; k++) {
-        ossvec[k] = new std::ostringstream();
-    }
 
     //1. go thrw the keyvec to partition them among other procs
-    for (int i=0; i<keyvec.size(); i++) {
-        Key key = keyvec[i];
-        int k = _prtn.owner(key); //the owner
-        if (k != mpirank) {
-            typename std::map<Key, Data>::iterator mi = _lclmap.find(key);
-            CHECK_TRUE( mi!=_lclmap.end() );
-            CHECK_TRUE( key == mi->first );
-            Data& dat = mi->second;
-            SAFE_FUNC_EVAL( serialize(key, *(ossvec[k]), mask) );
-            SAFE_FUNC_EVAL( serialize(dat, *(ossvec[k]), mask) );
-            _snbvec[k]++;
-        }
-    }
+    SAFE_FUNC_EVAL( packPut(keyvec, mask) );
 
-    //2. to vector
-    strs2vec(ossvec);
-
-    //3. get size
-    std::vector<int> sszvec;
-    std::vector<int> rszvec;
-    getSizes(rszvec, sszvec);
+    //2. send and receive
+    SAFE_FUNC_EVAL( chooseExchange(_snbvec) );
+    SAFE_FUNC_EVAL( sendBufs() );
+    if (_record != NULL) {
+        SAFE_FUNC_EVAL( recordPlan(keyvec, NULL) );
+    }
 
-    //4. allocate space, send and receive
-    makeBufReqs(rszvec, sszvec);
+    if (!_async) {
+        SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
+    }
+    return 0;
+}
 
-    SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::putBegin(std::vector<Key>& keyvec,
+                                         const std::vector<int>& mask,
+                                         ParVecPlan<Key>& plan) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::putBegin");
+#endif
+    int mpisize = getMPISize();
+    if (plan.valid()) {
+        resetVecs();
+        _reqs = new MPI_Request[2 * mpisize];
+        _stats = new MPI_Status[2 * mpisize];
+        bool ok = false;
+        SAFE_FUNC_EVAL( packPut(keyvec, mask) );
+        SAFE_FUNC_EVAL( startPlan(plan, keyvec, ok) );
+        if (ok) {
+            return 0;
+        }
+        delete[] _reqs;
+        delete[] _stats;
+        plan.clear();
+    }
+    _record = &plan;
+    SAFE_FUNC_EVAL( putBegin(keyvec, mask) );
+    _record = NULL;
     return 0;
 }
 
@@ -464,32 +1248,99 @@ int ParVec<Key,Data,Partition>::putEnd( const std::vector<int>& mask ) {
     SAFE_FUNC_EVAL( MPI_Waitall(2*mpisize, &(_reqs[0]), &(_stats[0])) );
     delete[] _reqs;
     delete[] _stats;
-    _sbufvec.clear(); //save space
-    //5. go thrw the messages and write back
-    std::vector<std::istringstream*> issvec(mpisize);
-    for (int k = 0; k < mpisize; k++) {
-        issvec[k] = new std::istringstream();
-    }
-    for (int k = 0; k < mpisize; k++) {
-        std::string tmp(_rbufvec[k].begin(), _rbufvec[k].end());
-        issvec[k]->str(tmp);
+    if (_plan != NULL) {
+        std::vector<MPI_Request>& reqs = _plan->_reqs;
+        if (!reqs.empty()) {
+            SAFE_FUNC_EVAL( MPI_Waitall(reqs.size(), &(reqs[0]), MPI_STATUSES_IGNORE) );
+        }
+        _plan = NULL;
     }
-    _rbufvec.clear(); //save space
+    //5. go thrw the messages and write back in place
     for (int k = 0; k < mpisize; k++) {
+        MemIStream iss(_rbufvec[k].empty() ? NULL : &(_rbufvec[k][0]), _rbufvec[k].size());
         for (int i = 0; i < _rnbvec[k]; i++) {
             Key key;
-            deserialize(key, *(issvec[k]), mask);
+            deserialize(key, iss, mask);
             CHECK_TRUE( _prtn.owner(key) == mpirank );
             typename std::map<Key,Data>::iterator mi = _lclmap.find(key);
             CHECK_TRUE( mi!=_lclmap.end() );
-            deserialize(mi->second, *(issvec[k]), mask);
+            deserialize(mi->second, iss, mask);
         }
     }
-    for (int k = 0; k < mpisize; k++) {
-        delete issvec[k];
-        issvec[k] = NULL;
+    if (!_async) {
+        SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
+    }
+    _async = false;
+    return 0;
+}
+
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::getStart(std::vector<Key>& keyvec,
+                                         const std::vector<int>& mask,
+                                         ParVecHandle<Key,Data,Partition>& h,
+                                         ParVecPlan<Key>* plan) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::getStart");
+#endif
+    CHECK_TRUE( !h.active() );
+    double t0 = MPI_Wtime();
+    _async = true;
+    if (plan != NULL) {
+        SAFE_FUNC_EVAL( getBegin(keyvec, mask, *plan) );
+    } else {
+        SAFE_FUNC_EVAL( getBegin(keyvec, mask) );
+    }
+    h._pv = this;
+    h._mask = mask;
+    h._put = false;
+    h._tstart = MPI_Wtime();
+    h._tdone = -1;
+    h._startsecs = h._tstart - t0;
+    return 0;
+}
+
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::putStart(std::vector<Key>& keyvec,
+                                         const std::vector<int>& mask,
+                                         ParVecHandle<Key,Data,Partition>& h,
+                                         ParVecPlan<Key>* plan) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::putStart");
+#endif
+    CHECK_TRUE( !h.active() );
+    double t0 = MPI_Wtime();
+    _async = true;
+    if (plan != NULL) {
+        SAFE_FUNC_EVAL( putBegin(keyvec, mask, *plan) );
+    } else {
+        SAFE_FUNC_EVAL( putBegin(keyvec, mask) );
+    }
+    h._pv = this;
+    h._mask = mask;
+    h._put = true;
+    h._tstart = MPI_Wtime();
+    h._tdone = -1;
+    h._startsecs = h._tstart - t0;
+    return 0;
+}
+
+//--------------------------------------------
+template <class Key, class Data, class Partition>
+int ParVec<Key,Data,Partition>::testExchange(bool& done) {
+#ifndef RELEASE
+    CallStackEntry entry("ParVec::testExchange");
+#endif
+    int mpisize = getMPISize();
+    int flag = 0;
+    SAFE_FUNC_EVAL( MPI_Testall(2 * mpisize, _reqs, &flag, MPI_STATUSES_IGNORE) );
+    done = (flag != 0);
+    if (done && _plan != NULL && !_plan->_reqs.empty()) {
+        SAFE_FUNC_EVAL( MPI_Testall(_plan->_reqs.size(), &(_plan->_reqs[0]), &flag,
+                                    MPI_STATUSES_IGNORE) );
+        done = (flag != 0);
     }
-    SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
     return 0;
 }
 
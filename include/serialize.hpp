@@ -68,6 +68,26 @@ inline int deserialize(int& val, std::istream& is, const std::vector<int>& mask)
     return 0;
 }
 
+//-------------------
+//long
+inline int serialize(const long& val, std::ostream& os, const std::vector<int>& mask)
+{
+#ifndef RELEASE
+    CallStackEntry entry("serialize");
+#endif
+    os.write((char*)&val, sizeof(long));
+    return 0;
+}
+
+inline int deserialize(long& val, std::istream& is, const std::vector<int>& mask)
+{
+#ifndef RELEASE
+    CallStackEntry entry("deserialize");
+#endif
+    is.read((char*)&val, sizeof(long));
+    return 0;
+}
+
 //-------------------
 //double
 inline int serialize(const double& val, std::ostream& os, const std::vector<int>& mask)
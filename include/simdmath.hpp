@@ -0,0 +1,68 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _SIMDMATH_HPP_
+#define _SIMDMATH_HPP_
+
+/*
+ * Self-contained vector math routines used in place of MKL's VML when the
+ * code is compiled with SIMD_MATH defined.  The instruction set is picked at
+ * compile time: AVX-512 if __AVX512F__ is defined, AVX2 if __AVX2__ is
+ * defined, and a branch-free scalar loop otherwise (which the compiler is
+ * free to auto-vectorize).  Build with -march=native (or similar) to get the
+ * wide paths.
+ *
+ * sincos uses a three-term Cody-Waite reduction by pi/2 and the Cephes
+ * minimax polynomials on [-pi/4, pi/4].  The error is within a few ulp for
+ * |x| < 1e5, which covers K*r for every box in the tree and is well below the
+ * tolerance of the most accurate (ACCU=3) translation tables.
+ */
+
+// out[i] = sqrt(in[i])
+int vd_sqrt(int n, const double* in, double* out);
+
+// out[i] = 1 / in[i]
+int vd_inv(int n, const double* in, double* out);
+
+// out_sin[i] = sin(in[i]), out_cos[i] = cos(in[i])
+int vd_sincos(int n, const double* in, double* out_sin, double* out_cos);
+
+// Single precision versions, used by the mixed-precision near field
+// (Kernel3d::apply_float).  vs_sincos uses the Cephes single precision
+// polynomials and is accurate to a few float ulp for |x| < 1e4.  Both are
+// always compiled, independently of SIMD_MATH.
+int vs_sqrt(int n, const float* in, float* out);
+int vs_sincos(int n, const float* in, float* out_sin, float* out_cos);
+
+// c[i] += sum_s a[s][i] * b[s][i] for n complex numbers stored interleaved
+// (re, im), as in std::complex<double>.  Used for the Hadamard products of
+// the V list FFTs.  Always compiled, independently of SIMD_MATH.
+int vz_mulacc(int n, int nsrc, const double* const* a, const double* const* b, double* c);
+
+// Same with b[s] read through an index map: c[i] += sum_s a[s][i] * b[s][map[s][i]].
+// map, or any map[s], may be NULL for the identity.
+int vz_mulacc_map(int n, int nsrc, const double* const* a, const double* const* b,
+                  const int* const* map, double* c);
+
+// Same with b[s] in single precision (complex float), upcast as it is read.
+int vz_mulacc_map_f(int n, int nsrc, const double* const* a, const float* const* b,
+                    const int* const* map, double* c);
+
+// Name of the instruction set selected at compile time.
+const char* vd_isa();
+
+#endif  // _SIMDMATH_HPP_
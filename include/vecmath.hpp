@@ -22,8 +22,10 @@
 
 /*
  * This file is a wrapper around vector operations.  If MKL is available, these functions
- * call the corresponding MKL functions.  Otherwise, the operations are done with
- * manual looping.
+ * call the corresponding MKL functions.  If SIMD_MATH is defined, they call the
+ * vectorized routines in simdmath.hpp.  Otherwise, the operations are done with
+ * manual looping.  The vec_ functions work on raw arrays of length n (used for
+ * the tiles in Kernel3d::apply); the mat_ functions work on whole matrices.
  */
 
 #ifdef MKL
@@ -33,68 +35,91 @@ extern "C"
     void vdinv_(int* n, double*, double*);
     void vdsincos_(int* n, double*, double*, double*);
 }
+#elif defined(SIMD_MATH)
+#include "simdmath.hpp"
 #endif
 
-int mat_dsqrt(int M, int N, DblNumMat& in, DblNumMat& out)
+int vec_dsqrt(int n, double* in, double* out)
 {
 #ifndef RELEASE
-    CallStackEntry entry("mat_dsqrt");
+    CallStackEntry entry("vec_dsqrt");
 #endif
 #ifdef MKL
-    int TTL = M * N;
-    vdsqrt_(&TTL, in.data(), out.data());
+    vdsqrt_(&n, in, out);
+#elif defined(SIMD_MATH)
+    vd_sqrt(n, in, out);
 #else
-    for(int i = 0; i < M; i++) {
-        for(int j = 0; j < N; j++)      {
-            out(i,j) = sqrt(in(i,j));
-        }
+    for(int i = 0; i < n; i++) {
+        out[i] = sqrt(in[i]);
     }
 #endif
     return 0;
 }
 
-int mat_dinv(int M, int N, DblNumMat& in, DblNumMat& out)
+int vec_dinv(int n, double* in, double* out)
 {
 #ifndef RELEASE
-    CallStackEntry entry("mat_dinv");
+    CallStackEntry entry("vec_dinv");
 #endif
 #ifdef MKL
-    int TTL = M * N;
-    vdinv_(&TTL, in.data(), out.data());
+    vdinv_(&n, in, out);
+#elif defined(SIMD_MATH)
+    vd_inv(n, in, out);
 #else
-    for(int i = 0; i < M; i++) {
-        for(int j = 0; j < N; j++)      {
-            out(i,j) = 1.0 / in(i,j);
-        }
+    for(int i = 0; i < n; i++) {
+        out[i] = 1.0 / in[i];
     }
 #endif
     return 0;
 }
 
-int mat_dsincos(int M, int N, DblNumMat& in, DblNumMat& out_sin,
-                DblNumMat& out_cos)
+int vec_dsincos(int n, double* in, double* out_sin, double* out_cos)
 {
 #ifndef RELEASE
-    CallStackEntry entry("mat_dsincos");
+    CallStackEntry entry("vec_dsincos");
 #endif
 #ifdef MKL
-    int TTL = M * N;
-    vdsincos_(&TTL, in.data(), out_sin.data(), out_cos.data());
+    vdsincos_(&n, in, out_sin, out_cos);
+#elif defined(SIMD_MATH)
+    vd_sincos(n, in, out_sin, out_cos);
 #else
-    for(int i = 0; i < M; i++) {
-        for(int j = 0; j < N; j++)      {
+    for(int i = 0; i < n; i++) {
 #ifdef OS_X
-            out_sin(i, j) = sin(in(i, j));
-            out_cos(i, j) = cos(in(i, j));
+        out_sin[i] = sin(in[i]);
+        out_cos[i] = cos(in[i]);
 #else
-            sincos(in(i,j), &out_sin(i,j), &out_cos(i,j));
+        sincos(in[i], &out_sin[i], &out_cos[i]);
 #endif
-        }
     }
 #endif
     return 0;
 }
 
+int mat_dsqrt(int M, int N, DblNumMat& in, DblNumMat& out)
+{
+#ifndef RELEASE
+    CallStackEntry entry("mat_dsqrt");
+#endif
+    return vec_dsqrt(M * N, in.data(), out.data());
+}
+
+int mat_dinv(int M, int N, DblNumMat& in, DblNumMat& out)
+{
+#ifndef RELEASE
+    CallStackEntry entry("mat_dinv");
+#endif
+    return vec_dinv(M * N, in.data(), out.data());
+}
+
+int mat_dsincos(int M, int N, DblNumMat& in, DblNumMat& out_sin,
+                DblNumMat& out_cos)
+{
+#ifndef RELEASE
+    CallStackEntry entry("mat_dsincos");
+#endif
+    return vec_dsincos(M * N, in.data(), out_sin.data(), out_cos.data());
+}
+
 int mat_dscale(int M, int N, DblNumMat& in, double K)
 {
 #ifndef RELEASE
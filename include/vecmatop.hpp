@@ -30,8 +30,23 @@ int dgemv(int m, int n, double alpha, double* A, double* X, double beta, double*
 //--------------------------------------------------
 int zgemm(cpx alpha, const CpxNumMat& A, const CpxNumMat& B, cpx beta, CpxNumMat& C);
 int zgemm(int m, int n, int k, cpx alpha, cpx* A, cpx* B, cpx beta, cpx* C);
+// C <- alpha * A^T * B + beta * C (transpose, not conjugate transpose)
+int zgemm_trans(cpx alpha, const CpxNumMat& A, const CpxNumMat& B, cpx beta, CpxNumMat& C);
 
 int zgemv(cpx alpha, const CpxNumMat& A, const CpxNumVec& X, cpx beta, CpxNumVec& Y);
 int zgemv(int m, int n, cpx alpha, cpx* A, cpx* X, cpx beta, cpx* Y);
 
+// Thin SVD, A = U * diag(S) * VT, with U m x r, VT r x n, r = min(m, n)
+int zgesvd(const CpxNumMat& A, CpxNumMat& U, DblNumVec& S, CpxNumMat& VT);
+// Pseudo-inverse, singular values below max(m, n) * S(0) * DBL_EPSILON
+// are dropped (as in MATLAB's pinv)
+int zpinv(const CpxNumMat& A, CpxNumMat& B);
+// QR with column pivoting, A(:, piv) = Q * R.  Only R (min(m, n) x n) and
+// the 0-based pivots are returned.
+int zgeqp3(const CpxNumMat& A, IntNumVec& piv, CpxNumMat& R);
+// Thin QR, A = Q * R with Q m x r, R r x n, r = min(m, n)
+int zgeqrf(const CpxNumMat& A, CpxNumMat& Q, CpxNumMat& R);
+// Inverse of the upper triangular R
+int ztrtri(const CpxNumMat& R, CpxNumMat& Rinv);
+
 #endif
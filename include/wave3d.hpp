@@ -25,6 +25,8 @@
 #include "mlib3d.hpp"
 #include "parvec.hpp"
 
+#include <list>
+
 #define NUM_CHILDREN (8)
 #define CHILD_IND1(x) ((x & 4) >> 2)
 #define CHILD_IND2(x) ((x & 2) >> 1)
@@ -66,10 +68,11 @@ public:
     int _fftcnt;
     //
     DblNumMat _extpos;   // positions of exact points (leaf level)
-    CpxNumVec _extden;   // Exact densities  
-    CpxNumVec _upeqnden; // Upward equivalent density
-    CpxNumVec _extval;   // Exact potential value
-    CpxNumVec _dnchkval; // Downward check potential
+    // One column per right-hand side
+    CpxNumMat _extden;   // Exact densities  
+    CpxNumMat _upeqnden; // Upward equivalent density
+    CpxNumMat _extval;   // Exact potential value
+    CpxNumMat _dnchkval; // Downward check potential
 
     int _tag;
     std::vector<int> _ptidxvec;
@@ -84,7 +87,7 @@ public:
     std::map< Index3, std::vector<BoxKey> > _fndeidxvec;
 
     // Auxiliarly data structures for FFT
-    CpxNumTns _upeqnden_fft;
+    NumVec<CpxNumTns> _upeqnden_fft;  // one tensor per right-hand side
     std::set<Index3> _incdirset;
     std::set<Index3> _outdirset;
 
@@ -112,12 +115,12 @@ public:
     std::map< Index3, std::vector<BoxKey> >& fndeidxvec() { return _fndeidxvec; }
     //
     DblNumMat& extpos() { return _extpos; }
-    CpxNumVec& extden() { return _extden; }
-    CpxNumVec& upeqnden() { return _upeqnden; }
-    CpxNumVec& extval() { return _extval; }
-    CpxNumVec& dnchkval() { return _dnchkval; }
+    CpxNumMat& extden() { return _extden; }
+    CpxNumMat& upeqnden() { return _upeqnden; }
+    CpxNumMat& extval() { return _extval; }
+    CpxNumMat& dnchkval() { return _dnchkval; }
     //
-    CpxNumTns& upeqnden_fft() { return _upeqnden_fft; }
+    NumVec<CpxNumTns>& upeqnden_fft() { return _upeqnden_fft; }
     std::set<Index3>& incdirset() { return _incdirset; }
     std::set<Index3>& outdirset() { return _outdirset; }
     int& fftnum() { return _fftnum; }
@@ -175,15 +178,16 @@ typedef std::pair<BoxKey,Index3> HFBoxAndDirectionKey;
 // Boundary data
 class HFBoxAndDirectionDat {
 public:
-    CpxNumVec _dirupeqnden;
-    CpxNumVec _dirdnchkval;
+    // One column per right-hand side
+    CpxNumMat _dirupeqnden;
+    CpxNumMat _dirdnchkval;
 public:
     HFBoxAndDirectionDat() {;}
     ~HFBoxAndDirectionDat() {;}
     // Directional upward equivalent density
-    CpxNumVec& dirupeqnden() { return _dirupeqnden; }
+    CpxNumMat& dirupeqnden() { return _dirupeqnden; }
     // Directional downward check value
-    CpxNumVec& dirdnchkval() { return _dirdnchkval; }
+    CpxNumMat& dirdnchkval() { return _dirdnchkval; }
 };
 
 #define HFBoxAndDirectionDat_Number 2
@@ -211,6 +215,168 @@ public:
     }
 };
 
+//---------------------------------------------------------------------------
+// Kernel matrices of near-field interactions, kept across calls to
+// Wave3d::eval.  They only depend on the geometry, so once a matrix is
+// stored a later eval applies it with zgemv.  The key is the (target box,
+// source box) pair.  Matrices are added until the memory budget is used up;
+// the pairs that do not fit are evaluated without a matrix every time.
+class NearFieldCache {
+public:
+    typedef std::pair<BoxKey, BoxKey> key_t;
+    std::map<key_t, CpxNumMat> _mats;
+    double _budget;  // bytes, 0 disables the cache
+    double _bytes;
+    long _hits;
+    long _misses;
+public:
+    NearFieldCache(): _budget(0), _bytes(0), _hits(0), _misses(0) {;}
+    ~NearFieldCache() {;}
+    double& budget() { return _budget; }
+    bool enabled() { return _budget > 0; }
+    double bytes() { return _bytes; }
+    long hits() { return _hits; }
+    long misses() { return _misses; }
+    // Fraction of lookups since the last reset_counts that found a matrix.
+    double hit_rate() { return (_hits + _misses) > 0 ? double(_hits) / (_hits + _misses) : 0; }
+
+    // Cached matrix for (trgkey, srckey), or NULL.  Counts a hit or a miss.
+    CpxNumMat* find(const BoxKey& trgkey, const BoxKey& srckey);
+    // New m x n matrix for (trgkey, srckey), or NULL if it does not fit.
+    CpxNumMat* insert(const BoxKey& trgkey, const BoxKey& srckey, int m, int n);
+    void reset_counts() { _hits = 0; _misses = 0; }
+    void clear();
+};
+
+//---------------------------------------------------------------------------
+// High frequency M2L operators.  The kernel matrix from the upward equivalent
+// points of a source box to the downward check points of a target box only
+// depends on the box width W, the direction and the integer offset
+// (trgctr - srcctr) / W, so it is shared by all pairs with the same offset.
+// Least recently used matrices are evicted when the budget is exceeded.
+class M2LCache {
+public:
+    typedef std::pair<double, std::pair<Index3, Index3> > key_t;
+    typedef std::pair<CpxNumMat, std::list<key_t>::iterator> entry_t;
+    std::map<key_t, entry_t> _mats;
+    std::list<key_t> _lru;  // most recently used first
+    double _budget;  // bytes, 0 disables the cache
+    double _bytes;
+    long _hits;
+    long _misses;
+    long _evictions;
+public:
+    M2LCache(): _budget(0), _bytes(0), _hits(0), _misses(0), _evictions(0) {;}
+    ~M2LCache() {;}
+    double& budget() { return _budget; }
+    bool enabled() { return _budget > 0; }
+    double bytes() { return _bytes; }
+    long hits() { return _hits; }
+    long misses() { return _misses; }
+    long evictions() { return _evictions; }
+    double hit_rate() { return (_hits + _misses) > 0 ? double(_hits) / (_hits + _misses) : 0; }
+
+    // Cached matrix for (W, dir, off), or NULL.  Counts a hit or a miss.
+    CpxNumMat* find(double W, const Index3& dir, const Index3& off);
+    // New m x n matrix for (W, dir, off), evicting old matrices as needed.
+    // NULL if the matrix alone is larger than the budget.
+    CpxNumMat* insert(double W, const Index3& dir, const Index3& off, int m, int n);
+    void reset_counts() { _hits = 0; _misses = 0; _evictions = 0; }
+    void clear();
+};
+
+//---------------------------------------------------------------------------
+// Book-keeping for the V list spectra (BoxDat::upeqnden_fft) of the per-box
+// FFT path.  SPECTRUM_KEEPALL frees a spectrum after its last use,
+// SPECTRUM_LRU also drops the least recently used spectra while the total is
+// above the budget, and SPECTRUM_RECOMPUTE frees each spectrum right after
+// the target box that used it.  The byte count includes the batches of
+// V_list_batch, whose size is limited by the same budget.
+enum {
+    SPECTRUM_KEEPALL = 0,
+    SPECTRUM_LRU = 1,
+    SPECTRUM_RECOMPUTE = 2,
+};
+
+class SpectrumCache {
+public:
+    int _policy;
+    double _budget;  // bytes, 0 for no limit
+    double _bytes;
+    double _peak;    // since the last reset_peak
+    std::list<BoxKey> _lru;  // most recently used first
+    std::map<BoxKey, std::list<BoxKey>::iterator> _pos;
+public:
+    SpectrumCache(): _policy(SPECTRUM_KEEPALL), _budget(0), _bytes(0), _peak(0) {;}
+    ~SpectrumCache() {;}
+    int& policy() { return _policy; }
+    double& budget() { return _budget; }
+    double bytes() { return _bytes; }
+    double peak() { return _peak; }
+    void reset_peak() { _peak = _bytes; }
+    void grow(double sz) { _bytes += sz;  _peak = std::max(_peak, _bytes); }
+    void shrink(double sz) { _bytes -= sz; }
+
+    // A spectrum of sz bytes was computed for key.
+    void add(const BoxKey& key, double sz);
+    // The spectrum of key was used.
+    void touch(const BoxKey& key);
+    // The spectrum of key (sz bytes) was freed.
+    void remove(const BoxKey& key, double sz);
+    // True if the LRU policy must drop lru_key().
+    bool over_budget() { return _policy == SPECTRUM_LRU && _budget > 0 && _bytes > _budget && !_lru.empty(); }
+    BoxKey lru_key() { return _lru.back(); }
+    void clear();
+};
+
+//---------------------------------------------------------------------------
+// Precomputed P2M and L2P operators of an owned leaf box.  When folded, the
+// uc2ue (dc2de) pseudo-inverse is included, so that p2m maps extden directly
+// to upeqnden and l2p maps dnchkval directly to extval.  Otherwise p2m maps
+// extden to upchkval and l2p maps dneqnden to extval.
+class LeafOpDat {
+public:
+    CpxNumMat _p2m;
+    CpxNumMat _l2p;
+    bool _p2mfold;
+    bool _l2pfold;
+public:
+    LeafOpDat(): _p2mfold(false), _l2pfold(false) {;}
+    ~LeafOpDat() {;}
+    CpxNumMat& p2m() { return _p2m; }
+    CpxNumMat& l2p() { return _l2p; }
+    bool& p2mfold() { return _p2mfold; }
+    bool& l2pfold() { return _l2pfold; }
+};
+
+//---------------------------------------------------------------------------
+// Low frequency M2L engines behind Wave3d::LowFreqM2L.  LOWM2L_FFT is the V
+// list FFT path (V_list_batch, or V_list_compute per box), LOWM2L_DENSE
+// applies a truncated SVD of the kernel matrix of each offset with zgemm
+// (V_list_dense), and LOWM2L_AUTO picks one of the two for every level from
+// a flop estimate.  Short V lists favor the dense engine.
+enum {
+    LOWM2L_FFT = 0,
+    LOWM2L_DENSE = 1,
+    LOWM2L_AUTO = 2,
+};
+
+// Truncated SVD K ~= L * R of the kernel matrix K from the upward equivalent
+// points of a source box to the downward check points of a target box at
+// one V list offset.  L = U_r * S_r is dcp.n() x r, R = V_r^* is r x uep.n().
+class DenseM2LOp {
+public:
+    CpxNumMat _L;
+    CpxNumMat _R;
+public:
+    DenseM2LOp() {;}
+    ~DenseM2LOp() {;}
+    CpxNumMat& L() { return _L; }
+    CpxNumMat& R() { return _R; }
+    int rank() { return _R.m(); }
+    double bytes() { return double(_L.m() * _L.n() + _R.m() * _R.n()) * sizeof(cpx); }
+};
+
 //---------------------------------------------------------------------------
 typedef std::pair< std::vector<BoxKey>, std::vector<BoxKey> > box_lists_t;
 typedef std::map< Index3, box_lists_t > hdmap_t;
@@ -231,9 +397,39 @@ public:
     Point3 _ctr;
     int _ptsmax;
     int _maxlevel;
+    bool _nearfloat;  // single-precision near field (ACCU=1 only)
+    int _nrhs;  // number of right-hand sides in the current eval
+    NearFieldCache _nearcache;
+    bool _leafopson;  // keep leaf P2M/L2P operators across evals
+    std::map<BoxKey, LeafOpDat> _leafops;
+    bool _vbatch;  // level-wide batched FFTs for the V list
+    bool _vorder;  // Morton order of the targets in the low frequency levels
+    SpectrumCache _speccache;
+    std::map<double, double> _specpeak;  // W -> peak spectrum bytes
+    int _lowm2l;  // LOWM2L_FFT, LOWM2L_DENSE or LOWM2L_AUTO
+    // relative SVD truncation of the dense M2L operators, 10^(-2*ACCU-4)
+    // unless -wave3d_DENSETOL is given (set in setup)
+    double _densetol;
+    std::map<double, std::map<Index3, DenseM2LOp> > _densem2l;  // W -> offset -> op
+    std::map<double, double> _lowm2lsel;  // W -> engine used
+    std::map<double, double> _vlistlen;  // W -> average V list length
+    M2LCache _m2lcache;
+    // W -> (flops, seconds) of the batched high frequency M2M and L2L
+    std::map<double, std::pair<double, double> > _m2mrate;
+    std::map<double, std::pair<double, double> > _l2lrate;
     //
     ParVec<BoxKey, BoxDat, BoxPrtn> _boxvec;
     ParVec<HFBoxAndDirectionKey, HFBoxAndDirectionDat, HFBoxAndDirectionPrtn> _bndvec;
+    // Communication plans of the exchanges repeated by every eval (density
+    // gather, low frequency ghost boxes, high frequency boundaries, potential
+    // scatter), recorded on the first eval after setup.
+    bool _commplans;
+    ParVecPlan<int> _denplan;
+    ParVecPlan<BoxKey> _boxplan;
+    ParVecPlan<HFBoxAndDirectionKey> _bndplan;
+    ParVecPlan<int> _valplan;
+    bool _overlap;  // low frequency downward exchange behind the high frequency pass
+    ParVecHandle<BoxKey, BoxDat, BoxPrtn> _boxhandle;
     //
     CpxNumTns _denfft, _valfft;
     fftw_plan _fplan, _bplan;
@@ -253,6 +449,17 @@ public:
     Point3& ctr() { return _ctr; }
     int& ptsmax() { return _ptsmax; }
     int& maxlevel() { return _maxlevel; }
+    bool& nearfloat() { return _nearfloat; }
+    NearFieldCache& nearcache() { return _nearcache; }
+    bool& leafopson() { return _leafopson; }
+    bool& vbatch() { return _vbatch; }
+    bool& vorder() { return _vorder; }
+    SpectrumCache& speccache() { return _speccache; }
+    int& lowm2l() { return _lowm2l; }
+    double& densetol() { return _densetol; }
+    M2LCache& m2lcache() { return _m2lcache; }
+    bool& commplans() { return _commplans; }
+    bool& overlap() { return _overlap; }
 
     //main functions
     int setup(std::map<std::string, std::string>& opts);
@@ -260,10 +467,20 @@ public:
     // Compute the potentials at the target points.
     int eval( ParVec<int, cpx, PtPrtn>& den, ParVec<int, cpx, PtPrtn>& val);
 
+    // Block version of eval for several right-hand sides on the same
+    // geometry.  Every point carries a vector of k densities; val gets a
+    // vector of k potentials.  All k columns go through each translation
+    // together (zgemm instead of zgemv) and share the communication.
+    int eval( ParVec<int, CpxNumVec, PtPrtn>& den, ParVec<int, CpxNumVec, PtPrtn>& val);
+
     // Compute the true solution and store the relative err in relerr.
     int check(ParVec<int, cpx, PtPrtn>& den, ParVec<int, cpx, PtPrtn>& val,
               IntNumVec& chkkeyvec, double& relerr);
 
+    // Free the requests of the communication plans.  Call before
+    // MPI_Finalize.
+    int ReleasePlans();
+
     bool CompareHFBoxAndDirectionKey(HFBoxAndDirectionKey a, HFBoxAndDirectionKey b) {
 	return BoxWidth(a.first) < BoxWidth(b.first);
     }
@@ -339,8 +556,19 @@ private:
                       std::set<BoxKey>& reqboxset);
 
     int EvalDownwardLow(double W, std::vector<BoxKey>& trgvec);
+    // Build the stored P2M (L2P) operator of the leaf key.  uc2ue (dc2de) is
+    // folded in unless that would make the operator larger.
+    int LeafP2MSetup(BoxKey& key, BoxDat& dat, const FetchDat& fetch, LeafOpDat& op);
+    int LeafL2PSetup(BoxKey& key, BoxDat& dat, const FetchDat& fetch, LeafOpDat& op);
+    int LeafOpsReport();
+
     int LowFreqUpwardPass(ldmap_t& ldmap, std::set<BoxKey>& reqboxset);
-    int LowFreqDownwardComm(std::set<BoxKey>& reqboxset);
+    // The low frequency downward exchange of the ghost boxes, started right
+    // after the upward pass and, with _overlap, finished after the high
+    // frequency pass, which tests it for progress as it goes.
+    int LowFreqDownwardCommBegin(std::set<BoxKey>& reqboxset);
+    int LowFreqDownwardCommTest();
+    int LowFreqDownwardCommEnd();
     int LowFreqDownwardPass(ldmap_t& ldmap);
     int HighFreqPass(hdmap_t& hdmap);
 
@@ -360,21 +588,70 @@ private:
     int EvalDownwardHigh(double W, Index3 dir, box_lists_t& hdvecs);
 
     int ConstructMaps(ldmap_t& ldmap, hdmap_t& hdmap);
-    int GatherDensities(std::vector<int>& reqpts, ParVec<int,cpx,PtPrtn>& den);
+    int GatherDensities(std::vector<int>& reqpts, ParVec<int,CpxNumVec,PtPrtn>& den);
     
-    int U_list_compute(BoxDat& trgdat);
-    int X_list_compute(BoxDat& trgdat, DblNumMat& dcp, DblNumMat& dnchkpos,
-                       CpxNumVec& dnchkval);
-    int W_list_compute(BoxDat& trgdat, double W, DblNumMat& uep);
+    // val += G(trgpos, srcpos) * den for a near-field interaction between the
+    // boxes trgkey and srckey.  Uses the cached kernel matrix if there is
+    // one (or room for one), and otherwise evaluates the kernel on the fly,
+    // in single precision if single is set.
+    int NearFieldApply(BoxKey& trgkey, BoxKey& srckey,
+                       const DblNumMat& trgpos, const DblNumMat& srcpos,
+                       const CpxNumMat& den, CpxNumMat& val, bool single);
+    // Both directions of the interaction between boxes akey and bkey, as
+    // in Kernel3d::apply_sym.
+    int NearFieldApplySym(BoxKey& akey, BoxKey& bkey, BoxDat& adat, BoxDat& bdat);
+    int NearFieldCacheReport();
+    int M2LCacheReport();
+    // Per level GFLOP/s of the batched M2M or L2L, clears rate.
+    int HighFreqRateReport(std::map<double, std::pair<double, double> >& rate,
+                           std::string name);
+    // Prints vals[W] for every level W present on any process, 0 where a
+    // process has no entry.
+    int LevelReport(std::map<double, double>& vals, std::string name);
+
+    // True if the U-list interaction between the owned leaf trgkey and its
+    // neighbor neikey is evaluated once for both boxes by U_list_symmetric.
+    bool SymmetricUPair(BoxKey& trgkey, BoxKey& neikey, int mpirank);
+    // Evaluate every symmetric U-list pair of local leaves once, adding the
+    // result to the extval of both boxes.
+    int U_list_symmetric(ldmap_t& ldmap);
+    int U_list_compute(BoxKey& trgkey, BoxDat& trgdat);
+    int X_list_compute(BoxKey& trgkey, BoxDat& trgdat, const DblNumMat& dcp, DblNumMat& dnchkpos,
+                       CpxNumMat& dnchkval);
+    int W_list_compute(BoxKey& trgkey, BoxDat& trgdat, double W, const DblNumMat& uep);
     int V_list_compute(BoxDat& trgdat, double W, int _P, Point3& trgctr,
-                       DblNumMat& uep, DblNumMat& dcp, CpxNumVec& dnchkval,
-                       NumTns<CpxNumTns>& ue2dc);
+                       const DblNumMat& uep, const DblNumMat& dcp, CpxNumMat& dnchkval,
+                       Ue2dcTable& ue2dc);
+    // V list of all boxes in trgvec at once: the upward densities of all
+    // source boxes go through one batched forward FFT, and the check values
+    // of all targets through one batched inverse FFT.  With a spectrum
+    // budget, the targets are split into batches that fit in it.
+    int V_list_batch(double W, int _P, std::vector<BoxKey>& trgvec,
+                     const DblNumMat& uep, const DblNumMat& dcp, Ue2dcTable& ue2dc);
+    // V list of all boxes in trgvec with the dense operators: the pairs are
+    // grouped by offset and each group is two zgemm calls.
+    int V_list_dense(double W, std::vector<BoxKey>& trgvec, const DblNumMat& uep, const DblNumMat& dcp);
+    // Dense operator of offset off at level W, built on first use.
+    int DenseM2LFetch(double W, Index3 off, const DblNumMat& uep, const DblNumMat& dcp, DenseM2LOp*& op);
+    // Engine for the level, from _lowm2l and, for LOWM2L_AUTO, the flop
+    // counts of both engines on the V lists of trgvec.
+    int LowFreqM2LSelect(double W, int _P, std::vector<BoxKey>& trgvec,
+                         const DblNumMat& uep, const DblNumMat& dcp, int& engine);
+    // Adds the V list contributions of the level to dnchkval of all boxes
+    // in trgvec, with the given engine.
+    int LowFreqM2L(double W, int _P, int engine, std::vector<BoxKey>& trgvec,
+                   const DblNumMat& uep, const DblNumMat& dcp, Ue2dcTable& ue2dc);
+    int LowFreqM2LReport();
+    // Time spent building translation data in the Mlib3d fetches, and the
+    // build time saved by finding it in the fetch cache instead.
+    int FetchCacheReport();
 
     int HighFrequencyM2L(double W, Index3 dir, BoxKey trgkey, BoxDat& trgdat,
-                         DblNumMat& dcp, DblNumMat& uep);
+                         const DblNumMat& dcp, const DblNumMat& uep);
 
-    int HighFrequencyL2L(double W, Index3 dir, BoxKey trgkey,
-                         NumVec<CpxNumMat>& dc2de, NumTns<CpxNumMat>& de2dc);
+    // L2L of all boxes in trgvec for direction dir, batched across boxes.
+    int HighFrequencyL2L(double W, Index3 dir, std::vector<BoxKey>& trgvec,
+                         const FetchDat& fetch);
 
     // Add keys to reqbndset for high-frequency M2L computations
     // For every target box, add all the keys corresponding to
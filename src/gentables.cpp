@@ -0,0 +1,146 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#include "mlib3d.hpp"
+#include "parallel.hpp"
+#include "serialize.hpp"
+#include <exception>
+
+// Writes the translation tables for the Helmholtz kernel to data/, in the
+// format read by Mlib3d::setup, in place of matlab/aug3d_script.m.
+//
+// mpirun -np 4 ./gentables -ACCU 2 -NPQ 4 -maxW 64
+//     (writes data/helm3d_ld_2.bin and data/helm3d_hd_2_4.bin)
+//
+// With -indexed 1 the files are in the indexed format, which can be read
+// lazily (-mlib3d_LAZY 1).  With -convert 1 nothing is computed: the
+// existing files -ldname and -hdname are rewritten in the indexed format,
+// with .idx appended to the names.
+
+int optionsCreate(int argc, char** argv, std::map<std::string,
+                  std::string>& options) {
+    options.clear();
+    for(int k = 1; k < argc; k += 2) {
+      options[ std::string(argv[k]) ] = std::string(argv[k + 1]);
+    }
+    return 0;
+}
+
+template <class T>
+void getOption(std::map<std::string, std::string>& opts, std::string option, T& val) {
+    std::map<std::string, std::string>::iterator mi = opts.find(option);
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> val;
+    }
+}
+
+int main(int argc, char** argv)
+{
+#ifndef RELEASE
+    try {
+#endif
+        MPI_Init(&argc, &argv);
+        int mpirank, mpisize;
+        getMPIInfo(&mpirank, &mpisize);
+
+        std::vector<int> all(1,1);
+        std::map<std::string, std::string> opts;
+        optionsCreate(argc, argv, opts);
+        int ACCU = 1;
+        int NPQ = 4;
+        int maxW = 16;
+        getOption(opts, "-ACCU", ACCU);
+        getOption(opts, "-NPQ", NPQ);
+        getOption(opts, "-maxW", maxW);
+        std::ostringstream lname, hname;
+        lname << "helm3d_ld_" << ACCU << ".bin";
+        hname << "helm3d_hd_" << ACCU << "_" << NPQ << ".bin";
+        std::string ldname = lname.str();
+        std::string hdname = hname.str();
+        getOption(opts, "-ldname", ldname);
+        getOption(opts, "-hdname", hdname);
+        int indexed = 0;
+        int convert = 0;
+        getOption(opts, "-indexed", indexed);
+        getOption(opts, "-convert", convert);
+
+        Mlib3d mlib("mlib3d_");
+        mlib.kernel() = Kernel3d(KERNEL_HELM);
+        mlib.NPQ() = NPQ;
+
+        if (convert) {
+            std::istringstream liss;
+            std::map<double, LowFreqEntry> w2ldmap;
+            SAFE_FUNC_EVAL( SharedRead(ldname, liss) );
+            SAFE_FUNC_EVAL( deserialize(w2ldmap, liss, all) );
+            SAFE_FUNC_EVAL( SharedWriteIndexed(ldname + ".idx", w2ldmap) );
+            std::istringstream hiss;
+            std::map<double, std::map<Index3, HghFreqDirEntry> > w2hdmap;
+            SAFE_FUNC_EVAL( SharedRead(hdname, hiss) );
+            SAFE_FUNC_EVAL( deserialize(w2hdmap, hiss, all) );
+            SAFE_FUNC_EVAL( SharedWriteIndexed(hdname + ".idx", w2hdmap) );
+            SAFE_FUNC_EVAL( MPI_Finalize() );
+            return 0;
+        }
+
+        double t0 = MPI_Wtime();
+        std::vector<double> Ws;
+        for (int k = 7; k >= 1; --k) {
+            Ws.push_back(1.0 / (1 << k));
+        }
+        std::map<double, LowFreqEntry> w2ldmap;
+        SAFE_FUNC_EVAL( mlib.GenerateLowFreq(ACCU, Ws, w2ldmap) );
+        if (indexed) {
+            SAFE_FUNC_EVAL( SharedWriteIndexed(ldname, w2ldmap) );
+        } else {
+            std::ostringstream loss;
+            SAFE_FUNC_EVAL( serialize(w2ldmap, loss, all) );
+            SAFE_FUNC_EVAL( SharedWrite(ldname, loss) );
+        }
+        double t1 = MPI_Wtime();
+
+        Ws.clear();
+        for (int W = 1; W <= maxW; W *= 2) {
+            Ws.push_back(W);
+        }
+        std::map<double, std::map<Index3, HghFreqDirEntry> > w2hdmap;
+        SAFE_FUNC_EVAL( mlib.GenerateHghFreq(ACCU, NPQ, Ws, w2hdmap) );
+        if (indexed) {
+            SAFE_FUNC_EVAL( SharedWriteIndexed(hdname, w2hdmap) );
+        } else {
+            std::ostringstream hoss;
+            SAFE_FUNC_EVAL( serialize(w2hdmap, hoss, all) );
+            SAFE_FUNC_EVAL( SharedWrite(hdname, hoss) );
+        }
+        double t2 = MPI_Wtime();
+        if (mpirank == 0) {
+            std::cout << "low frequency tables took " << t1 - t0 << " secs" << std::endl;
+            std::cout << "high frequency tables took " << t2 - t1 << " secs" << std::endl;
+        }
+
+        SAFE_FUNC_EVAL( MPI_Finalize() );
+#ifndef RELEASE
+    } catch( ... ) {
+        int mpirank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &mpirank);
+        std::cerr << "Process " << mpirank << " caught error." << std::endl;
+        DumpCallStack();
+    }
+#endif
+    return 0;
+}
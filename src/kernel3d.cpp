@@ -17,89 +17,422 @@
     along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
 #include "kernel3d.hpp"
 #include "vecmath.hpp"
+#include "simdmath.hpp"
+
+#include <algorithm>
 
 double Kernel3d::_mindif = 1e-8;
 
 //---------------------------------------------------------------------------
-// exp(i*K*r)/r
-// Computes 
-int Kernel3d::kernel(const DblNumMat& trgpos, const DblNumMat& srcpos,
-                     const DblNumMat& srcnor, CpxNumMat& inter) {
-#ifndef RELEASE
-    CallStackEntry entry("Kernel3d::kernel");
-#endif
+// Kernel values for the tile of targets [i0, i0 + nt) and sources
+// [j0, j0 + ns).  Entry (i, j) of the tile is stored at i * ns + j.
+// r2 and r are work arrays; re and im receive the real and imaginary parts.
+template <class Policy>
+static inline void KernelTile(const DblNumMat& trgpos, int i0, int nt,
+                              const DblNumMat& srcpos, int j0, int ns,
+                              double mindif2, double* r2, double* r,
+                              double* re, double* im) {
+    double K = 2*M_PI;
+    int cnt = nt * ns;
+    for (int i = 0; i < nt; i++) {
+        double tx = trgpos(0, i0 + i);
+        double ty = trgpos(1, i0 + i);
+        double tz = trgpos(2, i0 + i);
+        for (int j = 0; j < ns; j++) {
+            double x = tx - srcpos(0, j0 + j);
+            double y = ty - srcpos(1, j0 + j);
+            double z = tz - srcpos(2, j0 + j);
+            double tmp = x*x + y*y + z*z;
+            r2[i * ns + j] = (tmp < mindif2) ? 1 : tmp;
+        }
+    }
+    vec_dsqrt(cnt, r2, r);
+    Policy::amplitude(cnt, r, r2);  //r2 now holds amp(r)
+    for (int k = 0; k < cnt; k++) {
+        r[k] *= K;
+    }
+    vec_dsincos(cnt, r, im, re);
+    Policy::scale(cnt, r2, re, im);
+}
+
+//---------------------------------------------------------------------------
+// Single precision version of KernelTile, on coordinates that have already
+// been shifted and rounded to float.
+template <class Policy>
+static inline void KernelTileFloat(const float* tx, const float* ty, const float* tz, int nt,
+                                   const float* sx, const float* sy, const float* sz, int ns,
+                                   float mindif2, float* r2, float* r,
+                                   float* re, float* im) {
+    float K = float(2*M_PI);
+    int cnt = nt * ns;
+    for (int i = 0; i < nt; i++) {
+        float* d2 = r2 + i * ns;
+        for (int j = 0; j < ns; j++) {
+            float x = tx[i] - sx[j];
+            float y = ty[i] - sy[j];
+            float z = tz[i] - sz[j];
+            float tmp = x*x + y*y + z*z;
+            d2[j] = (tmp < mindif2) ? 1.0f : tmp;
+        }
+    }
+    vs_sqrt(cnt, r2, r);
+    Policy::amplitude(cnt, r, r2);
+    for (int k = 0; k < cnt; k++) {
+        r[k] *= K;
+    }
+    vs_sincos(cnt, r, im, re);
+    Policy::scale(cnt, r2, re, im);
+}
+
+//---------------------------------------------------------------------------
+template <class Policy>
+static int KernelMatrix(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                        double mindif2, CpxNumMat& inter) {
     int M = trgpos.n();
     int N = srcpos.n();
-    double K = 2*M_PI;
-    cpx I(0, 1);
-    double mindif2 = _mindif * _mindif;
+    double r2[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double r[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double re[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double im[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
 
-    if (_type == KERNEL_HELM) {
-        //-------------------------------
-        DblNumMat r2(M, N);
-        for (int i = 0; i < M; i++) {
-            for (int j = 0; j < N; j++) {
-                double x = trgpos(0,i) - srcpos(0,j);
-                double y = trgpos(1,i) - srcpos(1,j);
-                double z = trgpos(2,i) - srcpos(2,j);
-                double tmp = x*x + y*y + z*z;
-                r2(i,j) = tmp;
-                if (tmp < mindif2) {
-                    r2(i,j) = 1;
+    inter.resize(M, N);
+    for (int j0 = 0; j0 < N; j0 += KERNEL_TILE_SRC) {
+        int ns = std::min(KERNEL_TILE_SRC, N - j0);
+        for (int i0 = 0; i0 < M; i0 += KERNEL_TILE_TRG) {
+            int nt = std::min(KERNEL_TILE_TRG, M - i0);
+            KernelTile<Policy>(trgpos, i0, nt, srcpos, j0, ns, mindif2, r2, r, re, im);
+            for (int j = 0; j < ns; j++) {
+                cpx* col = inter.clmdata(j0 + j) + i0;
+                for (int i = 0; i < nt; i++) {
+                    col[i] = cpx(re[i * ns + j], im[i * ns + j]);
                 }
             }
         }
+    }
+    return 0;
+}
 
-        DblNumMat r(M, N);
-        mat_dsqrt(M, N, r2, r);
-    
-        DblNumMat& ir = r2;  //1/r
-        mat_dinv(M, N, r, ir);
-
-        DblNumMat& kr = r; //Kr
-        mat_dscale(M, N, kr, K);
-    
-        DblNumMat skr(M, N), ckr(M, N);
-        mat_dsincos(M, N, kr, skr, ckr);
-    
-        inter.resize(M, N);
-        for (int i = 0; i < M; i++)     {
-            for(int j = 0; j < N; j++) {
-                inter(i,j) = cpx( ckr(i, j) * ir(i, j), skr(i, j) * ir(i, j) );
+//---------------------------------------------------------------------------
+// val(:, c) += G * den(:, c) for every column c.  Each kernel tile is
+// evaluated once and applied to all columns.
+template <class Policy>
+static int KernelApply(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                       double mindif2, const CpxNumMat& den, CpxNumMat& val) {
+    int M = trgpos.n();
+    int N = srcpos.n();
+    int C = den.n();
+    double r2[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double r[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double re[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double im[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double denr[KERNEL_TILE_SRC], deni[KERNEL_TILE_SRC];
+
+    for (int j0 = 0; j0 < N; j0 += KERNEL_TILE_SRC) {
+        int ns = std::min(KERNEL_TILE_SRC, N - j0);
+        for (int i0 = 0; i0 < M; i0 += KERNEL_TILE_TRG) {
+            int nt = std::min(KERNEL_TILE_TRG, M - i0);
+            KernelTile<Policy>(trgpos, i0, nt, srcpos, j0, ns, mindif2, r2, r, re, im);
+            for (int c = 0; c < C; c++) {
+                for (int j = 0; j < ns; j++) {
+                    denr[j] = den(j0 + j, c).real();
+                    deni[j] = den(j0 + j, c).imag();
+                }
+                for (int i = 0; i < nt; i++) {
+                    double* gr = re + i * ns;
+                    double* gi = im + i * ns;
+                    double accr = 0, acci = 0;
+                    for (int j = 0; j < ns; j++) {
+                        accr += gr[j] * denr[j] - gi[j] * deni[j];
+                        acci += gr[j] * deni[j] + gi[j] * denr[j];
+                    }
+                    val(i0 + i, c) += cpx(accr, acci);
+                }
             }
         }
-    } else if (_type == KERNEL_EXPR) {
-        //-------------------------------
-        DblNumMat r2(M,N);
-        for (int i = 0; i < M; i++) {
-            for (int j = 0; j < N; j++) {
-                double x = trgpos(0,i) - srcpos(0,j);
-                double y = trgpos(1,i) - srcpos(1,j);
-                double z = trgpos(2,i) - srcpos(2,j);
-                double tmp = x*x + y*y + z*z;
-                r2(i, j) = tmp;
-                if (tmp < mindif2) {
-                    r2(i, j) = 1;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+template <class Policy>
+static int KernelApplyFloat(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                            double mindif2, const CpxNumMat& den, CpxNumMat& val) {
+    int M = trgpos.n();
+    int N = srcpos.n();
+    int C = den.n();
+    if (M == 0 || N == 0) {
+        return 0;
+    }
+    float fmindif2 = float(mindif2);
+    float r2[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float r[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float re[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float im[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float sx[KERNEL_TILE_SRC], sy[KERNEL_TILE_SRC], sz[KERNEL_TILE_SRC];
+    float denr[KERNEL_TILE_SRC], deni[KERNEL_TILE_SRC];
+    float tx[KERNEL_TILE_TRG], ty[KERNEL_TILE_TRG], tz[KERNEL_TILE_TRG];
+    // Near-field boxes are small compared to the domain, so coordinates
+    // relative to o keep most of the float mantissa.
+    double ox = trgpos(0, 0), oy = trgpos(1, 0), oz = trgpos(2, 0);
+
+    for (int j0 = 0; j0 < N; j0 += KERNEL_TILE_SRC) {
+        int ns = std::min(KERNEL_TILE_SRC, N - j0);
+        for (int j = 0; j < ns; j++) {
+            sx[j] = float(srcpos(0, j0 + j) - ox);
+            sy[j] = float(srcpos(1, j0 + j) - oy);
+            sz[j] = float(srcpos(2, j0 + j) - oz);
+        }
+        for (int i0 = 0; i0 < M; i0 += KERNEL_TILE_TRG) {
+            int nt = std::min(KERNEL_TILE_TRG, M - i0);
+            for (int i = 0; i < nt; i++) {
+                tx[i] = float(trgpos(0, i0 + i) - ox);
+                ty[i] = float(trgpos(1, i0 + i) - oy);
+                tz[i] = float(trgpos(2, i0 + i) - oz);
+            }
+            KernelTileFloat<Policy>(tx, ty, tz, nt, sx, sy, sz, ns, fmindif2,
+                                    r2, r, re, im);
+            for (int c = 0; c < C; c++) {
+                for (int j = 0; j < ns; j++) {
+                    denr[j] = float(den(j0 + j, c).real());
+                    deni[j] = float(den(j0 + j, c).imag());
+                }
+                for (int i = 0; i < nt; i++) {
+                    float* gr = re + i * ns;
+                    float* gi = im + i * ns;
+                    float accr = 0, acci = 0;
+                    for (int j = 0; j < ns; j++) {
+                        accr += gr[j] * denr[j] - gi[j] * deni[j];
+                        acci += gr[j] * deni[j] + gi[j] * denr[j];
+                    }
+                    val(i0 + i, c) += cpx(double(accr), double(acci));
                 }
             }
         }
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// aval += G(apos, bpos) * bden and bval += G(bpos, apos) * aden, from one
+// evaluation of each kernel tile.  The kernels are symmetric, so the tile
+// for (a, b) serves both directions: its rows accumulate into aval and its
+// columns into bval.
+template <class Policy>
+static int KernelApplySym(const DblNumMat& apos, const DblNumMat& bpos,
+                          double mindif2, const CpxNumMat& aden, const CpxNumMat& bden,
+                          CpxNumMat& aval, CpxNumMat& bval) {
+    int M = apos.n();
+    int N = bpos.n();
+    int C = aden.n();
+    double r2[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double r[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double re[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double im[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    double bdenr[KERNEL_TILE_SRC], bdeni[KERNEL_TILE_SRC];
+    double bvalr[KERNEL_TILE_SRC], bvali[KERNEL_TILE_SRC];
 
-        DblNumMat r(M, N);
-        mat_dsqrt(M, N, r2, r);
-    
-        DblNumMat& kr = r; //Kr
-        mat_dscale(M, N, kr, K);
-    
-        DblNumMat skr(M, N), ckr(M, N);
-        mat_dsincos(M, N, kr, skr, ckr);
-    
-        inter.resize(M, N);
-        for(int i = 0; i < M; i++) {
-            for(int j = 0; j < N; j++) {
-                inter(i,j) = cpx( ckr(i, j), skr(i, j) );
+    for (int j0 = 0; j0 < N; j0 += KERNEL_TILE_SRC) {
+        int ns = std::min(KERNEL_TILE_SRC, N - j0);
+        for (int i0 = 0; i0 < M; i0 += KERNEL_TILE_TRG) {
+            int nt = std::min(KERNEL_TILE_TRG, M - i0);
+            KernelTile<Policy>(apos, i0, nt, bpos, j0, ns, mindif2, r2, r, re, im);
+            for (int c = 0; c < C; c++) {
+                for (int j = 0; j < ns; j++) {
+                    bdenr[j] = bden(j0 + j, c).real();
+                    bdeni[j] = bden(j0 + j, c).imag();
+                    bvalr[j] = 0;
+                    bvali[j] = 0;
+                }
+                for (int i = 0; i < nt; i++) {
+                    double* gr = re + i * ns;
+                    double* gi = im + i * ns;
+                    double adr = aden(i0 + i, c).real();
+                    double adi = aden(i0 + i, c).imag();
+                    double accr = 0, acci = 0;
+                    for (int j = 0; j < ns; j++) {
+                        accr += gr[j] * bdenr[j] - gi[j] * bdeni[j];
+                        acci += gr[j] * bdeni[j] + gi[j] * bdenr[j];
+                        bvalr[j] += gr[j] * adr - gi[j] * adi;
+                        bvali[j] += gr[j] * adi + gi[j] * adr;
+                    }
+                    aval(i0 + i, c) += cpx(accr, acci);
+                }
+                for (int j = 0; j < ns; j++) {
+                    bval(j0 + j, c) += cpx(bvalr[j], bvali[j]);
+                }
             }
         }
-    } else {
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+template <class Policy>
+static int KernelApplySymFloat(const DblNumMat& apos, const DblNumMat& bpos,
+                               double mindif2, const CpxNumMat& aden, const CpxNumMat& bden,
+                               CpxNumMat& aval, CpxNumMat& bval) {
+    int M = apos.n();
+    int N = bpos.n();
+    int C = aden.n();
+    if (M == 0 || N == 0) {
+        return 0;
+    }
+    float fmindif2 = float(mindif2);
+    float r2[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float r[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float re[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float im[KERNEL_TILE_TRG * KERNEL_TILE_SRC];
+    float sx[KERNEL_TILE_SRC], sy[KERNEL_TILE_SRC], sz[KERNEL_TILE_SRC];
+    float bdenr[KERNEL_TILE_SRC], bdeni[KERNEL_TILE_SRC];
+    float bvalr[KERNEL_TILE_SRC], bvali[KERNEL_TILE_SRC];
+    float tx[KERNEL_TILE_TRG], ty[KERNEL_TILE_TRG], tz[KERNEL_TILE_TRG];
+    double ox = apos(0, 0), oy = apos(1, 0), oz = apos(2, 0);
+
+    for (int j0 = 0; j0 < N; j0 += KERNEL_TILE_SRC) {
+        int ns = std::min(KERNEL_TILE_SRC, N - j0);
+        for (int j = 0; j < ns; j++) {
+            sx[j] = float(bpos(0, j0 + j) - ox);
+            sy[j] = float(bpos(1, j0 + j) - oy);
+            sz[j] = float(bpos(2, j0 + j) - oz);
+        }
+        for (int i0 = 0; i0 < M; i0 += KERNEL_TILE_TRG) {
+            int nt = std::min(KERNEL_TILE_TRG, M - i0);
+            for (int i = 0; i < nt; i++) {
+                tx[i] = float(apos(0, i0 + i) - ox);
+                ty[i] = float(apos(1, i0 + i) - oy);
+                tz[i] = float(apos(2, i0 + i) - oz);
+            }
+            KernelTileFloat<Policy>(tx, ty, tz, nt, sx, sy, sz, ns, fmindif2,
+                                    r2, r, re, im);
+            for (int c = 0; c < C; c++) {
+                for (int j = 0; j < ns; j++) {
+                    bdenr[j] = float(bden(j0 + j, c).real());
+                    bdeni[j] = float(bden(j0 + j, c).imag());
+                    bvalr[j] = 0;
+                    bvali[j] = 0;
+                }
+                for (int i = 0; i < nt; i++) {
+                    float* gr = re + i * ns;
+                    float* gi = im + i * ns;
+                    float adr = float(aden(i0 + i, c).real());
+                    float adi = float(aden(i0 + i, c).imag());
+                    float accr = 0, acci = 0;
+                    for (int j = 0; j < ns; j++) {
+                        accr += gr[j] * bdenr[j] - gi[j] * bdeni[j];
+                        acci += gr[j] * bdeni[j] + gi[j] * bdenr[j];
+                        bvalr[j] += gr[j] * adr - gi[j] * adi;
+                        bvali[j] += gr[j] * adi + gi[j] * adr;
+                    }
+                    aval(i0 + i, c) += cpx(double(accr), double(acci));
+                }
+                for (int j = 0; j < ns; j++) {
+                    bval(j0 + j, c) += cpx(double(bvalr[j]), double(bvali[j]));
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// exp(i*K*r)/r or exp(i*K*r), depending on the kernel type
+int Kernel3d::kernel(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                     const DblNumMat& srcnor, CpxNumMat& inter) {
+#ifndef RELEASE
+    CallStackEntry entry("Kernel3d::kernel");
+#endif
+    double mindif2 = _mindif * _mindif;
+    switch (_type) {
+    case KERNEL_HELM:
+        return KernelMatrix<HelmKernel>(trgpos, srcpos, mindif2, inter);
+    case KERNEL_EXPR:
+        return KernelMatrix<ExprKernel>(trgpos, srcpos, mindif2, inter);
+    default:
+	std::cerr << "Unknown kernel type " << _type << std::endl;
+        throw new std::exception();
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+int Kernel3d::apply(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                    const CpxNumMat& den, CpxNumMat& val) {
+#ifndef RELEASE
+    CallStackEntry entry("Kernel3d::apply");
+#endif
+    CHECK_TRUE(den.m() == srcpos.n() && val.m() == trgpos.n() && den.n() == val.n());
+    double mindif2 = _mindif * _mindif;
+    switch (_type) {
+    case KERNEL_HELM:
+        return KernelApply<HelmKernel>(trgpos, srcpos, mindif2, den, val);
+    case KERNEL_EXPR:
+        return KernelApply<ExprKernel>(trgpos, srcpos, mindif2, den, val);
+    default:
+	std::cerr << "Unknown kernel type " << _type << std::endl;
+        throw new std::exception();
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+int Kernel3d::apply(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                    const CpxNumVec& den, CpxNumVec& val) {
+    CpxNumMat denmat(den.m(), 1, false, den.data());
+    CpxNumMat valmat(val.m(), 1, false, val.data());
+    return apply(trgpos, srcpos, denmat, valmat);
+}
+
+//---------------------------------------------------------------------------
+int Kernel3d::apply_float(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                          const CpxNumMat& den, CpxNumMat& val) {
+#ifndef RELEASE
+    CallStackEntry entry("Kernel3d::apply_float");
+#endif
+    CHECK_TRUE(den.m() == srcpos.n() && val.m() == trgpos.n() && den.n() == val.n());
+    double mindif2 = _mindif * _mindif;
+    switch (_type) {
+    case KERNEL_HELM:
+        return KernelApplyFloat<HelmKernel>(trgpos, srcpos, mindif2, den, val);
+    case KERNEL_EXPR:
+        return KernelApplyFloat<ExprKernel>(trgpos, srcpos, mindif2, den, val);
+    default:
+	std::cerr << "Unknown kernel type " << _type << std::endl;
+        throw new std::exception();
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+int Kernel3d::apply_float(const DblNumMat& trgpos, const DblNumMat& srcpos,
+                          const CpxNumVec& den, CpxNumVec& val) {
+    CpxNumMat denmat(den.m(), 1, false, den.data());
+    CpxNumMat valmat(val.m(), 1, false, val.data());
+    return apply_float(trgpos, srcpos, denmat, valmat);
+}
+
+//---------------------------------------------------------------------------
+int Kernel3d::apply_sym(const DblNumMat& apos, const DblNumMat& bpos,
+                        const CpxNumMat& aden, const CpxNumMat& bden,
+                        CpxNumMat& aval, CpxNumMat& bval, bool single) {
+#ifndef RELEASE
+    CallStackEntry entry("Kernel3d::apply_sym");
+#endif
+    CHECK_TRUE(aden.m() == apos.n() && aval.m() == apos.n());
+    CHECK_TRUE(bden.m() == bpos.n() && bval.m() == bpos.n());
+    CHECK_TRUE(aden.n() == bden.n() && aval.n() == aden.n() && bval.n() == bden.n());
+    double mindif2 = _mindif * _mindif;
+    switch (_type) {
+    case KERNEL_HELM:
+        if (single) {
+            return KernelApplySymFloat<HelmKernel>(apos, bpos, mindif2, aden, bden, aval, bval);
+        }
+        return KernelApplySym<HelmKernel>(apos, bpos, mindif2, aden, bden, aval, bval);
+    case KERNEL_EXPR:
+        if (single) {
+            return KernelApplySymFloat<ExprKernel>(apos, bpos, mindif2, aden, bden, aval, bval);
+        }
+        return KernelApplySym<ExprKernel>(apos, bpos, mindif2, aden, bden, aval, bval);
+    default:
 	std::cerr << "Unknown kernel type " << _type << std::endl;
         throw new std::exception();
     }
@@ -29,7 +29,7 @@ Point3 ShiftedPoint(int dir_ind, double W) {
     return Point3((a - 0.5) * W / 2, (b - 0.5) * W / 2, (c - 0.5) * W / 2);
 }
 
-int Transpose(CpxNumMat& trg, CpxNumMat& src) {
+int Transpose(CpxNumMat& trg, const CpxNumMat& src) {
 #ifndef RELEASE
     CallStackEntry entry("Transpose");
 #endif
@@ -66,6 +66,66 @@ int negate(DblNumMat& src) {
     return 0;
 }
 
+//-----------------------------------
+// Replace the uc2ue factors by single precision copies
+static int DemoteFactors(NumVec<CpxNumMat>& uc2ue, NumVec<Cpx8NumMat>& fuc2ue) {
+    fuc2ue.resize(uc2ue.m());
+    for (int k = 0; k < uc2ue.m(); ++k) {
+        CpxNumMat& mat = uc2ue(k);
+        fuc2ue(k).resize(mat.m(), mat.n());
+        std::copy(mat.data(), mat.data() + mat.m() * mat.n(), fuc2ue(k).data());
+    }
+    uc2ue.resize(0);
+    return 0;
+}
+
+static int DemoteEntry(LowFreqEntry& le) {
+    SAFE_FUNC_EVAL( DemoteFactors(le._uc2ue, le._fuc2ue) );
+    SAFE_FUNC_EVAL( le._ue2dctbl.demote() );
+    return 0;
+}
+
+static int DemoteEntry(HghFreqDirEntry& he) {
+    SAFE_FUNC_EVAL( DemoteFactors(he._uc2ue, he._fuc2ue) );
+    return 0;
+}
+
+// Non-owning view of a table array
+template <class F>
+static NumMat<F> ViewOf(const NumMat<F>& a) {
+    return NumMat<F>(a.m(), a.n(), false, a.data());
+}
+
+// Views of the uc2ue factors of an entry, in the precision they are stored
+// in.  upcast is the buffer the single precision ones are upcast into when
+// applied.
+template <class E>
+static int Uc2ueFetch(const E& e, std::vector<cpx>* upcast, FetchDat& dat) {
+    if (e._fuc2ue.m() == 0) {
+        dat._uc2ue.resize(3);
+        for (int i = 0; i < 3; ++i) {
+            dat._uc2ue(i) = ViewOf(e._uc2ue(i));
+        }
+        return 0;
+    }
+    dat._fuc2ue.resize(3);
+    for (int i = 0; i < 3; ++i) {
+        dat._fuc2ue(i) = ViewOf(e._fuc2ue(i));
+    }
+    dat._upcast = upcast;
+    return 0;
+}
+
+//-----------------------------------
+// Keep only the symmetry-unique V list tensors of an entry as read
+static int CompressUe2dc(LowFreqEntry& le) {
+    if (le.ue2dc().m() == 7) {
+        SAFE_FUNC_EVAL( le.ue2dctbl().setup(le.ue2dc()) );
+    }
+    le.ue2dc().resize(0, 0, 0);
+    return 0;
+}
+
 //-----------------------------------
 int Mlib3d::setup(std::map<std::string, std::string>& opts)
 {
@@ -89,191 +149,871 @@ int Mlib3d::setup(std::map<std::string, std::string>& opts)
         std::istringstream ss(mi->second);
         ss >> _hdname;
     }
+    // memory cap of the fetch cache in MB, 0 for no cap
+    double fetchcache_mb = 0;
+    mi = opts.find("-" + prefix() + "FETCHCACHE");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> fetchcache_mb;
+    }
+    _fetchbudget = fetchcache_mb * 1024 * 1024;
+    // one copy of the tables per node, in MPI-3 shared memory
+    int sharedtables = 0;
+    mi = opts.find("-" + prefix() + "SHAREDTABLES");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> sharedtables;
+    }
+    // read the entries of indexed table files when first needed
+    mi = opts.find("-" + prefix() + "LAZY");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> _lazy;
+    }
+    CHECK_TRUE(!(_lazy && sharedtables));
+    // single precision uc2ue factors and V list tensors
+    mi = opts.find("-" + prefix() + "FLOATTABLES");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> _floattables;
+    }
+    // compute (and save) the tables that are not found in data/
+    int generate = 0;
+    mi = opts.find("-" + prefix() + "GENERATE");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> generate;
+    }
+    int ACCU = 1;
+    mi = opts.find("-" + prefix() + "ACCU");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> ACCU;
+    }
+    // largest high frequency box width generated
+    int genmaxW = 16;
+    mi = opts.find("-" + prefix() + "GENMAXW");
+    if(mi!=opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> genmaxW;
+    }
+    SAFE_FUNC_EVAL( ReleaseTables() );
+    _fetchmap.clear();
+    _fetchlru.clear();
+    _fetchbytes = 0;
+    reset_fetch_counts();
   
-    //LEXING: read data in a shared way
     std::vector<int> all(1,1);
-    std::istringstream liss;
-    SAFE_FUNC_EVAL( SharedRead(_ldname, liss) );
-    SAFE_FUNC_EVAL( deserialize(_w2ldmap, liss, all) );
-    std::istringstream hiss;
-    SAFE_FUNC_EVAL( SharedRead(_hdname, hiss) );
-    SAFE_FUNC_EVAL( deserialize(_w2hdmap, hiss, all) );
-  
+    if (generate) {
+        bool exists;
+        SAFE_FUNC_EVAL( SharedExists(_ldname, exists) );
+        if (!exists) {
+            std::vector<double> Ws;
+            for (int k = 7; k >= 1; --k) {
+                Ws.push_back(1.0 / (1 << k));
+            }
+            std::map<double, LowFreqEntry> w2ldmap;
+            SAFE_FUNC_EVAL( GenerateLowFreq(ACCU, Ws, w2ldmap) );
+            if (_lazy) {
+                SAFE_FUNC_EVAL( SharedWriteIndexed(_ldname, w2ldmap) );
+            } else {
+                std::ostringstream oss;
+                SAFE_FUNC_EVAL( serialize(w2ldmap, oss, all) );
+                SAFE_FUNC_EVAL( SharedWrite(_ldname, oss) );
+            }
+        }
+        SAFE_FUNC_EVAL( SharedExists(_hdname, exists) );
+        if (!exists) {
+            std::vector<double> Ws;
+            for (int W = 1; W <= genmaxW; W *= 2) {
+                Ws.push_back(W);
+            }
+            std::map<double, std::map<Index3, HghFreqDirEntry> > w2hdmap;
+            SAFE_FUNC_EVAL( GenerateHghFreq(ACCU, _NPQ, Ws, w2hdmap) );
+            if (_lazy) {
+                SAFE_FUNC_EVAL( SharedWriteIndexed(_hdname, w2hdmap) );
+            } else {
+                std::ostringstream oss;
+                SAFE_FUNC_EVAL( serialize(w2hdmap, oss, all) );
+                SAFE_FUNC_EVAL( SharedWrite(_hdname, oss) );
+            }
+        }
+    }
+
+    _w2ldmap.clear();
+    _w2hdmap.clear();
+    _loadcount = 0;
+    _loadbytes = 0;
+    _loadsecs = 0;
+    bool ldindexed, hdindexed;
+    SAFE_FUNC_EVAL( SharedReadIndex(_ldname, ldindexed, _ldindex, _ldstart) );
+    SAFE_FUNC_EVAL( SharedReadIndex(_hdname, hdindexed, _hdindex, _hdstart) );
+    CHECK_TRUE(!_lazy || (ldindexed && hdindexed));
+
+    //LEXING: read data in a shared way
+    if (!_lazy) {
+        std::istringstream liss;
+        SAFE_FUNC_EVAL( SharedRead(_ldname, liss) );
+        if (ldindexed) {
+            liss.seekg(_ldstart);
+            for (table_index_t::iterator ii = _ldindex.begin(); ii != _ldindex.end(); ++ii) {
+                SAFE_FUNC_EVAL( deserialize(_w2ldmap[ii->first.first], liss, all) );
+            }
+        } else {
+            SAFE_FUNC_EVAL( deserialize(_w2ldmap, liss, all) );
+        }
+        std::istringstream hiss;
+        SAFE_FUNC_EVAL( SharedRead(_hdname, hiss) );
+        if (hdindexed) {
+            hiss.seekg(_hdstart);
+            for (table_index_t::iterator ii = _hdindex.begin(); ii != _hdindex.end(); ++ii) {
+                SAFE_FUNC_EVAL( deserialize(_w2hdmap[ii->first.first][ii->first.second],
+                                            hiss, all) );
+            }
+        } else {
+            SAFE_FUNC_EVAL( deserialize(_w2hdmap, hiss, all) );
+        }
+    }
+
+    //keep only the symmetry-unique V list tensors
+    for (std::map<double, LowFreqEntry>::iterator mi = _w2ldmap.begin();
+         mi != _w2ldmap.end(); ++mi) {
+        SAFE_FUNC_EVAL( CompressUe2dc(mi->second) );
+        if (_floattables) {
+            SAFE_FUNC_EVAL( DemoteEntry(mi->second) );
+        }
+    }
+    if (_floattables) {
+        for (std::map<double, std::map<Index3, HghFreqDirEntry> >::iterator mi = _w2hdmap.begin();
+             mi != _w2hdmap.end(); ++mi) {
+            for (std::map<Index3, HghFreqDirEntry>::iterator mj = mi->second.begin();
+                 mj != mi->second.end(); ++mj) {
+                SAFE_FUNC_EVAL( DemoteEntry(mj->second) );
+            }
+        }
+    }
+    if (!_lazy) {
+        int mpirank, mpisize;
+        getMPIInfo(&mpirank, &mpisize);
+        double mb = tablebytes() / 1048576.0;
+        if (mpirank == 0) {
+            std::cerr << "Translation tables: " << mb << " MB per process, "
+                      << (_floattables ? "single" : "double") << " precision" << std::endl;
+        }
+    }
+    if (sharedtables) {
+        SAFE_FUNC_EVAL( ShareTables() );
+    }
+    return 0;
+}
+
+//-----------------------------------
+// Place the arrays of the tables at base + off (aligned), copying them there
+// if copy is set, and make the entries views of that memory.  With base
+// NULL, only off is advanced, to size the segment.
+static const size_t TABLE_ALIGN = 64;
+
+template <class F>
+static void ShareArray(NumVec<F>& a, char* base, size_t& off, bool copy) {
+    off = (off + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+    size_t sz = size_t(a.m()) * sizeof(F);
+    if (base != NULL && sz > 0) {
+        F* ptr = (F*) (base + off);
+        if (copy) {
+            std::copy(a.data(), a.data() + a.m(), ptr);
+        }
+        a = NumVec<F>(a.m(), false, ptr);
+    }
+    off += sz;
+}
+
+template <class F>
+static void ShareArray(NumMat<F>& a, char* base, size_t& off, bool copy) {
+    off = (off + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+    size_t sz = size_t(a.m()) * a.n() * sizeof(F);
+    if (base != NULL && sz > 0) {
+        F* ptr = (F*) (base + off);
+        if (copy) {
+            std::copy(a.data(), a.data() + a.m() * a.n(), ptr);
+        }
+        a = NumMat<F>(a.m(), a.n(), false, ptr);
+    }
+    off += sz;
+}
+
+template <class F>
+static void ShareArray(NumTns<F>& a, char* base, size_t& off, bool copy) {
+    off = (off + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+    size_t sz = size_t(a.m()) * a.n() * a.p() * sizeof(F);
+    if (base != NULL && sz > 0) {
+        F* ptr = (F*) (base + off);
+        if (copy) {
+            std::copy(a.data(), a.data() + a.m() * a.n() * a.p(), ptr);
+        }
+        a = NumTns<F>(a.m(), a.n(), a.p(), false, ptr);
+    }
+    off += sz;
+}
+
+// Walk the arrays of the tables in a fixed order (the same on every process)
+static size_t ShareTableArrays(std::map<double, LowFreqEntry>& w2ldmap,
+                               std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap,
+                               char* base, bool copy) {
+    size_t off = 0;
+    for (std::map<double, LowFreqEntry>::iterator mi = w2ldmap.begin();
+         mi != w2ldmap.end(); ++mi) {
+        LowFreqEntry& le = mi->second;
+        ShareArray(le._uep, base, off, copy);
+        ShareArray(le._ucp, base, off, copy);
+        for (int k = 0; k < le._uc2ue.m(); ++k) {
+            ShareArray(le._uc2ue(k), base, off, copy);
+        }
+        for (int k = 0; k < le._fuc2ue.m(); ++k) {
+            ShareArray(le._fuc2ue(k), base, off, copy);
+        }
+        Ue2dcTable& tbl = le._ue2dctbl;
+        for (int k = 0; k < tbl._tns.m(); ++k) {
+            ShareArray(tbl._tns(k), base, off, copy);
+        }
+        for (int k = 0; k < tbl._maps.m(); ++k) {
+            ShareArray(tbl._maps(k), base, off, copy);
+        }
+        for (int k = 0; k < tbl._ftns.m(); ++k) {
+            ShareArray(tbl._ftns(k), base, off, copy);
+        }
+    }
+    for (std::map<double, std::map<Index3, HghFreqDirEntry> >::iterator mi = w2hdmap.begin();
+         mi != w2hdmap.end(); ++mi) {
+        for (std::map<Index3, HghFreqDirEntry>::iterator mj = mi->second.begin();
+             mj != mi->second.end(); ++mj) {
+            HghFreqDirEntry& he = mj->second;
+            ShareArray(he._uep, base, off, copy);
+            ShareArray(he._ucp, base, off, copy);
+            for (int k = 0; k < he._uc2ue.m(); ++k) {
+                ShareArray(he._uc2ue(k), base, off, copy);
+            }
+            for (int k = 0; k < he._fuc2ue.m(); ++k) {
+                ShareArray(he._fuc2ue(k), base, off, copy);
+            }
+        }
+    }
+    return off;
+}
+
+//-----------------------------------
+int Mlib3d::ShareTables() {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::ShareTables");
+#endif
+    CHECK_TRUE(_tablewin == MPI_WIN_NULL);
+    SAFE_FUNC_EVAL( MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                                        MPI_INFO_NULL, &_nodecomm) );
+    int noderank, nodesize;
+    SAFE_FUNC_EVAL( MPI_Comm_rank(_nodecomm, &noderank) );
+    SAFE_FUNC_EVAL( MPI_Comm_size(_nodecomm, &nodesize) );
+    size_t total = ShareTableArrays(_w2ldmap, _w2hdmap, NULL, false);
+    //the node leader holds the segment and fills it
+    char* base;
+    SAFE_FUNC_EVAL( MPI_Win_allocate_shared(noderank == 0 ? MPI_Aint(total) : 0, 1,
+                                            MPI_INFO_NULL, _nodecomm, &base, &_tablewin) );
+    MPI_Aint sz;
+    int disp;
+    SAFE_FUNC_EVAL( MPI_Win_shared_query(_tablewin, 0, &sz, &disp, &base) );
+    CHECK_TRUE(size_t(sz) >= total);
+    if (noderank == 0) {
+        ShareTableArrays(_w2ldmap, _w2hdmap, base, true);
+    }
+    SAFE_FUNC_EVAL( MPI_Barrier(_nodecomm) );
+    if (noderank != 0) {
+        ShareTableArrays(_w2ldmap, _w2hdmap, base, false);
+    }
+    SAFE_FUNC_EVAL( MPI_Barrier(_nodecomm) );
+    _sharedbytes = total;
+
+    int leader = (noderank == 0);
+    int numnodes = 0;
+    SAFE_FUNC_EVAL( MPI_Reduce(&leader, &numnodes, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD) );
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    if (mpirank == 0) {
+        std::cerr << "Translation tables: " << total / 1048576.0 << " MB per node, in shared "
+                  << "memory on " << numnodes << " nodes (" << double(total) * mpisize / 1048576.0
+                  << " MB total as private copies)" << std::endl;
+    }
+    return 0;
+}
+
+//-----------------------------------
+double Mlib3d::tablebytes() {
+    double sz = 0;
+    for (std::map<double, LowFreqEntry>::iterator mi = _w2ldmap.begin();
+         mi != _w2ldmap.end(); ++mi) {
+        LowFreqEntry& le = mi->second;
+        sz += (le._uep.m() * le._uep.n() + le._ucp.m() * le._ucp.n()) * sizeof(double);
+        for (int k = 0; k < le._uc2ue.m(); ++k) {
+            sz += double(le._uc2ue(k).m()) * le._uc2ue(k).n() * sizeof(cpx);
+        }
+        for (int k = 0; k < le._fuc2ue.m(); ++k) {
+            sz += double(le._fuc2ue(k).m()) * le._fuc2ue(k).n() * sizeof(cpx8);
+        }
+        sz += le._ue2dctbl.bytes();
+    }
+    for (std::map<double, std::map<Index3, HghFreqDirEntry> >::iterator mi = _w2hdmap.begin();
+         mi != _w2hdmap.end(); ++mi) {
+        for (std::map<Index3, HghFreqDirEntry>::iterator mj = mi->second.begin();
+             mj != mi->second.end(); ++mj) {
+            HghFreqDirEntry& he = mj->second;
+            sz += (he._uep.m() * he._uep.n() + he._ucp.m() * he._ucp.n()) * sizeof(double);
+            for (int k = 0; k < he._uc2ue.m(); ++k) {
+                sz += double(he._uc2ue(k).m()) * he._uc2ue(k).n() * sizeof(cpx);
+            }
+            for (int k = 0; k < he._fuc2ue.m(); ++k) {
+                sz += double(he._fuc2ue(k).m()) * he._fuc2ue(k).n() * sizeof(cpx8);
+            }
+        }
+    }
+    return sz;
+}
+
+//-----------------------------------
+int Mlib3d::ReleaseTables() {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::ReleaseTables");
+#endif
+    if (_tablewin == MPI_WIN_NULL) {
+        return 0;
+    }
+    //the entries and the cached fetches may point into the window
+    _w2ldmap.clear();
+    _w2hdmap.clear();
+    _fetchmap.clear();
+    _fetchlru.clear();
+    _fetchbytes = 0;
+    SAFE_FUNC_EVAL( MPI_Win_free(&_tablewin) );
+    SAFE_FUNC_EVAL( MPI_Comm_free(&_nodecomm) );
+    _sharedbytes = 0;
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::LoadEntry(const std::string& name, long start, std::pair<long, long> pos,
+                      std::string& buf) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::LoadEntry");
+#endif
+    double t0 = MPI_Wtime();
+    std::string filename = "data/" + name;
+    std::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+    CHECK_TRUE(!fin.fail());
+    fin.seekg(start + pos.first);
+    buf.resize(pos.second);
+    fin.read(&buf[0], pos.second);
+    CHECK_TRUE(fin.gcount() == pos.second);
+    ++_loadcount;
+    _loadbytes += pos.second;
+    _loadsecs += MPI_Wtime() - t0;
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::LowEntry(double W, LowFreqEntry*& le) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::LowEntry");
+#endif
+    std::map<double, LowFreqEntry>::iterator mi = _w2ldmap.find(W);
+    if (mi != _w2ldmap.end()) {
+        le = &(mi->second);
+        return 0;
+    }
+    le = NULL;
+    if (!_lazy) {
+        return 0;
+    }
+    table_index_t::iterator ii = _ldindex.find(std::make_pair(W, Index3(0, 0, 0)));
+    if (ii == _ldindex.end()) {
+        return 0;
+    }
+    std::string buf;
+    SAFE_FUNC_EVAL( LoadEntry(_ldname, _ldstart, ii->second, buf) );
+    std::istringstream iss(buf);
+    std::vector<int> all(1, 1);
+    le = &(_w2ldmap[W]);
+    SAFE_FUNC_EVAL( deserialize(*le, iss, all) );
+    SAFE_FUNC_EVAL( CompressUe2dc(*le) );
+    if (_floattables) {
+        SAFE_FUNC_EVAL( DemoteEntry(*le) );
+    }
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::HghEntry(double W, Index3 srt, HghFreqDirEntry*& he) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::HghEntry");
+#endif
+    std::map<double, std::map<Index3, HghFreqDirEntry> >::iterator mi = _w2hdmap.find(W);
+    if (mi != _w2hdmap.end()) {
+        std::map<Index3, HghFreqDirEntry>::iterator mj = mi->second.find(srt);
+        if (mj != mi->second.end()) {
+            he = &(mj->second);
+            return 0;
+        }
+    }
+    he = NULL;
+    if (!_lazy) {
+        return 0;
+    }
+    table_index_t::iterator ii = _hdindex.find(std::make_pair(W, srt));
+    if (ii == _hdindex.end()) {
+        return 0;
+    }
+    std::string buf;
+    SAFE_FUNC_EVAL( LoadEntry(_hdname, _hdstart, ii->second, buf) );
+    std::istringstream iss(buf);
+    std::vector<int> all(1, 1);
+    he = &(_w2hdmap[W][srt]);
+    SAFE_FUNC_EVAL( deserialize(*he, iss, all) );
+    if (_floattables) {
+        SAFE_FUNC_EVAL( DemoteEntry(*he) );
+    }
     return 0;
 }
 
 //-----------------------------------
-int Mlib3d::UpwardLowFetch(double W, DblNumMat& uep, DblNumMat& ucp,
-                           NumVec<CpxNumMat>& uc2ue, NumTns<CpxNumMat>& ue2uc) {
+int Mlib3d::Prefetch(const std::set<double>& lws, const std::set<Index3>& hdirs) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::Prefetch");
+#endif
+    if (!_lazy) {
+        return 0;
+    }
+    LowFreqEntry* le;
+    HghFreqDirEntry* he;
+    for (std::set<double>::const_iterator si = lws.begin(); si != lws.end(); ++si) {
+        SAFE_FUNC_EVAL( LowEntry(*si, le) );
+        SAFE_FUNC_EVAL( LowEntry(*si / 2, le) );
+    }
+    //a direction needs its parents at the smaller widths, down to W = 1,
+    //and the W = 1/2 low frequency level
+    for (std::set<Index3>::const_iterator si = hdirs.begin(); si != hdirs.end(); ++si) {
+        Index3 dir = *si;
+        double W = double(dir.linfty()) / _NPQ;
+        while (W >= 1) {
+            Index3 srt, sgn, prm;
+            SAFE_FUNC_EVAL( HighFetchIndex3Sort(dir, srt, sgn, prm) );
+            SAFE_FUNC_EVAL( HghEntry(W, srt, he) );
+            if (W == 1) {
+                SAFE_FUNC_EVAL( LowEntry(W / 2, le) );
+                break;
+            }
+            dir = predir(dir);
+            W /= 2;
+        }
+    }
+    long lcl[2] = {_loadcount, long(_loadbytes)};
+    long sum[2], mx[2];
+    SAFE_FUNC_EVAL( MPI_Reduce(lcl, sum, 2, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD) );
+    SAFE_FUNC_EVAL( MPI_Reduce(lcl, mx, 2, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD) );
+    double secs;
+    SAFE_FUNC_EVAL( MPI_Reduce(&_loadsecs, &secs, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD) );
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    if (mpirank == 0) {
+        long total = _ldindex.size() + _hdindex.size();
+        std::cerr << "Table entries read per process: average "
+                  << double(sum[0]) / mpisize << ", max " << mx[0] << " of " << total
+                  << " (" << double(sum[1]) / mpisize / 1048576.0 << " MB average, "
+                  << mx[1] / 1048576.0 << " MB max, " << secs << " secs max)" << std::endl;
+    }
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::UpwardLowFetch(double W, const FetchDat*& dat) {
 #ifndef RELEASE
     CallStackEntry entry("Mlib3d::UpwardLowFetch");
 #endif
-    CHECK_TRUE(_w2ldmap.find(W) != _w2ldmap.end());
-    LowFreqEntry& le = _w2ldmap[W];
-  
-    uep = le.uep();
-    ucp = le.ucp();
-    uc2ue.resize(3);
+    fetch_key_t key(0, std::make_pair(W, Index3(0, 0, 0)));
+    dat = FetchFind(key);
+    if (dat == NULL) {
+        FetchDat* slot = FetchAdd(key);
+        double t0 = MPI_Wtime();
+        SAFE_FUNC_EVAL( UpwardLowBuild(W, *slot) );
+        slot->_secs = MPI_Wtime() - t0;
+        SAFE_FUNC_EVAL( FetchCharge(*slot) );
+        dat = slot;
+    }
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::DownwardLowFetch(double W, const FetchDat*& dat) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::DownwardLowFetch");
+#endif
+    fetch_key_t key(1, std::make_pair(W, Index3(0, 0, 0)));
+    dat = FetchFind(key);
+    if (dat == NULL) {
+        FetchDat* slot = FetchAdd(key);
+        double t0 = MPI_Wtime();
+        SAFE_FUNC_EVAL( DownwardLowBuild(W, *slot) );
+        slot->_secs = MPI_Wtime() - t0;
+        SAFE_FUNC_EVAL( FetchCharge(*slot) );
+        dat = slot;
+    }
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::UpwardHighFetch(double W, Index3 dir, const FetchDat*& dat) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::UpwardHighFetch");
+#endif
+    fetch_key_t key(0, std::make_pair(W, dir));
+    dat = FetchFind(key);
+    if (dat == NULL) {
+        FetchDat* slot = FetchAdd(key);
+        double t0 = MPI_Wtime();
+        SAFE_FUNC_EVAL( UpwardHighBuild(W, dir, *slot) );
+        slot->_secs = MPI_Wtime() - t0;
+        SAFE_FUNC_EVAL( FetchCharge(*slot) );
+        dat = slot;
+    }
+    return 0;
+}
+
+//-----------------------------------
+int Mlib3d::DownwardHighFetch(double W, Index3 dir, const FetchDat*& dat) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::DownwardHighFetch");
+#endif
+    fetch_key_t key(1, std::make_pair(W, dir));
+    dat = FetchFind(key);
+    if (dat == NULL) {
+        FetchDat* slot = FetchAdd(key);
+        double t0 = MPI_Wtime();
+        SAFE_FUNC_EVAL( DownwardHighBuild(W, dir, *slot) );
+        slot->_secs = MPI_Wtime() - t0;
+        SAFE_FUNC_EVAL( FetchCharge(*slot) );
+        dat = slot;
+    }
+    return 0;
+}
+
+//-----------------------------------
+FetchDat* Mlib3d::FetchFind(const fetch_key_t& key) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::FetchFind");
+#endif
+    std::map<fetch_key_t, std::pair<FetchDat, std::list<fetch_key_t>::iterator> >::iterator mi =
+        _fetchmap.find(key);
+    if (mi == _fetchmap.end()) {
+        ++_fetchmisses;
+        return NULL;
+    }
+    ++_fetchhits;
+    _fetchsaved += mi->second.first._secs;
+    _fetchlru.splice(_fetchlru.begin(), _fetchlru, mi->second.second);
+    return &(mi->second.first);
+}
+
+//-----------------------------------
+FetchDat* Mlib3d::FetchAdd(const fetch_key_t& key) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::FetchAdd");
+#endif
+    _fetchlru.push_front(key);
+    std::pair<FetchDat, std::list<fetch_key_t>::iterator>& ent = _fetchmap[key];
+    ent.second = _fetchlru.begin();
+    return &(ent.first);
+}
+
+//-----------------------------------
+int Mlib3d::FetchCharge(FetchDat& dat) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::FetchCharge");
+#endif
+    _fetchbytes += dat.bytes();
+    _fetchsecs += dat._secs;
+    //dat is the most recently used entry, so it is never the one dropped
+    while (_fetchbudget > 0 && _fetchlru.size() > 1 && _fetchbytes > _fetchbudget) {
+        std::map<fetch_key_t, std::pair<FetchDat, std::list<fetch_key_t>::iterator> >::iterator mi =
+            _fetchmap.find(_fetchlru.back());
+        _fetchbytes -= mi->second.first.bytes();
+        _fetchmap.erase(mi);
+        _fetchlru.pop_back();
+    }
+    return 0;
+}
+
+//-----------------------------------
+const CpxNumMat& FetchDat::factor(int i, CpxNumMat& view) const {
+    if (_fuc2ue.m() == 0) {
+        return _uc2ue(i);
+    }
+    const Cpx8NumMat& mat = _fuc2ue(i);
+    size_t sz = size_t(mat.m()) * mat.n();
+    if (_upcast->size() < sz) {
+        _upcast->resize(sz);
+    }
+    std::copy(mat.data(), mat.data() + sz, _upcast->begin());
+    view = CpxNumMat(mat.m(), mat.n(), false, sz > 0 ? &((*_upcast)[0]) : NULL);
+    return view;
+}
+
+//-----------------------------------
+int FetchDat::rows(int i) const {
+    return _fuc2ue.m() == 0 ? _uc2ue(i).m() : _fuc2ue(i).m();
+}
+
+int FetchDat::cols(int i) const {
+    return _fuc2ue.m() == 0 ? _uc2ue(i).n() : _fuc2ue(i).n();
+}
+
+//-----------------------------------
+// The factors are used one at a time, so that single precision ones can
+// share one upcast buffer.
+int FetchDat::uc2ue_apply(const CpxNumMat& in, CpxNumMat& out) const {
+#ifndef RELEASE
+    CallStackEntry entry("FetchDat::uc2ue_apply");
+#endif
+    CpxNumMat view;
+    CpxNumMat mid(rows(2), in.n());
+    SAFE_FUNC_EVAL( zgemm(1.0, factor(2, view), in, 0.0, mid) );
+    const CpxNumMat& is = factor(1, view);
+    CpxNumMat mid2;
+    if (_low) {
+        for (int j = 0; j < mid.n(); ++j) {
+            for (int k = 0; k < mid.m(); ++k) {
+                mid(k, j) = mid(k, j) * is(k, 0);
+            }
+        }
+    } else {
+        mid2.resize(is.m(), in.n());
+        SAFE_FUNC_EVAL( zgemm(1.0, is, mid, 0.0, mid2) );
+    }
+    out.resize(rows(0), in.n());
+    SAFE_FUNC_EVAL( zgemm(1.0, factor(0, view), _low ? mid : mid2, 0.0, out) );
+    return 0;
+}
+
+//-----------------------------------
+int FetchDat::dc2de_apply(const CpxNumMat& in, CpxNumMat& out) const {
+#ifndef RELEASE
+    CallStackEntry entry("FetchDat::dc2de_apply");
+#endif
+    CpxNumMat view;
+    CpxNumMat mid(cols(0), in.n());
+    SAFE_FUNC_EVAL( zgemm_trans(1.0, factor(0, view), in, 0.0, mid) );
+    const CpxNumMat& is = factor(1, view);
+    CpxNumMat mid2;
+    if (_low) {
+        for (int j = 0; j < mid.n(); ++j) {
+            for (int k = 0; k < mid.m(); ++k) {
+                mid(k, j) = mid(k, j) * is(k, 0);
+            }
+        }
+    } else {
+        mid2.resize(is.n(), in.n());
+        SAFE_FUNC_EVAL( zgemm_trans(1.0, is, mid, 0.0, mid2) );
+    }
+    out.resize(cols(2), in.n());
+    SAFE_FUNC_EVAL( zgemm_trans(1.0, factor(2, view), _low ? mid : mid2, 0.0, out) );
+    return 0;
+}
+
+//-----------------------------------
+double FetchDat::applymuls() const {
+    double muls = 0;
     for (int i = 0; i < 3; ++i) {
-      uc2ue(i) = le.uc2ue()(i);
+        if (!_low || i != 1) {
+            muls += double(rows(i)) * cols(i);
+        }
+    }
+    return muls;
+}
+
+//-----------------------------------
+double FetchDat::bytes() const {
+    double sz = 0;
+    const DblNumMat* pts[4] = { &_uep, &_ucp, &_dep, &_dcp };
+    for (int k = 0; k < 4; ++k) {
+        if (pts[k]->owndata()) {
+            sz += double(pts[k]->m() * pts[k]->n()) * sizeof(double);
+        }
+    }
+    for (int i = 0; i < _uc2ue.m(); ++i) {
+        if (_uc2ue(i).owndata()) {
+            sz += double(_uc2ue(i).m() * _uc2ue(i).n()) * sizeof(cpx);
+        }
+    }
+    for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
+        int a = CHILD_IND1(ind);
+        int b = CHILD_IND2(ind);
+        int c = CHILD_IND3(ind);
+        if (_ue2uc.m() == 2) {
+            sz += double(_ue2uc(a,b,c).m() * _ue2uc(a,b,c).n()) * sizeof(cpx);
+        }
+        if (_de2dc.m() == 2) {
+            sz += double(_de2dc(a,b,c).m() * _de2dc(a,b,c).n()) * sizeof(cpx);
+        }
     }
+    return sz;
+}
+
+//-----------------------------------
+int Mlib3d::UpwardLowBuild(double W, FetchDat& dat) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::UpwardLowBuild");
+#endif
+    LowFreqEntry* lep;
+    SAFE_FUNC_EVAL( LowEntry(W, lep) );
+    CHECK_TRUE(lep != NULL);
+    LowFreqEntry& le = *lep;
+  
+    dat._low = true;
+    dat._uep = ViewOf(le.uep());
+    dat._ucp = ViewOf(le.ucp());
+    SAFE_FUNC_EVAL( Uc2ueFetch(le, &_upcast, dat) );
   
-    DblNumMat uepchd = _w2ldmap[W / 2].uep();
+    DblNumMat uepchd;
+    SAFE_FUNC_EVAL( LowEntry(W / 2, lep) );
+    if (lep != NULL) {
+        uepchd = ViewOf(lep->uep());
+    }
 
-    ue2uc.resize(2, 2, 2);
+    dat._ue2uc.resize(2, 2, 2);
     for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
         DblNumMat tmp(uepchd.m(), uepchd.n());
         ApplyShift(tmp, uepchd, ShiftedPoint(ind, W));
-        SAFE_FUNC_EVAL( _kernel.kernel(ucp, tmp, tmp, ue2uc(CHILD_IND1(ind), CHILD_IND2(ind),
-                                             CHILD_IND3(ind))) );
+        SAFE_FUNC_EVAL( _kernel.kernel(dat._ucp, tmp, tmp,
+                                       dat._ue2uc(CHILD_IND1(ind), CHILD_IND2(ind),
+                                                  CHILD_IND3(ind))) );
     }
     return 0;
 }
 
 //-----------------------------------
-int Mlib3d::DownwardLowFetch(double W, DblNumMat& dep, DblNumMat& dcp,
-                             NumVec<CpxNumMat>& dc2de, NumTns<CpxNumMat>& de2dc,
-                             NumTns<CpxNumTns>& ue2dc, DblNumMat& uep) {
+int Mlib3d::DownwardLowBuild(double W, FetchDat& dat) {
 #ifndef RELEASE
-    CallStackEntry entry("Mlib3d::DownwardLowFetch");
+    CallStackEntry entry("Mlib3d::DownwardLowBuild");
 #endif
-    CHECK_TRUE(_w2ldmap.find(W) != _w2ldmap.end());
-    LowFreqEntry& le = _w2ldmap[W];
+    LowFreqEntry* lep;
+    SAFE_FUNC_EVAL( LowEntry(W, lep) );
+    CHECK_TRUE(lep != NULL);
+    LowFreqEntry& le = *lep;
   
-    dep = le.ucp();
-    dcp = le.uep();
-    uep = le.uep();
-    CpxNumMat tmp0( le.uc2ue()(0) );
-    CpxNumMat tmp2( le.uc2ue()(2) );
-    dc2de.resize(3);
-    Transpose(dc2de(0), tmp2);
-    dc2de(1) = le.uc2ue()(1);
-    Transpose(dc2de(2), tmp0);
-    DblNumMat dcpchd = _w2ldmap[W / 2].uep();
+    dat._low = true;
+    dat._dep = ViewOf(le.ucp());
+    dat._dcp = ViewOf(le.uep());
+    dat._uep = ViewOf(le.uep());
+    //dc2de is applied as the transpose of uc2ue
+    SAFE_FUNC_EVAL( Uc2ueFetch(le, &_upcast, dat) );
+    DblNumMat dcpchd;
+    SAFE_FUNC_EVAL( LowEntry(W / 2, lep) );
+    if (lep != NULL) {
+        dcpchd = ViewOf(lep->uep());
+    }
   
-    de2dc.resize(2,2,2);
+    dat._de2dc.resize(2,2,2);
     for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
         DblNumMat tmp(dcpchd.m(), dcpchd.n());
         ApplyShift(tmp, dcpchd, ShiftedPoint(ind, W));
-        SAFE_FUNC_EVAL( _kernel.kernel(tmp, dep, dep, de2dc(CHILD_IND1(ind), CHILD_IND2(ind),
-                                             CHILD_IND3(ind))) );
+        SAFE_FUNC_EVAL( _kernel.kernel(tmp, dat._dep, dat._dep,
+                                       dat._de2dc(CHILD_IND1(ind), CHILD_IND2(ind),
+                                                  CHILD_IND3(ind))) );
     }
   
-    ue2dc.resize(7,7,7);
-    for (int a = 0; a < 7; a++) {
-        for (int b = 0; b < 7; b++) {
-            for (int c = 0; c < 7; c++) {
-                if (abs(a - 3) > 1 || abs(b - 3) > 1 || abs(c-3) > 1) {
-                    ue2dc(a,b,c) = le.ue2dc()(a,b,c);
-                }
-            }
-        }
-    }
+    dat._ue2dc = &(le.ue2dctbl());
     return 0;
 }
 
 //-----------------------------------
-int Mlib3d::UpwardHighFetch(double W, Index3 dir, DblNumMat& uep, DblNumMat& ucp,
-                            NumVec<CpxNumMat>& uc2ue, NumTns<CpxNumMat>& ue2uc) {
+int Mlib3d::UpwardHighBuild(double W, Index3 dir, FetchDat& dat) {
 #ifndef RELEASE
-    CallStackEntry entry("Mlib3d::UpwardHighFetch");
+    CallStackEntry entry("Mlib3d::UpwardHighBuild");
 #endif
-    CHECK_TRUE(_w2hdmap.find(W) != _w2hdmap.end());
-    std::map<Index3, HghFreqDirEntry>& curmap = _w2hdmap[W];
-  
     Index3 srt, sgn, prm;
     SAFE_FUNC_EVAL( HighFetchIndex3Sort(dir, srt, sgn, prm) );
-    CHECK_TRUE(curmap.count(srt) != 0);
-
-    HghFreqDirEntry& he = curmap[srt];
-    DblNumMat ueptmp( he.uep() );
-    DblNumMat ucptmp( he.ucp() );
-    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ueptmp, uep) );
-    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ucptmp, ucp) );
-    uc2ue.resize(3);
-    for (int i = 0; i < 3; ++i) {
-        uc2ue(i) = he.uc2ue()(i);
-    }
+    HghFreqDirEntry* hep;
+    SAFE_FUNC_EVAL( HghEntry(W, srt, hep) );
+    CHECK_TRUE(hep != NULL);
+    HghFreqDirEntry& he = *hep;
+    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.uep(), dat._uep) );
+    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.ucp(), dat._ucp) );
+    SAFE_FUNC_EVAL( Uc2ueFetch(he, &_upcast, dat) );
   
     DblNumMat uepchd;
     if (W == 1.0) { //unit box
-        CHECK_TRUE(_w2ldmap.find(W / 2) != _w2ldmap.end());
-        LowFreqEntry& le = _w2ldmap[W / 2];
-        uepchd = le.uep();
+        LowFreqEntry* lep;
+        SAFE_FUNC_EVAL( LowEntry(W / 2, lep) );
+        CHECK_TRUE(lep != NULL);
+        uepchd = ViewOf(lep->uep());
     } else { //large box
-        CHECK_TRUE(_w2hdmap.find(W / 2) != _w2hdmap.end());
-        std::map<Index3,HghFreqDirEntry>& curmap = _w2hdmap[W / 2];
-        
         Index3 pdr = predir(dir);
         Index3 srt, sgn, prm;
         SAFE_FUNC_EVAL( HighFetchIndex3Sort(pdr, srt, sgn, prm) );
-        CHECK_TRUE(curmap.find(srt) != curmap.end());
-        HghFreqDirEntry& he = curmap[srt];
-        DblNumMat ueptmp( he.uep() );
-        SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ueptmp, uepchd) );
+        HghFreqDirEntry* hep;
+        SAFE_FUNC_EVAL( HghEntry(W / 2, srt, hep) );
+        CHECK_TRUE(hep != NULL);
+        HghFreqDirEntry& he = *hep;
+        SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.uep(), uepchd) );
     }
-    ue2uc.resize(2,2,2);
+    dat._ue2uc.resize(2,2,2);
     for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
         DblNumMat tmp(uepchd.m(), uepchd.n());
         ApplyShift(tmp, uepchd, ShiftedPoint(ind, W));
-        SAFE_FUNC_EVAL( _kernel.kernel(ucp, tmp, tmp, ue2uc(CHILD_IND1(ind), CHILD_IND2(ind),
-                                             CHILD_IND3(ind))) );
+        SAFE_FUNC_EVAL( _kernel.kernel(dat._ucp, tmp, tmp,
+                                       dat._ue2uc(CHILD_IND1(ind), CHILD_IND2(ind),
+                                                  CHILD_IND3(ind))) );
     }
   
     return 0;
 }
 
 //-----------------------------------
-int Mlib3d::DownwardHighFetch(double W, Index3 dir, DblNumMat& dep, DblNumMat& dcp,
-                              NumVec<CpxNumMat>& dc2de, NumTns<CpxNumMat>& de2dc,
-                              DblNumMat& uep) {
+int Mlib3d::DownwardHighBuild(double W, Index3 dir, FetchDat& dat) {
 #ifndef RELEASE
-    CallStackEntry entry("Mlib3d::DownwardHighFetch");
+    CallStackEntry entry("Mlib3d::DownwardHighBuild");
 #endif
-    CHECK_TRUE(_w2hdmap.find(W) != _w2hdmap.end());
-    std::map<Index3,HghFreqDirEntry>& curmap = _w2hdmap[W];
-  
     Index3 srt, sgn, prm;
     SAFE_FUNC_EVAL( HighFetchIndex3Sort(dir, srt, sgn, prm) );
-    CHECK_TRUE(curmap.find(srt) != curmap.end());
-    HghFreqDirEntry& he = curmap[srt];
+    HghFreqDirEntry* hep;
+    SAFE_FUNC_EVAL( HghEntry(W, srt, hep) );
+    CHECK_TRUE(hep != NULL);
+    HghFreqDirEntry& he = *hep;
   
-    DblNumMat ueptmp( he.uep() );
-    DblNumMat ucptmp( he.ucp() );
-    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ucptmp, dep) ); //ucp->dep
-    negate(dep);
-    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ueptmp, dcp) ); //uep->dcp
-    negate(dcp);
-    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ueptmp, uep) ); //uep->uep
-    dc2de.resize(3);
-    for (int k = 0; k < 3; ++k) {
-        CpxNumMat tmp( he.uc2ue()(2 - k) );
-        Transpose(dc2de(k), tmp);
-    }
+    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.ucp(), dat._dep) ); //ucp->dep
+    negate(dat._dep);
+    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.uep(), dat._dcp) ); //uep->dcp
+    negate(dat._dcp);
+    SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.uep(), dat._uep) ); //uep->uep
+    //dc2de is applied as the transpose of uc2ue
+    SAFE_FUNC_EVAL( Uc2ueFetch(he, &_upcast, dat) );
     DblNumMat dcpchd;
     if (W == 1.0) { //unit box
-        CHECK_TRUE(_w2ldmap.find(W / 2) != _w2ldmap.end());
-        LowFreqEntry& le = _w2ldmap[W / 2];
-        dcpchd = le.uep();
+        LowFreqEntry* lep;
+        SAFE_FUNC_EVAL( LowEntry(W / 2, lep) );
+        CHECK_TRUE(lep != NULL);
+        dcpchd = ViewOf(lep->uep());
     } else { //large box
-        CHECK_TRUE(_w2hdmap.find(W / 2) != _w2hdmap.end());
-        std::map<Index3,HghFreqDirEntry>& curmap = _w2hdmap[W / 2];
-        
         Index3 pdr = predir(dir);
         Index3 srt, sgn, prm;  SAFE_FUNC_EVAL( HighFetchIndex3Sort(pdr, srt, sgn, prm) );
-        CHECK_TRUE(curmap.find(srt) != curmap.end());
-        HghFreqDirEntry& he = curmap[srt];
-        DblNumMat ueptmp( he.uep() );
-        SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, ueptmp, dcpchd) );
+        HghFreqDirEntry* hep;
+        SAFE_FUNC_EVAL( HghEntry(W / 2, srt, hep) );
+        CHECK_TRUE(hep != NULL);
+        HghFreqDirEntry& he = *hep;
+        SAFE_FUNC_EVAL( HighFetchShuffle(prm, sgn, he.uep(), dcpchd) );
         negate(dcpchd);
     }
   
-    de2dc.resize(2,2,2);
+    dat._de2dc.resize(2,2,2);
     for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
         DblNumMat tmp(dcpchd.m(), dcpchd.n());
         ApplyShift(tmp, dcpchd, ShiftedPoint(ind, W));
-        SAFE_FUNC_EVAL( _kernel.kernel(tmp, dep, dep, de2dc(CHILD_IND1(ind), CHILD_IND2(ind),
-                                             CHILD_IND3(ind))) );
+        SAFE_FUNC_EVAL( _kernel.kernel(tmp, dat._dep, dat._dep,
+                                       dat._de2dc(CHILD_IND1(ind), CHILD_IND2(ind),
+                                                  CHILD_IND3(ind))) );
     }
   
     return 0;
@@ -357,6 +1097,211 @@ int Mlib3d::HighFetchIndex3Sort(Index3 val, Index3& srt, Index3& sgn,
 }
 
 
+//---------------------------------------------------------------------
+int Ue2dcTable::setup(NumTns<CpxNumTns>& ue2dc) {
+#ifndef RELEASE
+    CallStackEntry entry("Ue2dcTable::setup");
+#endif
+    CHECK_TRUE(ue2dc.m() == 7 && ue2dc.n() == 7 && ue2dc.p() == 7);
+    _ftns.resize(0);
+    _uid.resize(7, 7, 7);
+    _sid.resize(7, 7, 7);
+    setvalue(_uid, -1);
+    setvalue(_sid, -1);
+    std::map<Index3, int> srt2uid;
+    std::map<std::pair<Index3, Index3>, int> sym2sid;
+    std::vector<CpxNumTns> tns;
+    std::vector<IntNumVec> maps;
+    for (int a = 0; a < 7; a++) {
+        for (int b = 0; b < 7; b++) {
+            for (int c = 0; c < 7; c++) {
+                if (abs(a - 3) <= 1 && abs(b - 3) <= 1 && abs(c - 3) <= 1) {
+                    continue;
+                }
+                Index3 off(a - 3, b - 3, c - 3);
+                //off[prm[d]] = sgn[prm[d]] * srt[d], as in HighFetchIndex3Sort
+                Index3 srt, sgn, prm;
+                for (int d = 0; d < 3; ++d) {
+                    sgn(d) = off(d) < 0 ? -1 : 1;
+                    srt(d) = abs(off(d));
+                    prm(d) = d;
+                }
+                for (int i = 0; i < 3; ++i) {
+                    for (int j = 0; j + 1 < 3 - i; ++j) {
+                        if (srt(j) > srt(j + 1)) {
+                            std::swap(srt(j), srt(j + 1));
+                            std::swap(prm(j), prm(j + 1));
+                        }
+                    }
+                }
+                std::map<Index3, int>::iterator si = srt2uid.find(srt);
+                if (si == srt2uid.end()) {
+                    si = srt2uid.insert(std::make_pair(srt, int(tns.size()))).first;
+                    tns.push_back(ue2dc(srt(0) + 3, srt(1) + 3, srt(2) + 3));
+                }
+                _uid(a, b, c) = si->second;
+                bool ident = (prm == Index3(0, 1, 2) && sgn == Index3(1, 1, 1));
+                if (ident) {
+                    continue;
+                }
+                std::pair<Index3, Index3> sym(prm, sgn);
+                std::map<std::pair<Index3, Index3>, int>::iterator mi = sym2sid.find(sym);
+                if (mi == sym2sid.end()) {
+                    //frequency w of off is frequency mu of srt, with
+                    //mu[d] = sgn[prm[d]] * w[prm[d]] modulo N
+                    CpxNumTns& ref = ue2dc(a, b, c);
+                    int N = ref.m();
+                    IntNumVec map(N * N * N);
+                    Index3 w;
+                    for (w(2) = 0; w(2) < N; ++w(2)) {
+                        for (w(1) = 0; w(1) < N; ++w(1)) {
+                            for (w(0) = 0; w(0) < N; ++w(0)) {
+                                Index3 mu;
+                                for (int d = 0; d < 3; ++d) {
+                                    mu(d) = ((sgn(prm(d)) * w(prm(d))) % N + N) % N;
+                                }
+                                map(w(0) + N * (w(1) + N * w(2))) = mu(0) + N * (mu(1) + N * mu(2));
+                            }
+                        }
+                    }
+                    mi = sym2sid.insert(std::make_pair(sym, int(maps.size()))).first;
+                    maps.push_back(map);
+                }
+                _sid(a, b, c) = mi->second;
+            }
+        }
+    }
+    _tns.resize(tns.size());
+    for (int k = 0; k < tns.size(); ++k) {
+        _tns(k) = tns[k];
+    }
+    _maps.resize(maps.size());
+    for (int k = 0; k < maps.size(); ++k) {
+        _maps(k) = maps[k];
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Ue2dcTable::demote() {
+#ifndef RELEASE
+    CallStackEntry entry("Ue2dcTable::demote");
+#endif
+    _ftns.resize(_tns.m());
+    for (int k = 0; k < _tns.m(); ++k) {
+        CpxNumTns& tns = _tns(k);
+        _ftns(k).resize(tns.m(), tns.n(), tns.p());
+        std::copy(tns.data(), tns.data() + tns.m() * tns.n() * tns.p(), _ftns(k).data());
+    }
+    _tns.resize(0);
+    return 0;
+}
+
+double Ue2dcTable::bytes() {
+    double sz = 0;
+    for (int k = 0; k < _tns.m(); ++k) {
+        sz += double(_tns(k).m()) * _tns(k).n() * _tns(k).p() * sizeof(cpx);
+    }
+    for (int k = 0; k < _ftns.m(); ++k) {
+        sz += double(_ftns(k).m()) * _ftns(k).n() * _ftns(k).p() * sizeof(cpx8);
+    }
+    for (int k = 0; k < _maps.m(); ++k) {
+        sz += double(_maps(k).m()) * sizeof(int);
+    }
+    return sz;
+}
+
+//-------------------
+template <class T>
+static int SharedWriteIndexedEntries(std::string name,
+                                     std::vector<std::pair<std::pair<double, Index3>, const T*> >& ents) {
+#ifndef RELEASE
+    CallStackEntry entry("SharedWriteIndexed");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    std::vector<int> all(1, 1);
+    std::ostringstream oss;
+    if (mpirank == 0) {
+        std::ostringstream pss;
+        table_index_t index;
+        for (int k = 0; k < ents.size(); ++k) {
+            long off = pss.tellp();
+            SAFE_FUNC_EVAL( serialize(*(ents[k].second), pss, all) );
+            index[ents[k].first] = std::make_pair(off, long(pss.tellp()) - off);
+        }
+        oss.write(TABLE_MAGIC, strlen(TABLE_MAGIC));
+        SAFE_FUNC_EVAL( serialize(index, oss, all) );
+        oss << pss.str();
+    }
+    SAFE_FUNC_EVAL( SharedWrite(name, oss) );
+    return 0;
+}
+
+int SharedWriteIndexed(std::string name, const std::map<double, LowFreqEntry>& w2ldmap) {
+    std::vector<std::pair<std::pair<double, Index3>, const LowFreqEntry*> > ents;
+    for (std::map<double, LowFreqEntry>::const_iterator mi = w2ldmap.begin();
+         mi != w2ldmap.end(); ++mi) {
+        ents.push_back(std::make_pair(std::make_pair(mi->first, Index3(0, 0, 0)), &(mi->second)));
+    }
+    return SharedWriteIndexedEntries(name, ents);
+}
+
+int SharedWriteIndexed(std::string name,
+                       const std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap) {
+    std::vector<std::pair<std::pair<double, Index3>, const HghFreqDirEntry*> > ents;
+    for (std::map<double, std::map<Index3, HghFreqDirEntry> >::const_iterator mi = w2hdmap.begin();
+         mi != w2hdmap.end(); ++mi) {
+        for (std::map<Index3, HghFreqDirEntry>::const_iterator mj = mi->second.begin();
+             mj != mi->second.end(); ++mj) {
+            ents.push_back(std::make_pair(std::make_pair(mi->first, mj->first), &(mj->second)));
+        }
+    }
+    return SharedWriteIndexedEntries(name, ents);
+}
+
+//-------------------
+int SharedReadIndex(std::string name, bool& indexed, table_index_t& index, long& start) {
+#ifndef RELEASE
+    CallStackEntry entry("SharedReadIndex");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    std::vector<int> all(1, 1);
+    index.clear();
+    start = 0;
+    std::string str;
+    if (mpirank == 0) {
+        std::string filename = "data/" + name;
+        std::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+        CHECK_TRUE(!fin.fail());
+        std::string magic(strlen(TABLE_MAGIC), ' ');
+        fin.read(&magic[0], magic.size());
+        if (fin.gcount() == magic.size() && magic == TABLE_MAGIC) {
+            SAFE_FUNC_EVAL( deserialize(index, fin, all) );
+            start = fin.tellg();
+            std::ostringstream oss;
+            SAFE_FUNC_EVAL( serialize(index, oss, all) );
+            str = oss.str();
+        }
+    }
+    long hdr[2] = {start, long(str.size())};
+    SAFE_FUNC_EVAL( MPI_Bcast(hdr, 2, MPI_LONG, 0, MPI_COMM_WORLD) );
+    start = hdr[0];
+    indexed = (start > 0);
+    if (indexed && mpirank != 0) {
+        str.resize(hdr[1]);
+    }
+    if (indexed) {
+        SAFE_FUNC_EVAL( MPI_Bcast(&str[0], hdr[1], MPI_BYTE, 0, MPI_COMM_WORLD) );
+        if (mpirank != 0) {
+            std::istringstream iss(str);
+            SAFE_FUNC_EVAL( deserialize(index, iss, all) );
+        }
+    }
+    return 0;
+}
+
 //-------------------
 int serialize(const LowFreqEntry& le, std::ostream& os,
               const std::vector<int>& mask) {
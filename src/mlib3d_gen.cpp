@@ -0,0 +1,583 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#include "mlib3d.hpp"
+#include "parallel.hpp"
+#include "serialize.hpp"
+
+#include <cstdlib>
+
+// Generation of the translation tables, the C++ version of
+// matlab/aug3d_lowdata.m and matlab/aug3d_hghdata.m.  The output has the
+// layout read by Mlib3d::setup (and written by aug3d_script.m).
+
+// Number of directions used to find the vertices of a convex hull
+#define HULL_DIRS 4096
+
+//---------------------------------------------------------------------
+// Equivalent points per edge of the low frequency boxes
+static int AccuP(int ACCU) {
+    CHECK_TRUE(ACCU >= 1 && ACCU <= 3);
+    return 2 * ACCU + 2;
+}
+
+static void ToMat(const std::vector<Point3>& pts, DblNumMat& mat) {
+    mat.resize(3, pts.size());
+    for (int k = 0; k < pts.size(); ++k) {
+        for (int d = 0; d < 3; ++d) {
+            mat(d, k) = pts[k](d);
+        }
+    }
+}
+
+static void ToPoints(const DblNumMat& mat, std::vector<Point3>& pts) {
+    pts.resize(mat.n());
+    for (int k = 0; k < mat.n(); ++k) {
+        pts[k] = Point3(mat(0, k), mat(1, k), mat(2, k));
+    }
+}
+
+static void SubMat(const std::vector<Point3>& pts, const std::vector<int>& idx, DblNumMat& mat) {
+    mat.resize(3, idx.size());
+    for (int k = 0; k < idx.size(); ++k) {
+        for (int d = 0; d < 3; ++d) {
+            mat(d, k) = pts[idx[k]](d);
+        }
+    }
+}
+
+// sort and remove duplicates, as unique(pts', 'rows')'
+static void Unique(std::vector<Point3>& pts) {
+    std::sort(pts.begin(), pts.end());
+    pts.erase(std::unique(pts.begin(), pts.end()), pts.end());
+}
+
+static void ConjTranspose(const CpxNumMat& A, CpxNumMat& B) {
+    B.resize(A.n(), A.m());
+    for (int j = 0; j < A.n(); ++j) {
+        for (int i = 0; i < A.m(); ++i) {
+            B(j, i) = std::conj(A(i, j));
+        }
+    }
+}
+
+static void Rows(const CpxNumMat& A, const std::vector<int>& idx, CpxNumMat& B) {
+    B.resize(idx.size(), A.n());
+    for (int j = 0; j < A.n(); ++j) {
+        for (int i = 0; i < idx.size(); ++i) {
+            B(i, j) = A(idx[i], j);
+        }
+    }
+}
+
+// Points of the P x P x P grid on [-L/2, L/2]^3 that lie on its boundary,
+// x fastest as with ndgrid
+static void SurfaceGrid(double L, int P, DblNumMat& pts) {
+    std::vector<double> x(P);
+    for (int i = 0; i < P; ++i) {
+        x[i] = -L / 2 + i * L / (P - 1);
+    }
+    x[P - 1] = L / 2;
+    std::vector<Point3> tmp;
+    for (int k = 0; k < P; ++k) {
+        for (int j = 0; j < P; ++j) {
+            for (int i = 0; i < P; ++i) {
+                if (i == 0 || i == P - 1 || j == 0 || j == P - 1 || k == 0 || k == P - 1) {
+                    tmp.push_back(Point3(x[i], x[j], x[k]));
+                }
+            }
+        }
+    }
+    ToMat(tmp, pts);
+}
+
+// Indices of the vertices of the convex hull of pts, as the maximizers of
+// x . d over HULL_DIRS directions spread over the sphere.  The MATLAB code
+// uses convhulln; a vertex is only missed here if its normal cone falls
+// between the directions.  The vertices are only added to the random
+// samples of the factorization, so this does not change the tables'
+// accuracy.
+static void HullPoints(const std::vector<Point3>& pts, std::vector<int>& idx) {
+    std::set<int> found;
+    double ga = M_PI * (3 - sqrt(5.0));
+    for (int k = 0; k < HULL_DIRS; ++k) {
+        double z = 1 - (2.0 * k + 1) / HULL_DIRS;
+        double r = sqrt(1 - z * z);
+        Point3 dir(r * cos(ga * k), r * sin(ga * k), z);
+        int best = 0;
+        double bestval = pts[0] * dir;
+        for (int i = 1; i < pts.size(); ++i) {
+            double val = pts[i] * dir;
+            if (val > bestval) {
+                bestval = val;
+                best = i;
+            }
+        }
+        found.insert(best);
+    }
+    idx.assign(found.begin(), found.end());
+}
+
+// nr sorted distinct indices out of 0 .. M-1 (all of them if nr > M),
+// as sort(ceil(rand(1,nr)*(M-nr))) + [1:nr]
+static void RandomIndices(int M, int nr, unsigned short* seed, std::vector<int>& idx) {
+    idx.clear();
+    if (nr > M) {
+        for (int i = 0; i < M; ++i) {
+            idx.push_back(i);
+        }
+        return;
+    }
+    std::vector<int> tmp(nr);
+    for (int k = 0; k < nr; ++k) {
+        tmp[k] = int(ceil(erand48(seed) * (M - nr)));
+    }
+    std::sort(tmp.begin(), tmp.end());
+    for (int k = 0; k < nr; ++k) {
+        idx.push_back(std::min(tmp[k] + k, M - 1));
+    }
+}
+
+// sorted union of index sets
+static void Union(std::vector<int>& a, const std::vector<int>& b) {
+    std::set<int> tmp(a.begin(), a.end());
+    tmp.insert(b.begin(), b.end());
+    a.assign(tmp.begin(), tmp.end());
+}
+
+// Columns j of R (pivoted QR) with |R(j,j)| > eps * |R(0,0)|, mapped
+// through the pivots
+static void PivotsAbove(const CpxNumMat& R, const IntNumVec& piv, double eps,
+                        std::vector<int>& idx) {
+    idx.clear();
+    int r = std::min(R.m(), R.n());
+    for (int j = 0; j < r; ++j) {
+        if (std::abs(R(j, j)) > eps * std::abs(R(0, 0))) {
+            idx.push_back(piv(j));
+        }
+    }
+}
+
+// Every process gets the union of the maps of all processes
+template <class T, class S>
+static int AllMerge(std::map<T, S>& lcl, std::map<T, S>& res) {
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    std::vector<int> all(1, 1);
+    std::ostringstream oss;
+    SAFE_FUNC_EVAL( serialize(lcl, oss, all) );
+    std::string str = oss.str();
+    int sz = str.size();
+    std::vector<int> szs(mpisize);
+    SAFE_FUNC_EVAL( MPI_Allgather(&sz, 1, MPI_INT, &szs[0], 1, MPI_INT, MPI_COMM_WORLD) );
+    std::vector<int> offs(mpisize + 1, 0);
+    for (int p = 0; p < mpisize; ++p) {
+        offs[p + 1] = offs[p] + szs[p];
+    }
+    std::vector<char> buf(offs[mpisize] + 1);
+    SAFE_FUNC_EVAL( MPI_Allgatherv((void*) str.data(), sz, MPI_BYTE, &buf[0], &szs[0],
+                                   &offs[0], MPI_BYTE, MPI_COMM_WORLD) );
+    for (int p = 0; p < mpisize; ++p) {
+        std::istringstream iss(std::string(buf.begin() + offs[p], buf.begin() + offs[p + 1]));
+        std::map<T, S> tmp;
+        SAFE_FUNC_EVAL( deserialize(tmp, iss, all) );
+        res.insert(tmp.begin(), tmp.end());
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Mlib3d::LowFreqEntryGen(int ACCU, double W, LowFreqEntry& le) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::LowFreqEntryGen");
+#endif
+    int P = AccuP(ACCU);
+    double lambda = 1e-16;
+    SurfaceGrid(W, P, le._uep);
+    SurfaceGrid(3 * W, P, le._ucp);
+    //up check to up equivalent, pinv through the SVD
+    CpxNumMat mce(le._ucp.n(), le._uep.n());
+    SAFE_FUNC_EVAL( _kernel.kernel(le._ucp, le._uep, le._uep, mce) );
+    CpxNumMat U, VT;
+    DblNumVec S;
+    SAFE_FUNC_EVAL( zgesvd(mce, U, S, VT) );
+    int r = 0;
+    while (r < S.m() && S(r) > lambda * S(0)) {
+        ++r;
+    }
+    le._uc2ue.resize(3);
+    CpxNumMat& v = le._uc2ue(0);
+    CpxNumMat& is = le._uc2ue(1);
+    CpxNumMat& up = le._uc2ue(2);
+    v.resize(VT.n(), r);
+    is.resize(r, 1);
+    up.resize(r, U.m());
+    for (int k = 0; k < r; ++k) {
+        for (int i = 0; i < VT.n(); ++i) {
+            v(i, k) = std::conj(VT(k, i));
+        }
+        is(k, 0) = cpx(1.0 / S(k), 0);
+        for (int i = 0; i < U.m(); ++i) {
+            up(k, i) = std::conj(U(i, k));
+        }
+    }
+    //up equivalent to down check, as the FFT of the kernel on the
+    //(2P)^3 grid for each V list offset
+    int N = 2 * P;
+    double step = W / (P - 1);
+    std::vector<double> g(N);
+    for (int i = 0; i < N; ++i) {
+        g[i] = (i < P ? i : i - N) * step;
+    }
+    DblNumMat ctr(3, 1);
+    setvalue(ctr, 0.0);
+    le._ue2dc.resize(7, 7, 7);
+    for (int a = 0; a < 7; ++a) {
+        for (int b = 0; b < 7; ++b) {
+            for (int c = 0; c < 7; ++c) {
+                if (abs(a - 3) <= 1 && abs(b - 3) <= 1 && abs(c - 3) <= 1) {
+                    continue;
+                }
+                DblNumMat pc(3, N * N * N);
+                for (int k = 0; k < N; ++k) {
+                    for (int j = 0; j < N; ++j) {
+                        for (int i = 0; i < N; ++i) {
+                            int idx = i + N * (j + N * k);
+                            pc(0, idx) = (a - 3) * W + g[i];
+                            pc(1, idx) = (b - 3) * W + g[j];
+                            pc(2, idx) = (c - 3) * W + g[k];
+                        }
+                    }
+                }
+                CpxNumMat moc(N * N * N, 1);
+                SAFE_FUNC_EVAL( _kernel.kernel(pc, ctr, ctr, moc) );
+                CpxNumTns& tns = le._ue2dc(a, b, c);
+                tns.resize(N, N, N);
+                std::copy(moc.data(), moc.data() + N * N * N, tns.data());
+                fftw_plan plan = fftw_plan_dft_3d(N, N, N, (fftw_complex*) (tns.data()),
+                                                  (fftw_complex*) (tns.data()),
+                                                  FFTW_FORWARD, FFTW_ESTIMATE);
+                CHECK_TRUE(plan != NULL);
+                fftw_execute(plan);
+                fftw_destroy_plan(plan);
+            }
+        }
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Mlib3d::GenerateLowFreq(int ACCU, std::vector<double>& Ws,
+                            std::map<double, LowFreqEntry>& w2ldmap) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::GenerateLowFreq");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    //levels are independent, one per process in turn
+    std::map<double, LowFreqEntry> lcl;
+    for (int g = 0; g < Ws.size(); ++g) {
+        if (g % mpisize == mpirank) {
+            SAFE_FUNC_EVAL( LowFreqEntryGen(ACCU, Ws[g], lcl[Ws[g]]) );
+        }
+    }
+    w2ldmap.clear();
+    SAFE_FUNC_EVAL( AllMerge(lcl, w2ldmap) );
+    if (mpirank == 0) {
+        std::cerr << "Generated " << w2ldmap.size() << " low frequency levels" << std::endl;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Mlib3d::HghFreqDirEntryGen(int ACCU, int NPQ, double W, Index3 dir,
+                               std::vector<Point3>& sfts, std::vector<Point3>& ns,
+                               std::map<Index3, HghFreqDirEntry>& respre,
+                               HghFreqDirEntry& he) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::HghFreqDirEntryGen");
+#endif
+    double D = W * W + W;
+    double DP = (2 * W) * (2 * W) + 2 * W;
+    int C = NPQ * int(W);
+    double EPS, rr, RT;
+    int NT;
+    switch (ACCU) {
+    case 1: EPS = 1e-4; rr = 70;  RT = 4; NT = 2400; break;
+    case 2: EPS = 1e-6; rr = 120; RT = 5; NT = 2400; break;
+    default: EPS = 1e-8; rr = 160; RT = 6; NT = 4800; break;
+    }
+    unsigned short seed[3] = { (unsigned short) (dir(0) + 1),
+                               (unsigned short) (dir(1) + 1),
+                               (unsigned short) (dir(2) + int(W)) };
+
+    //equivalent and check points of the children
+    std::vector<Point3> pspre, ptpre;
+    if (W == 1) {
+        DblNumMat pg;
+        SurfaceGrid(W / 2, AccuP(ACCU), pg);
+        ToPoints(pg, pspre);
+        ptpre = pspre;
+    } else {
+        std::map<Index3, HghFreqDirEntry>::iterator mi = respre.find(predir(dir));
+        CHECK_TRUE(mi != respre.end());
+        ToPoints(mi->second.uep(), pspre);
+        ptpre.resize(pspre.size());
+        for (int k = 0; k < pspre.size(); ++k) {
+            ptpre[k] = -pspre[k];
+        }
+    }
+    std::vector<Point3> pscol, ptcol;
+    for (int t = 0; t < NUM_CHILDREN; ++t) {
+        Point3 sgs(CHILD_IND1(t) ? W / 4 : -W / 4, CHILD_IND2(t) ? W / 4 : -W / 4,
+                   CHILD_IND3(t) ? W / 4 : -W / 4);
+        for (int k = 0; k < pspre.size(); ++k) {
+            pscol.push_back(pspre[k] + sgs);
+        }
+        for (int k = 0; k < ptpre.size(); ++k) {
+            ptcol.push_back(ptpre[k] + sgs);
+        }
+    }
+    Unique(pscol);
+    Unique(ptcol);
+
+    //source
+    std::vector<Point3>& ps = pscol;
+    std::vector<int> salw;
+    HullPoints(ps, salw);
+
+    //target: the far field boxes in the wedge
+    double tol = 1.0 + 1e-8;
+    std::vector<Point3> sss;
+    for (int k = 0; k < sfts.size(); ++k) {
+        if (fabs(ns[k](0) - dir(0)) <= tol && fabs(ns[k](1) - dir(1)) <= tol &&
+            fabs(ns[k](2) - dir(2)) <= 1e-8) {
+            sss.push_back(sfts[k]);
+        }
+    }
+    CHECK_TRUE(!sss.empty());
+    std::vector<Point3> play;
+    for (int k = 0; k < sss.size(); ++k) {
+        double scl = (sss[k].l2() < DP - 1e-8) ? 1 : 3;
+        for (int t = 0; t < NUM_CHILDREN; ++t) {
+            Point3 sgs(CHILD_IND1(t) ? W / 2 : -W / 2, CHILD_IND2(t) ? W / 2 : -W / 2,
+                       CHILD_IND3(t) ? W / 2 : -W / 2);
+            play.push_back(sss[k] + scl * sgs);
+        }
+    }
+    std::vector<int> hull;
+    HullPoints(play, hull);
+    std::vector<Point3> pt0;
+    for (int k = 0; k < hull.size(); ++k) {
+        pt0.push_back(play[hull[k]]);
+    }
+    //the nearest boxes
+    double mindis = DBL_MAX;
+    for (int k = 0; k < sss.size(); ++k) {
+        mindis = std::min(mindis, sss[k].l2());
+    }
+    std::vector<Point3> pt1;
+    for (int k = 0; k < sss.size(); ++k) {
+        if (sss[k].l2() < mindis + 1e-8) {
+            for (int i = 0; i < ptcol.size(); ++i) {
+                pt1.push_back(ptcol[i] + sss[k]);
+            }
+        }
+    }
+    Unique(pt1);
+    //random points in the wedge
+    double the_rng[2] = {DBL_MAX, -DBL_MAX};
+    double phi_rng[2] = {DBL_MAX, -DBL_MAX};
+    for (int k = 0; k < play.size(); ++k) {
+        double the = atan2(play[k](0), play[k](2));
+        double phi = atan2(play[k](1), play[k](2));
+        the_rng[0] = std::min(the_rng[0], the);
+        the_rng[1] = std::max(the_rng[1], the);
+        phi_rng[0] = std::min(phi_rng[0], phi);
+        phi_rng[1] = std::max(phi_rng[1], phi);
+    }
+    CHECK_TRUE(the_rng[0] <= (dir(0) - 1.0) / C * M_PI / 4 &&
+               the_rng[1] >= (dir(0) + 1.0) / C * M_PI / 4 &&
+               phi_rng[0] <= (dir(1) - 1.0) / C * M_PI / 4 &&
+               phi_rng[1] >= (dir(1) + 1.0) / C * M_PI / 4);
+    double rho_rng[2] = {mindis - W / 2, 6 * D};
+    std::vector<Point3> pt2(NT);
+    for (int k = 0; k < NT; ++k) {
+        double the = erand48(seed) * (the_rng[1] - the_rng[0]) + the_rng[0];
+        double phi = erand48(seed) * (phi_rng[1] - phi_rng[0]) + phi_rng[0];
+        double rho = erand48(seed) * (rho_rng[1] - rho_rng[0]) + rho_rng[0];
+        double tmp = sqrt(tan(the) * tan(the) + tan(phi) * tan(phi) + 1);
+        pt2[k] = Point3(tan(the) / tmp * rho, tan(phi) / tmp * rho, rho / tmp);
+    }
+    HullPoints(pt2, hull);
+    std::vector<Point3> talwpts(pt0);
+    talwpts.insert(talwpts.end(), pt1.begin(), pt1.end());
+    for (int k = 0; k < hull.size(); ++k) {
+        talwpts.push_back(pt2[hull[k]]);
+    }
+    Unique(talwpts);
+    std::vector<Point3> pt(talwpts);
+    pt.insert(pt.end(), pt2.begin(), pt2.end());
+    Unique(pt);
+    std::vector<int> talw;
+    for (int k = 0; k < talwpts.size(); ++k) {
+        talw.push_back(std::lower_bound(pt.begin(), pt.end(), talwpts[k]) - pt.begin());
+    }
+
+    //------------- low rank representation
+    int M = pt.size();
+    int N = ps.size();
+    DblNumMat ptmat, psmat;
+    ToMat(pt, ptmat);
+    ToMat(ps, psmat);
+    int sz1 = int(rr * RT);
+    int sz2 = int(rr * RT * RT);
+    //skeleton of the sources, from the rows rs
+    std::vector<int> rs, cs;
+    RandomIndices(M, int(round(sz1 * sqrt(double(M) / N))), seed, rs);
+    Union(rs, talw);
+    DblNumMat tmppos;
+    SubMat(pt, rs, tmppos);
+    CpxNumMat M1(rs.size(), N);
+    SAFE_FUNC_EVAL( _kernel.kernel(tmppos, psmat, psmat, M1) );
+    IntNumVec piv;
+    CpxNumMat R;
+    SAFE_FUNC_EVAL( zgeqp3(M1, piv, R) );
+    std::vector<int> idx1;
+    PivotsAbove(R, piv, EPS, idx1);
+    DblNumMat psidx;
+    SubMat(ps, idx1, psidx);
+    M1.resize(M, idx1.size());
+    SAFE_FUNC_EVAL( _kernel.kernel(ptmat, psidx, psidx, M1) );
+    CpxNumMat Q1, R1;
+    SAFE_FUNC_EVAL( zgeqrf(M1, Q1, R1) );
+    M1.resize(0, 0);
+    //skeleton of the targets, from the columns cs
+    RandomIndices(N, sz1, seed, cs);
+    Union(cs, salw);
+    Union(cs, idx1);
+    SubMat(ps, cs, tmppos);
+    CpxNumMat M2(M, cs.size());
+    SAFE_FUNC_EVAL( _kernel.kernel(ptmat, tmppos, tmppos, M2) );
+    CpxNumMat M2t;
+    ConjTranspose(M2, M2t);
+    SAFE_FUNC_EVAL( zgeqp3(M2t, piv, R) );
+    std::vector<int> idx2;
+    PivotsAbove(R, piv, EPS, idx2);
+    DblNumMat ptidx;
+    SubMat(pt, idx2, ptidx);
+    M2.resize(idx2.size(), N);
+    SAFE_FUNC_EVAL( _kernel.kernel(ptidx, psmat, psmat, M2) );
+    ConjTranspose(M2, M2t);
+    CpxNumMat Q2, R2;
+    SAFE_FUNC_EVAL( zgeqrf(M2t, Q2, R2) );
+    M2.resize(0, 0);
+    M2t.resize(0, 0);
+    //middle matrix from a larger sample
+    RandomIndices(N, sz2, seed, cs);
+    Union(cs, idx1);
+    RandomIndices(M, sz2, seed, rs);
+    Union(rs, idx2);
+    DblNumMat rpos, cpos;
+    SubMat(pt, rs, rpos);
+    SubMat(ps, cs, cpos);
+    CpxNumMat M3(rs.size(), cs.size());
+    SAFE_FUNC_EVAL( _kernel.kernel(rpos, cpos, cpos, M3) );
+    CpxNumMat tmp, tmpt, pinv1, pinv2;
+    Rows(Q1, rs, tmp);
+    SAFE_FUNC_EVAL( zpinv(tmp, pinv1) );
+    Rows(Q2, cs, tmp);
+    ConjTranspose(tmp, tmpt);
+    SAFE_FUNC_EVAL( zpinv(tmpt, pinv2) );
+    CpxNumMat mid(pinv1.m(), M3.n());
+    SAFE_FUNC_EVAL( zgemm(1.0, pinv1, M3, 0.0, mid) );
+    M3.resize(0, 0);
+    he._uc2ue.resize(3);
+    he._uc2ue(1).resize(mid.m(), pinv2.n());
+    SAFE_FUNC_EVAL( zgemm(1.0, mid, pinv2, 0.0, he._uc2ue(1)) );
+    SAFE_FUNC_EVAL( ztrtri(R1, he._uc2ue(0)) );
+    SAFE_FUNC_EVAL( ztrtri(R2, tmp) );
+    ConjTranspose(tmp, he._uc2ue(2));
+    he._uep = psidx;
+    he._ucp = ptidx;
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Mlib3d::GenerateHghFreq(int ACCU, int NPQ, std::vector<double>& Ws,
+                            std::map<double, std::map<Index3, HghFreqDirEntry> >& w2hdmap) {
+#ifndef RELEASE
+    CallStackEntry entry("Mlib3d::GenerateHghFreq");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    w2hdmap.clear();
+    std::map<Index3, HghFreqDirEntry> respre;
+    std::vector<double> sorted(Ws);
+    std::sort(sorted.begin(), sorted.end());
+    //each level needs the one below it; the directions of a level are
+    //independent and are spread over the processes
+    for (int g = 0; g < sorted.size(); ++g) {
+        double W = sorted[g];
+        CHECK_TRUE(g == 0 ? W == 1 : W == 2 * sorted[g - 1]);
+        double D = W * W + W;
+        int C = NPQ * int(W);
+        //box centers and their directions
+        std::vector<Point3> sfts, ns;
+        int nc = int(floor(5 * D / W + 1e-8)) + 1;
+        for (int k = 0; k < nc; ++k) {
+            for (int j = 0; j < nc; ++j) {
+                for (int i = 0; i < nc; ++i) {
+                    Point3 s(i * W, j * W, k * W);
+                    double r = s.l2();
+                    if (r >= D - 1e-8 && r <= 5 * D) {
+                        double t = s.linfty();
+                        Point3 n;
+                        for (int d = 0; d < 3; ++d) {
+                            n(d) = atan(s(d) / t) / (M_PI / 4) * C;
+                        }
+                        sfts.push_back(s);
+                        ns.push_back(n);
+                    }
+                }
+            }
+        }
+        //wedge centers, sorted
+        std::set<Index3> uns;
+        for (int a = 1; a <= C; a += 2) {
+            for (int b = 1; b <= C; b += 2) {
+                uns.insert(Index3(std::min(a, b), std::max(a, b), C));
+            }
+        }
+        std::map<Index3, HghFreqDirEntry> lcl;
+        int cnt = 0;
+        for (std::set<Index3>::iterator si = uns.begin(); si != uns.end(); ++si, ++cnt) {
+            if (cnt % mpisize == mpirank) {
+                SAFE_FUNC_EVAL( HghFreqDirEntryGen(ACCU, NPQ, W, *si, sfts, ns, respre,
+                                                   lcl[*si]) );
+            }
+        }
+        std::map<Index3, HghFreqDirEntry>& res = w2hdmap[W];
+        SAFE_FUNC_EVAL( AllMerge(lcl, res) );
+        respre = res;
+        if (mpirank == 0) {
+            std::cerr << "Generated high frequency level W = " << W << ", "
+                      << res.size() << " directions" << std::endl;
+        }
+    }
+    return 0;
+}
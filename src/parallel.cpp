@@ -103,6 +103,25 @@ int SharedRead(std::string name, std::istringstream& is) {
     return 0;
 }
 
+//---------------------------------------------------------
+int SharedExists(std::string name, bool& exists) {
+#ifndef RELEASE
+    CallStackEntry entry("SharedExists");
+#endif
+    int mpirank, mpisize;
+    getMPIInfo(&mpirank, &mpisize);
+    int found = 0;
+    if (mpirank == 0) {
+	char filename[MAX_FILE_NAME_LENGTH];
+	sprintf(filename, "data/%s", name.c_str());
+	std::ifstream fin(filename);
+	found = !fin.fail();
+    }
+    SAFE_FUNC_EVAL( MPI_Bcast((void*)&found, 1, MPI_INT, 0, MPI_COMM_WORLD) );
+    exists = found;
+    return 0;
+}
+
 //---------------------------------------------------------
 int SharedWrite(std::string name, std::ostringstream& os) {
 #ifndef RELEASE
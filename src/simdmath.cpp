@@ -0,0 +1,461 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#include "simdmath.hpp"
+
+#include <math.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// pi/2 split into three parts so that q * PIO2_1 and q * PIO2_2 are exact
+// for the quadrant counts we see (Cody-Waite reduction).
+#define PIO2_1 (2 * 7.85398125648498535156E-1)
+#define PIO2_2 (2 * 3.77489470793079817668E-8)
+#define PIO2_3 (2 * 2.69515142907905952645E-15)
+#define TWOOPI (6.36619772367581382433E-1)
+
+// Cephes coefficients for sin and cos on [-pi/4, pi/4]
+#define S0 ( 1.58962301576546568060E-10)
+#define S1 (-2.50507477628578072866E-8)
+#define S2 ( 2.75573136213857245213E-6)
+#define S3 (-1.98412698295895385996E-4)
+#define S4 ( 8.33333333332211858878E-3)
+#define S5 (-1.66666666666666307295E-1)
+
+#define C0 (-1.13585365213876817300E-11)
+#define C1 ( 2.08757008419747316778E-9)
+#define C2 (-2.75573141792967388112E-7)
+#define C3 ( 2.48015872888517045348E-5)
+#define C4 (-1.38888888888730564116E-3)
+#define C5 ( 4.16666666666665929218E-2)
+
+// Single precision reduction constants and Cephes sinf/cosf coefficients
+#define FPIO2_1 (1.5703125f)
+#define FPIO2_2 (4.837512969970703125E-4f)
+#define FPIO2_3 (7.54978995489188216E-8f)
+#define FTWOOPI (6.36619772367581382433E-1f)
+
+#define FS0 (-1.9515295891E-4f)
+#define FS1 ( 8.3321608736E-3f)
+#define FS2 (-1.6666654611E-1f)
+
+#define FC0 ( 2.443315711809948E-5f)
+#define FC1 (-1.388731625493765E-3f)
+#define FC2 ( 4.166664568298827E-2f)
+
+//---------------------------------------------------------------------
+// Scalar kernel, used for the portable path and for the loop remainders.
+static inline void sincos_scalar(double x, double* s, double* c) {
+    double t = x * TWOOPI;
+    int iq = (int)(t + (t >= 0 ? 0.5 : -0.5));
+    double q = iq;
+    double r = ((x - q * PIO2_1) - q * PIO2_2) - q * PIO2_3;
+    double z = r * r;
+    double ps = r + r * z * (((((S0 * z + S1) * z + S2) * z + S3) * z + S4) * z + S5);
+    double pc = 1.0 - 0.5 * z + z * z * (((((C0 * z + C1) * z + C2) * z + C3) * z + C4) * z + C5);
+    // Rotate by the quadrant.  iq & 3 is correct for negative iq as well.
+    int qm = iq & 3;
+    double sv = (qm & 1) ? pc : ps;
+    double cv = (qm & 1) ? ps : pc;
+    *s = (qm & 2) ? -sv : sv;
+    *c = (qm == 1 || qm == 2) ? -cv : cv;
+}
+
+// c += a * b for one interleaved complex number, in plain real arithmetic
+// without the NaN/Inf recovery of std::complex.
+static inline void zmulacc_scalar(const double* a, const double* b, double* c) {
+    c[0] += a[0] * b[0] - a[1] * b[1];
+    c[1] += a[0] * b[1] + a[1] * b[0];
+}
+
+// the same with b in single precision, upcast before the product
+static inline void zmulacc_scalar(const double* a, const float* b, double* c) {
+    double br = b[0], bi = b[1];
+    c[0] += a[0] * br - a[1] * bi;
+    c[1] += a[0] * bi + a[1] * br;
+}
+
+#if defined(__AVX512F__)
+//---------------------------------------------------------------------
+#define VLEN 8
+static inline void sincos_vec(const double* x, double* s, double* c) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d zero = _mm512_setzero_pd();
+    __m512d xv = _mm512_loadu_pd(x);
+    __m512d q = _mm512_roundscale_pd(_mm512_mul_pd(xv, _mm512_set1_pd(TWOOPI)),
+                                     _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_fnmadd_pd(q, _mm512_set1_pd(PIO2_1), xv);
+    r = _mm512_fnmadd_pd(q, _mm512_set1_pd(PIO2_2), r);
+    r = _mm512_fnmadd_pd(q, _mm512_set1_pd(PIO2_3), r);
+    __m512d z = _mm512_mul_pd(r, r);
+
+    __m512d ps = _mm512_fmadd_pd(_mm512_set1_pd(S0), z, _mm512_set1_pd(S1));
+    ps = _mm512_fmadd_pd(ps, z, _mm512_set1_pd(S2));
+    ps = _mm512_fmadd_pd(ps, z, _mm512_set1_pd(S3));
+    ps = _mm512_fmadd_pd(ps, z, _mm512_set1_pd(S4));
+    ps = _mm512_fmadd_pd(ps, z, _mm512_set1_pd(S5));
+    ps = _mm512_fmadd_pd(_mm512_mul_pd(r, z), ps, r);
+
+    __m512d pc = _mm512_fmadd_pd(_mm512_set1_pd(C0), z, _mm512_set1_pd(C1));
+    pc = _mm512_fmadd_pd(pc, z, _mm512_set1_pd(C2));
+    pc = _mm512_fmadd_pd(pc, z, _mm512_set1_pd(C3));
+    pc = _mm512_fmadd_pd(pc, z, _mm512_set1_pd(C4));
+    pc = _mm512_fmadd_pd(pc, z, _mm512_set1_pd(C5));
+    pc = _mm512_fmadd_pd(_mm512_mul_pd(z, z), pc, _mm512_fnmadd_pd(half, z, one));
+
+    // quadrant q mod 4 and q mod 2, computed in floating point
+    __m512d qm = _mm512_sub_pd(q, _mm512_mul_pd(_mm512_set1_pd(4.0),
+                  _mm512_roundscale_pd(_mm512_mul_pd(q, _mm512_set1_pd(0.25)),
+                                       _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)));
+    __m512d qo = _mm512_sub_pd(q, _mm512_mul_pd(two,
+                  _mm512_roundscale_pd(_mm512_mul_pd(q, half),
+                                       _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)));
+    __mmask8 odd = _mm512_cmp_pd_mask(qo, one, _CMP_EQ_OQ);
+    __mmask8 sneg = _mm512_cmp_pd_mask(qm, two, _CMP_GE_OQ);
+    __mmask8 cneg = _mm512_cmp_pd_mask(qm, one, _CMP_EQ_OQ) |
+                    _mm512_cmp_pd_mask(qm, two, _CMP_EQ_OQ);
+    __m512d sv = _mm512_mask_blend_pd(odd, ps, pc);
+    __m512d cv = _mm512_mask_blend_pd(odd, pc, ps);
+    sv = _mm512_mask_sub_pd(sv, sneg, zero, sv);
+    cv = _mm512_mask_sub_pd(cv, cneg, zero, cv);
+    _mm512_storeu_pd(s, sv);
+    _mm512_storeu_pd(c, cv);
+}
+
+static inline void sqrt_vec(const double* in, double* out) {
+    _mm512_storeu_pd(out, _mm512_sqrt_pd(_mm512_loadu_pd(in)));
+}
+
+static inline void inv_vec(const double* in, double* out) {
+    _mm512_storeu_pd(out, _mm512_div_pd(_mm512_set1_pd(1.0), _mm512_loadu_pd(in)));
+}
+
+#define VLENF 16
+static inline void sqrtf_vec(const float* in, float* out) {
+    _mm512_storeu_ps(out, _mm512_sqrt_ps(_mm512_loadu_ps(in)));
+}
+
+// c += a * b for VLENZ interleaved complex numbers
+#define VLENZ 4
+static inline void zmulacc_pd(__m512d av, __m512d bv, double* c) {
+    __m512d bre = _mm512_movedup_pd(bv);        // (br, br)
+    __m512d bim = _mm512_permute_pd(bv, 0xFF);  // (bi, bi)
+    __m512d asw = _mm512_permute_pd(av, 0x55);  // (ai, ar)
+    // (ar * br - ai * bi, ai * br + ar * bi)
+    __m512d p = _mm512_fmaddsub_pd(av, bre, _mm512_mul_pd(asw, bim));
+    _mm512_storeu_pd(c, _mm512_add_pd(_mm512_loadu_pd(c), p));
+}
+
+static inline void zmulacc_vec(const double* a, const double* b, double* c) {
+    zmulacc_pd(_mm512_loadu_pd(a), _mm512_loadu_pd(b), c);
+}
+
+// b is gathered through the complex indices idx[0 .. VLENZ-1]
+static inline void zmulacc_map_vec(const double* a, const double* b, const int* idx, double* c) {
+    __m256d b01 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(b + 2 * idx[0])),
+                                       _mm_loadu_pd(b + 2 * idx[1]), 1);
+    __m256d b23 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(b + 2 * idx[2])),
+                                       _mm_loadu_pd(b + 2 * idx[3]), 1);
+    zmulacc_pd(_mm512_loadu_pd(a), _mm512_insertf64x4(_mm512_castpd256_pd512(b01), b23, 1), c);
+}
+
+static inline void zmulacc_vec(const double* a, const float* b, double* c) {
+    zmulacc_pd(_mm512_loadu_pd(a), _mm512_cvtps_pd(_mm256_loadu_ps(b)), c);
+}
+
+// one complex float is 8 bytes, so it is loaded as a double
+static inline void zmulacc_map_vec(const double* a, const float* b, const int* idx, double* c) {
+    __m128d b01 = _mm_loadh_pd(_mm_load_sd((const double*) (b + 2 * idx[0])),
+                               (const double*) (b + 2 * idx[1]));
+    __m128d b23 = _mm_loadh_pd(_mm_load_sd((const double*) (b + 2 * idx[2])),
+                               (const double*) (b + 2 * idx[3]));
+    __m256d bv = _mm256_insertf128_pd(_mm256_castpd128_pd256(b01), b23, 1);
+    zmulacc_pd(_mm512_loadu_pd(a), _mm512_cvtps_pd(_mm256_castpd_ps(bv)), c);
+}
+
+const char* vd_isa() { return "avx512"; }
+
+#elif defined(__AVX2__)
+//---------------------------------------------------------------------
+#define VLEN 4
+#ifdef __FMA__
+# define MADD(a, b, c) _mm256_fmadd_pd(a, b, c)
+# define NMADD(a, b, c) _mm256_fnmadd_pd(a, b, c)
+#else
+# define MADD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+# define NMADD(a, b, c) _mm256_sub_pd(c, _mm256_mul_pd(a, b))
+#endif
+static inline void sincos_vec(const double* x, double* s, double* c) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d xv = _mm256_loadu_pd(x);
+    __m256d q = _mm256_round_pd(_mm256_mul_pd(xv, _mm256_set1_pd(TWOOPI)),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = NMADD(q, _mm256_set1_pd(PIO2_1), xv);
+    r = NMADD(q, _mm256_set1_pd(PIO2_2), r);
+    r = NMADD(q, _mm256_set1_pd(PIO2_3), r);
+    __m256d z = _mm256_mul_pd(r, r);
+
+    __m256d ps = MADD(_mm256_set1_pd(S0), z, _mm256_set1_pd(S1));
+    ps = MADD(ps, z, _mm256_set1_pd(S2));
+    ps = MADD(ps, z, _mm256_set1_pd(S3));
+    ps = MADD(ps, z, _mm256_set1_pd(S4));
+    ps = MADD(ps, z, _mm256_set1_pd(S5));
+    ps = MADD(_mm256_mul_pd(r, z), ps, r);
+
+    __m256d pc = MADD(_mm256_set1_pd(C0), z, _mm256_set1_pd(C1));
+    pc = MADD(pc, z, _mm256_set1_pd(C2));
+    pc = MADD(pc, z, _mm256_set1_pd(C3));
+    pc = MADD(pc, z, _mm256_set1_pd(C4));
+    pc = MADD(pc, z, _mm256_set1_pd(C5));
+    pc = MADD(_mm256_mul_pd(z, z), pc, NMADD(half, z, one));
+
+    // quadrant q mod 4 and q mod 2, computed in floating point
+    __m256d qm = _mm256_sub_pd(q, _mm256_mul_pd(_mm256_set1_pd(4.0),
+                  _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.25)))));
+    __m256d qo = _mm256_sub_pd(q, _mm256_mul_pd(two, _mm256_floor_pd(_mm256_mul_pd(q, half))));
+    __m256d odd = _mm256_cmp_pd(qo, one, _CMP_EQ_OQ);
+    __m256d sneg = _mm256_cmp_pd(qm, two, _CMP_GE_OQ);
+    __m256d cneg = _mm256_or_pd(_mm256_cmp_pd(qm, one, _CMP_EQ_OQ),
+                                _mm256_cmp_pd(qm, two, _CMP_EQ_OQ));
+    __m256d sv = _mm256_blendv_pd(ps, pc, odd);
+    __m256d cv = _mm256_blendv_pd(pc, ps, odd);
+    sv = _mm256_xor_pd(sv, _mm256_and_pd(sneg, sign));
+    cv = _mm256_xor_pd(cv, _mm256_and_pd(cneg, sign));
+    _mm256_storeu_pd(s, sv);
+    _mm256_storeu_pd(c, cv);
+}
+
+static inline void sqrt_vec(const double* in, double* out) {
+    _mm256_storeu_pd(out, _mm256_sqrt_pd(_mm256_loadu_pd(in)));
+}
+
+static inline void inv_vec(const double* in, double* out) {
+    _mm256_storeu_pd(out, _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_loadu_pd(in)));
+}
+
+#define VLENF 8
+static inline void sqrtf_vec(const float* in, float* out) {
+    _mm256_storeu_ps(out, _mm256_sqrt_ps(_mm256_loadu_ps(in)));
+}
+
+// c += a * b for VLENZ interleaved complex numbers
+#define VLENZ 2
+static inline void zmulacc_pd(__m256d av, __m256d bv, double* c) {
+    __m256d bre = _mm256_movedup_pd(bv);       // (br, br)
+    __m256d bim = _mm256_permute_pd(bv, 0xF);  // (bi, bi)
+    __m256d asw = _mm256_permute_pd(av, 0x5);  // (ai, ar)
+    // (ar * br - ai * bi, ai * br + ar * bi)
+#ifdef __FMA__
+    __m256d p = _mm256_fmaddsub_pd(av, bre, _mm256_mul_pd(asw, bim));
+#else
+    __m256d p = _mm256_addsub_pd(_mm256_mul_pd(av, bre), _mm256_mul_pd(asw, bim));
+#endif
+    _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), p));
+}
+
+static inline void zmulacc_vec(const double* a, const double* b, double* c) {
+    zmulacc_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b), c);
+}
+
+// b is gathered through the complex indices idx[0 .. VLENZ-1]
+static inline void zmulacc_map_vec(const double* a, const double* b, const int* idx, double* c) {
+    __m256d bv = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(b + 2 * idx[0])),
+                                      _mm_loadu_pd(b + 2 * idx[1]), 1);
+    zmulacc_pd(_mm256_loadu_pd(a), bv, c);
+}
+
+static inline void zmulacc_vec(const double* a, const float* b, double* c) {
+    zmulacc_pd(_mm256_loadu_pd(a), _mm256_cvtps_pd(_mm_loadu_ps(b)), c);
+}
+
+// one complex float is 8 bytes, so it is loaded as a double
+static inline void zmulacc_map_vec(const double* a, const float* b, const int* idx, double* c) {
+    __m128d bv = _mm_loadh_pd(_mm_load_sd((const double*) (b + 2 * idx[0])),
+                              (const double*) (b + 2 * idx[1]));
+    zmulacc_pd(_mm256_loadu_pd(a), _mm256_cvtps_pd(_mm_castpd_ps(bv)), c);
+}
+
+const char* vd_isa() { return "avx2"; }
+
+#else
+//---------------------------------------------------------------------
+#define VLEN 1
+static inline void sincos_vec(const double* x, double* s, double* c) {
+    sincos_scalar(x[0], s, c);
+}
+
+static inline void sqrt_vec(const double* in, double* out) {
+    out[0] = sqrt(in[0]);
+}
+
+static inline void inv_vec(const double* in, double* out) {
+    out[0] = 1.0 / in[0];
+}
+
+#define VLENF 1
+static inline void sqrtf_vec(const float* in, float* out) {
+    out[0] = sqrtf(in[0]);
+}
+
+#define VLENZ 1
+static inline void zmulacc_vec(const double* a, const double* b, double* c) {
+    zmulacc_scalar(a, b, c);
+}
+
+static inline void zmulacc_map_vec(const double* a, const double* b, const int* idx, double* c) {
+    zmulacc_scalar(a, b + 2 * idx[0], c);
+}
+
+static inline void zmulacc_vec(const double* a, const float* b, double* c) {
+    zmulacc_scalar(a, b, c);
+}
+
+static inline void zmulacc_map_vec(const double* a, const float* b, const int* idx, double* c) {
+    zmulacc_scalar(a, b + 2 * idx[0], c);
+}
+
+const char* vd_isa() { return "scalar"; }
+
+#endif
+
+//---------------------------------------------------------------------
+int vd_sqrt(int n, const double* in, double* out) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        sqrt_vec(in + i, out + i);
+    }
+    for (; i < n; ++i) {
+        out[i] = sqrt(in[i]);
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int vd_inv(int n, const double* in, double* out) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        inv_vec(in + i, out + i);
+    }
+    for (; i < n; ++i) {
+        out[i] = 1.0 / in[i];
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int vd_sincos(int n, const double* in, double* out_sin, double* out_cos) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        sincos_vec(in + i, out_sin + i, out_cos + i);
+    }
+    for (; i < n; ++i) {
+        sincos_scalar(in[i], out_sin + i, out_cos + i);
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int vs_sqrt(int n, const float* in, float* out) {
+    int i = 0;
+    for (; i + VLENF <= n; i += VLENF) {
+        sqrtf_vec(in + i, out + i);
+    }
+    for (; i < n; ++i) {
+        out[i] = sqrtf(in[i]);
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// Written without calls or branches so that the compiler vectorizes the
+// loop at the full float width.
+int vs_sincos(int n, const float* in, float* out_sin, float* out_cos) {
+    for (int i = 0; i < n; ++i) {
+        float x = in[i];
+        float q = rintf(x * FTWOOPI);
+        int iq = (int)q;
+        float r = ((x - q * FPIO2_1) - q * FPIO2_2) - q * FPIO2_3;
+        float z = r * r;
+        float ps = r + r * z * ((FS0 * z + FS1) * z + FS2);
+        float pc = 1.0f - 0.5f * z + z * z * ((FC0 * z + FC1) * z + FC2);
+        int qm = iq & 3;
+        float sv = (qm & 1) ? pc : ps;
+        float cv = (qm & 1) ? ps : pc;
+        out_sin[i] = (qm & 2) ? -sv : sv;
+        out_cos[i] = ((qm + 1) & 2) ? -cv : cv;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// The entries are taken VZ_TILE at a time, and all sources are added to one
+// tile of c before moving on, so that the tile stays in L1.
+#define VZ_TILE 128
+int vz_mulacc(int n, int nsrc, const double* const* a, const double* const* b, double* c) {
+    return vz_mulacc_map(n, nsrc, a, b, NULL, c);
+}
+
+//---------------------------------------------------------------------
+// B is double or float
+template <class B>
+static int zmulacc_map(int n, int nsrc, const double* const* a, const B* const* b,
+                       const int* const* map, double* c) {
+    for (int i0 = 0; i0 < n; i0 += VZ_TILE) {
+        int i1 = (i0 + VZ_TILE < n) ? i0 + VZ_TILE : n;
+        for (int s = 0; s < nsrc; ++s) {
+            const double* as = a[s];
+            const B* bs = b[s];
+            const int* ms = (map == NULL) ? NULL : map[s];
+            int i = i0;
+            if (ms == NULL) {
+                for (; i + VLENZ <= i1; i += VLENZ) {
+                    zmulacc_vec(as + 2 * i, bs + 2 * i, c + 2 * i);
+                }
+                for (; i < i1; ++i) {
+                    zmulacc_scalar(as + 2 * i, bs + 2 * i, c + 2 * i);
+                }
+            } else {
+                for (; i + VLENZ <= i1; i += VLENZ) {
+                    zmulacc_map_vec(as + 2 * i, bs, ms + i, c + 2 * i);
+                }
+                for (; i < i1; ++i) {
+                    zmulacc_scalar(as + 2 * i, bs + 2 * ms[i], c + 2 * i);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int vz_mulacc_map(int n, int nsrc, const double* const* a, const double* const* b,
+                  const int* const* map, double* c) {
+    return zmulacc_map(n, nsrc, a, b, map, c);
+}
+
+//---------------------------------------------------------------------
+int vz_mulacc_map_f(int n, int nsrc, const double* const* a, const float* const* b,
+                    const int* const* map, double* c) {
+    return zmulacc_map(n, nsrc, a, b, map, c);
+}
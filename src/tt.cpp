@@ -194,9 +194,12 @@ int main(int argc, char** argv)
 	    printf("Td %.2e\n", time_drct);
 	    printf("Rt %.2e\n", time_drct / time_eval);
 	    printf("Ea %.6e\n", relerr);
+	    printf("Tp %s\n", mlib.floattables() ? "single" : "double");
 	    printf("----------------------\n");
 	}
 	//
+	SAFE_FUNC_EVAL( wave.ReleasePlans() );
+	SAFE_FUNC_EVAL( mlib.ReleaseTables() );
 	SAFE_FUNC_EVAL( MPI_Finalize() );
 #ifndef RELEASE
     } catch( ... ) {
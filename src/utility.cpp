@@ -43,3 +43,40 @@ int getMPIInfo(int *mpirank, int *mpisize) {
     *mpisize = getMPISize();
     return 0;
 }
+
+int getMPINodeInfo(MPINodeInfo*& info) {
+#ifndef RELEASE
+    CallStackEntry entry("getMPINodeInfo");
+#endif
+    static MPINodeInfo* node = NULL;
+    if (node == NULL) {
+        int mpirank, mpisize;
+        getMPIInfo(&mpirank, &mpisize);
+        MPINodeInfo* tmp = new MPINodeInfo;
+        SAFE_FUNC_EVAL( MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, mpirank,
+                                            MPI_INFO_NULL, &(tmp->nodecomm)) );
+        int noderank, nodesize;
+        MPI_Comm_rank(tmp->nodecomm, &noderank);
+        MPI_Comm_size(tmp->nodecomm, &nodesize);
+        SAFE_FUNC_EVAL( MPI_Comm_split(MPI_COMM_WORLD, noderank == 0 ? 0 : MPI_UNDEFINED,
+                                       mpirank, &(tmp->leadercomm)) );
+        int nodeidx = 0;
+        if (noderank == 0) {
+            MPI_Comm_rank(tmp->leadercomm, &nodeidx);
+            MPI_Comm_size(tmp->leadercomm, &(tmp->nnodes));
+        }
+        SAFE_FUNC_EVAL( MPI_Bcast(&nodeidx, 1, MPI_INT, 0, tmp->nodecomm) );
+        SAFE_FUNC_EVAL( MPI_Bcast(&(tmp->nnodes), 1, MPI_INT, 0, tmp->nodecomm) );
+        tmp->nodeof.resize(mpisize);
+        tmp->localof.resize(mpisize);
+        SAFE_FUNC_EVAL( MPI_Allgather(&nodeidx, 1, MPI_INT, &(tmp->nodeof[0]), 1, MPI_INT,
+                                      MPI_COMM_WORLD) );
+        SAFE_FUNC_EVAL( MPI_Allgather(&noderank, 1, MPI_INT, &(tmp->localof[0]), 1, MPI_INT,
+                                      MPI_COMM_WORLD) );
+        SAFE_FUNC_EVAL( MPI_Allreduce(&nodesize, &(tmp->maxnodesize), 1, MPI_INT, MPI_MAX,
+                                      MPI_COMM_WORLD) );
+        node = tmp;
+    }
+    info = node;
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* Distributed Directional Fast Multipole Method
+   Copyright (C) 2014 Austin Benson, Lexing Ying, and Jack Poulson
+
+ This file is part of DDFMM.
+
+    DDFMM is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    DDFMM is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with DDFMM.  If not, see <http://www.gnu.org/licenses/>. */
+#include "simdmath.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#define CLOCK_DIFF_SECS(ck1, ck0) (double(ck1-ck0) / CLOCKS_PER_SEC)
+
+// Throughput of the scalar libm path in vecmath.hpp against the vectorized
+// routines in simdmath.hpp, on arguments in the range K*r takes for K = 256.
+// The last part compares the V list Hadamard accumulation written with
+// std::complex against vz_mulacc, for the (2P)^3 tensors of P = 4, 6, 8, both
+// directly and through an index map (vz_mulacc_map), and with the tensors in
+// single precision (vz_mulacc_map_f) against the mapped double version.
+int main(int argc, char** argv) {
+    int n = 4096;        // about the size of one near-field kernel matrix
+    int reps = 2000;
+    if (argc > 1) n = atoi(argv[1]);
+    if (argc > 2) reps = atoi(argv[2]);
+
+    double xmax = 2 * M_PI * 256 * sqrt(3.0);
+    std::vector<double> x(n), r2(n), s0(n), c0(n), s1(n), c1(n), q0(n), q1(n);
+    srand48(0);
+    for (int i = 0; i < n; ++i) {
+        x[i] = xmax * drand48();
+        r2[i] = x[i] * x[i] + 1;
+    }
+    printf("vector math backend: %s, n = %d, reps = %d\n", vd_isa(), n, reps);
+
+    clock_t ck0, ck1;
+    double tscl, tvec, err;
+
+    //1. sqrt
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        for (int i = 0; i < n; ++i) {
+            q0[i] = sqrt(r2[i]);
+        }
+    }
+    ck1 = clock();
+    tscl = CLOCK_DIFF_SECS(ck1, ck0);
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        vd_sqrt(n, &r2[0], &q1[0]);
+    }
+    ck1 = clock();
+    tvec = CLOCK_DIFF_SECS(ck1, ck0);
+    err = 0;
+    for (int i = 0; i < n; ++i) {
+        err = std::max(err, fabs(q0[i] - q1[i]) / q0[i]);
+    }
+    printf("sqrt    scalar %8.1f Melem/s  vector %8.1f Melem/s  speedup %5.2f  max relerr %.2e\n",
+           1e-6 * n * reps / tscl, 1e-6 * n * reps / tvec, tscl / tvec, err);
+
+    //2. inv
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        for (int i = 0; i < n; ++i) {
+            q0[i] = 1.0 / r2[i];
+        }
+    }
+    ck1 = clock();
+    tscl = CLOCK_DIFF_SECS(ck1, ck0);
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        vd_inv(n, &r2[0], &q1[0]);
+    }
+    ck1 = clock();
+    tvec = CLOCK_DIFF_SECS(ck1, ck0);
+    err = 0;
+    for (int i = 0; i < n; ++i) {
+        err = std::max(err, fabs(q0[i] - q1[i]) / q0[i]);
+    }
+    printf("inv     scalar %8.1f Melem/s  vector %8.1f Melem/s  speedup %5.2f  max relerr %.2e\n",
+           1e-6 * n * reps / tscl, 1e-6 * n * reps / tvec, tscl / tvec, err);
+
+    //3. sincos
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        for (int i = 0; i < n; ++i) {
+#ifdef OS_X
+            s0[i] = sin(x[i]);
+            c0[i] = cos(x[i]);
+#else
+            sincos(x[i], &s0[i], &c0[i]);
+#endif
+        }
+    }
+    ck1 = clock();
+    tscl = CLOCK_DIFF_SECS(ck1, ck0);
+    ck0 = clock();
+    for (int k = 0; k < reps; ++k) {
+        vd_sincos(n, &x[0], &s1[0], &c1[0]);
+    }
+    ck1 = clock();
+    tvec = CLOCK_DIFF_SECS(ck1, ck0);
+    err = 0;
+    for (int i = 0; i < n; ++i) {
+        err = std::max(err, fabs(s0[i] - s1[i]));
+        err = std::max(err, fabs(c0[i] - c1[i]));
+    }
+    printf("sincos  scalar %8.1f Melem/s  vector %8.1f Melem/s  speedup %5.2f  max abserr %.2e\n",
+           1e-6 * n * reps / tscl, 1e-6 * n * reps / tvec, tscl / tvec, err);
+
+    //4. V list accumulation, nsrc source boxes into one target
+    typedef std::complex<double> cpx;
+    int nsrc = 64;
+    int Ps[3] = {4, 6, 8};
+    for (int ip = 0; ip < 3; ++ip) {
+        int P = Ps[ip];
+        int tsz = 8 * P * P * P;
+        int vreps = std::max(1, int(2e8 / (double(tsz) * nsrc)));
+        std::vector<cpx> den(tsz * nsrc), op(tsz * nsrc), v0(tsz), v1(tsz);
+        std::vector<const double*> dptr(nsrc), optr(nsrc);
+        for (int i = 0; i < tsz * nsrc; ++i) {
+            den[i] = cpx(drand48() - 0.5, drand48() - 0.5);
+            op[i] = cpx(drand48() - 0.5, drand48() - 0.5);
+        }
+        for (int s = 0; s < nsrc; ++s) {
+            dptr[s] = (const double*) (&den[s * tsz]);
+            optr[s] = (const double*) (&op[s * tsz]);
+        }
+        std::fill(v0.begin(), v0.end(), cpx(0, 0));
+        std::fill(v1.begin(), v1.end(), cpx(0, 0));
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            for (int s = 0; s < nsrc; ++s) {
+                const cpx* ds = &den[s * tsz];
+                const cpx* os = &op[s * tsz];
+                for (int i = 0; i < tsz; ++i) {
+                    v0[i] += ds[i] * os[i];
+                }
+            }
+        }
+        ck1 = clock();
+        tscl = CLOCK_DIFF_SECS(ck1, ck0);
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            vz_mulacc(tsz, nsrc, &dptr[0], &optr[0], (double*) (&v1[0]));
+        }
+        ck1 = clock();
+        tvec = CLOCK_DIFF_SECS(ck1, ck0);
+        err = 0;
+        double nrm = 0;
+        for (int i = 0; i < tsz; ++i) {
+            err = std::max(err, std::abs(v0[i] - v1[i]));
+            nrm = std::max(nrm, std::abs(v0[i]));
+        }
+        printf("mulacc P=%d complex %8.1f Mmul/s  vector %8.1f Mmul/s  speedup %5.2f  max relerr %.2e\n",
+               P, 1e-6 * tsz * nsrc * vreps / tscl, 1e-6 * tsz * nsrc * vreps / tvec,
+               tscl / tvec, err / nrm);
+        //the same through a permutation, as for the symmetry-compressed ue2dc tensors
+        std::vector<int> perm(tsz);
+        for (int i = 0; i < tsz; ++i) {
+            perm[i] = tsz - 1 - i;
+        }
+        std::vector<const int*> mptr(nsrc, &perm[0]);
+        std::fill(v0.begin(), v0.end(), cpx(0, 0));
+        std::fill(v1.begin(), v1.end(), cpx(0, 0));
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            for (int s = 0; s < nsrc; ++s) {
+                const cpx* ds = &den[s * tsz];
+                const cpx* os = &op[s * tsz];
+                for (int i = 0; i < tsz; ++i) {
+                    v0[i] += ds[i] * os[perm[i]];
+                }
+            }
+        }
+        ck1 = clock();
+        tscl = CLOCK_DIFF_SECS(ck1, ck0);
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            vz_mulacc_map(tsz, nsrc, &dptr[0], &optr[0], &mptr[0], (double*) (&v1[0]));
+        }
+        ck1 = clock();
+        tvec = CLOCK_DIFF_SECS(ck1, ck0);
+        err = 0;
+        nrm = 0;
+        for (int i = 0; i < tsz; ++i) {
+            err = std::max(err, std::abs(v0[i] - v1[i]));
+            nrm = std::max(nrm, std::abs(v0[i]));
+        }
+        printf("mulacc P=%d mapped  %8.1f Mmul/s  vector %8.1f Mmul/s  speedup %5.2f  max relerr %.2e\n",
+               P, 1e-6 * tsz * nsrc * vreps / tscl, 1e-6 * tsz * nsrc * vreps / tvec,
+               tscl / tvec, err / nrm);
+        //the same with the tensors stored as complex float
+        std::vector<std::complex<float> > opf(op.begin(), op.end());
+        std::vector<const float*> fptr(nsrc);
+        for (int s = 0; s < nsrc; ++s) {
+            fptr[s] = (const float*) (&opf[s * tsz]);
+        }
+        std::vector<cpx> v2(tsz, cpx(0, 0));
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            for (int s = 0; s < nsrc; ++s) {
+                const cpx* ds = &den[s * tsz];
+                const std::complex<float>* os = &opf[s * tsz];
+                for (int i = 0; i < tsz; ++i) {
+                    v2[i] += ds[i] * cpx(os[perm[i]]);
+                }
+            }
+        }
+        ck1 = clock();
+        tscl = CLOCK_DIFF_SECS(ck1, ck0);
+        std::fill(v1.begin(), v1.end(), cpx(0, 0));
+        ck0 = clock();
+        for (int k = 0; k < vreps; ++k) {
+            vz_mulacc_map_f(tsz, nsrc, &dptr[0], &fptr[0], &mptr[0], (double*) (&v1[0]));
+        }
+        ck1 = clock();
+        tvec = CLOCK_DIFF_SECS(ck1, ck0);
+        //relerr against the float reference loop, dblerr against the double tensors
+        err = 0;
+        double dblerr = 0;
+        for (int i = 0; i < tsz; ++i) {
+            err = std::max(err, std::abs(v2[i] - v1[i]));
+            dblerr = std::max(dblerr, std::abs(v0[i] - v1[i]));
+        }
+        printf("mulacc P=%d float   %8.1f Mmul/s  vector %8.1f Mmul/s  speedup %5.2f  max relerr %.2e"
+               "  vs double %.2e\n",
+               P, 1e-6 * tsz * nsrc * vreps / tscl, 1e-6 * tsz * nsrc * vreps / tvec,
+               tscl / tvec, err / nrm, dblerr / nrm);
+    }
+    return 0;
+}
@@ -97,6 +97,23 @@ int zgemm(int m, int n, int k, cpx alpha, cpx* A, cpx* B, cpx beta, cpx* C)
 		 &alpha, A, &m, B, &k, &beta, C, &m);
   return 0;
 }
+// ---------------------------------------------------------------------- 
+int zgemm_trans(cpx alpha, const CpxNumMat& A, const CpxNumMat& B, cpx beta, CpxNumMat& C)
+{
+#ifndef RELEASE
+    CallStackEntry entry("zgemm_trans");
+#endif
+  assert( A.n() == C.m() );  assert( A.m() == B.m() );  assert( B.n() == C.n() );
+  CHECK_TRUE(A.m() > 0 && A.n() > 0 && B.n() > 0);
+  char transa = 'T';
+  char transb = 'N';
+  int m = C.m();
+  int n = C.n();
+  int k = A.m();
+  zgemm_(&transa, &transb, &m, &n, &k, &alpha, A.data(), &k, B.data(), &k,
+         &beta, C.data(), &m);
+  return 0;
+}
 //Y <- a M X + b Y
 // ---------------------------------------------------------------------- 
 int zgemv(cpx alpha, const CpxNumMat& A, const CpxNumVec& X, cpx beta, CpxNumVec& Y)
@@ -123,3 +140,157 @@ int zgemv(int m, int n, cpx alpha, cpx* A, cpx* X, cpx beta, cpx* Y)
   zgemv_(&trans, &m, &n, &alpha, A, &m, X, &incx, &beta, Y, &incy);
   return 0;
 }
+// ---------------------------------------------------------------------- 
+int zgesvd(const CpxNumMat& A, CpxNumMat& U, DblNumVec& S, CpxNumMat& VT)
+{
+#ifndef RELEASE
+    CallStackEntry entry("zgesvd");
+#endif
+  int m = A.m();
+  int n = A.n();
+  int r = std::min(m, n);
+  CHECK_TRUE(r > 0);
+  CpxNumMat tmp(m, n);  // overwritten by LAPACK
+  std::copy(A.data(), A.data() + m * n, tmp.data());
+  U.resize(m, r);
+  S.resize(r);
+  VT.resize(r, n);
+  char jobu = 'S';
+  char jobvt = 'S';
+  int info = 0;
+  int lwork = -1;
+  cpx query;
+  DblNumVec rwork(5 * r);
+  zgesvd_(&jobu, &jobvt, &m, &n, tmp.data(), &m, S.data(), U.data(), &m,
+	  VT.data(), &r, &query, &lwork, rwork.data(), &info);
+  CHECK_TRUE(info == 0);
+  lwork = int(query.real());
+  CpxNumVec work(lwork);
+  zgesvd_(&jobu, &jobvt, &m, &n, tmp.data(), &m, S.data(), U.data(), &m,
+	  VT.data(), &r, work.data(), &lwork, rwork.data(), &info);
+  CHECK_TRUE(info == 0);
+  return 0;
+}
+// ---------------------------------------------------------------------- 
+int zpinv(const CpxNumMat& A, CpxNumMat& B)
+{
+#ifndef RELEASE
+    CallStackEntry entry("zpinv");
+#endif
+  CpxNumMat U, VT;
+  DblNumVec S;
+  SAFE_FUNC_EVAL( zgesvd(A, U, S, VT) );
+  double tol = std::max(A.m(), A.n()) * S(0) * DBL_EPSILON;
+  B.resize(A.n(), A.m());
+  setvalue(B, cpx(0,0));
+  //B = V * diag(1/S) * U^*
+  for (int k = 0; k < S.m() && S(k) > tol; ++k) {
+    double is = 1.0 / S(k);
+    for (int j = 0; j < A.m(); ++j) {
+      cpx u = std::conj(U(j, k)) * is;
+      for (int i = 0; i < A.n(); ++i) {
+	B(i, j) += std::conj(VT(k, i)) * u;
+      }
+    }
+  }
+  return 0;
+}
+// ---------------------------------------------------------------------- 
+int zgeqp3(const CpxNumMat& A, IntNumVec& piv, CpxNumMat& R)
+{
+#ifndef RELEASE
+    CallStackEntry entry("zgeqp3");
+#endif
+  int m = A.m();
+  int n = A.n();
+  int r = std::min(m, n);
+  CHECK_TRUE(r > 0);
+  CpxNumMat tmp(m, n);
+  std::copy(A.data(), A.data() + m * n, tmp.data());
+  piv.resize(n);
+  setvalue(piv, 0);  // all columns free
+  CpxNumVec tau(r);
+  DblNumVec rwork(2 * n);
+  int info = 0;
+  int lwork = -1;
+  cpx query;
+  zgeqp3_(&m, &n, tmp.data(), &m, piv.data(), tau.data(), &query, &lwork, rwork.data(), &info);
+  CHECK_TRUE(info == 0);
+  lwork = int(query.real());
+  CpxNumVec work(lwork);
+  zgeqp3_(&m, &n, tmp.data(), &m, piv.data(), tau.data(), work.data(), &lwork, rwork.data(), &info);
+  CHECK_TRUE(info == 0);
+  for (int j = 0; j < n; ++j) {
+    piv(j) -= 1;
+  }
+  R.resize(r, n);
+  setvalue(R, cpx(0,0));
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i <= std::min(j, r - 1); ++i) {
+      R(i, j) = tmp(i, j);
+    }
+  }
+  return 0;
+}
+// ---------------------------------------------------------------------- 
+int zgeqrf(const CpxNumMat& A, CpxNumMat& Q, CpxNumMat& R)
+{
+#ifndef RELEASE
+    CallStackEntry entry("zgeqrf");
+#endif
+  int m = A.m();
+  int n = A.n();
+  int r = std::min(m, n);
+  CHECK_TRUE(r > 0);
+  CpxNumMat tmp(m, n);
+  std::copy(A.data(), A.data() + m * n, tmp.data());
+  CpxNumVec tau(r);
+  int info = 0;
+  int lwork = -1;
+  cpx query;
+  zgeqrf_(&m, &n, tmp.data(), &m, tau.data(), &query, &lwork, &info);
+  CHECK_TRUE(info == 0);
+  lwork = int(query.real());
+  CpxNumVec work(lwork);
+  zgeqrf_(&m, &n, tmp.data(), &m, tau.data(), work.data(), &lwork, &info);
+  CHECK_TRUE(info == 0);
+  R.resize(r, n);
+  setvalue(R, cpx(0,0));
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i <= std::min(j, r - 1); ++i) {
+      R(i, j) = tmp(i, j);
+    }
+  }
+  Q.resize(m, r);
+  std::copy(tmp.data(), tmp.data() + m * r, Q.data());
+  lwork = -1;
+  zungqr_(&m, &r, &r, Q.data(), &m, tau.data(), &query, &lwork, &info);
+  CHECK_TRUE(info == 0);
+  lwork = int(query.real());
+  work.resize(lwork);
+  zungqr_(&m, &r, &r, Q.data(), &m, tau.data(), work.data(), &lwork, &info);
+  CHECK_TRUE(info == 0);
+  return 0;
+}
+// ---------------------------------------------------------------------- 
+int ztrtri(const CpxNumMat& R, CpxNumMat& Rinv)
+{
+#ifndef RELEASE
+    CallStackEntry entry("ztrtri");
+#endif
+  int n = R.m();
+  CHECK_TRUE(n > 0 && R.n() == n);
+  Rinv.resize(n, n);
+  setvalue(Rinv, cpx(0,0));
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i <= j; ++i) {
+      Rinv(i, j) = R(i, j);
+    }
+  }
+  char uplo = 'U';
+  char diag = 'N';
+  int info = 0;
+  ztrtri_(&uplo, &diag, &n, Rinv.data(), &n, &info);
+  CHECK_TRUE(info == 0);
+  return 0;
+}
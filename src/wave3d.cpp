@@ -23,7 +23,10 @@ Wave3d* Wave3d::_self = NULL;
 //-----------------------------------
 Wave3d::Wave3d(const std::string& p): ComObject(p), _posptr(NULL), _mlibptr(NULL),
                                       _fplan(NULL), _bplan(NULL), _ACCU(1), _NPQ(4),
-			              _K(64), _ctr(Point3(0, 0, 0)), _ptsmax(100) {
+			              _K(64), _ctr(Point3(0, 0, 0)), _ptsmax(100),
+                                      _nearfloat(false), _nrhs(1), _leafopson(false),
+                                      _vbatch(true), _vorder(false), _lowm2l(LOWM2L_AUTO),
+                                      _densetol(1e-6), _commplans(true), _overlap(true) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::Wave3d");
 #endif
@@ -157,6 +160,146 @@ int Wave3d::P() {
     }
 }
 
+//-----------------------------------------------------------
+CpxNumMat* NearFieldCache::find(const BoxKey& trgkey, const BoxKey& srckey) {
+#ifndef RELEASE
+    CallStackEntry entry("NearFieldCache::find");
+#endif
+    std::map<key_t, CpxNumMat>::iterator mi = _mats.find(key_t(trgkey, srckey));
+    if (mi == _mats.end()) {
+        _misses++;
+        return NULL;
+    }
+    _hits++;
+    return &(mi->second);
+}
+
+//-----------------------------------------------------------
+CpxNumMat* NearFieldCache::insert(const BoxKey& trgkey, const BoxKey& srckey,
+                                  int m, int n) {
+#ifndef RELEASE
+    CallStackEntry entry("NearFieldCache::insert");
+#endif
+    double sz = double(m) * n * sizeof(cpx);
+    if (_bytes + sz > _budget) {
+        return NULL;
+    }
+    _bytes += sz;
+    CpxNumMat& mat = _mats[key_t(trgkey, srckey)];
+    mat.resize(m, n);
+    return &mat;
+}
+
+//-----------------------------------------------------------
+void NearFieldCache::clear() {
+#ifndef RELEASE
+    CallStackEntry entry("NearFieldCache::clear");
+#endif
+    _mats.clear();
+    _bytes = 0;
+    reset_counts();
+}
+
+//-----------------------------------------------------------
+CpxNumMat* M2LCache::find(double W, const Index3& dir, const Index3& off) {
+#ifndef RELEASE
+    CallStackEntry entry("M2LCache::find");
+#endif
+    std::map<key_t, entry_t>::iterator mi = _mats.find(key_t(W, std::make_pair(dir, off)));
+    if (mi == _mats.end()) {
+        _misses++;
+        return NULL;
+    }
+    _hits++;
+    // move to the front of the LRU list
+    _lru.splice(_lru.begin(), _lru, mi->second.second);
+    return &(mi->second.first);
+}
+
+//-----------------------------------------------------------
+CpxNumMat* M2LCache::insert(double W, const Index3& dir, const Index3& off,
+                            int m, int n) {
+#ifndef RELEASE
+    CallStackEntry entry("M2LCache::insert");
+#endif
+    double sz = double(m) * n * sizeof(cpx);
+    if (sz > _budget) {
+        return NULL;
+    }
+    while (_bytes + sz > _budget && !_lru.empty()) {
+        std::map<key_t, entry_t>::iterator mi = _mats.find(_lru.back());
+        CHECK_TRUE(mi != _mats.end());
+        CpxNumMat& old = mi->second.first;
+        _bytes -= double(old.m()) * old.n() * sizeof(cpx);
+        _mats.erase(mi);
+        _lru.pop_back();
+        _evictions++;
+    }
+    key_t key(W, std::make_pair(dir, off));
+    _lru.push_front(key);
+    entry_t& ent = _mats[key];
+    ent.second = _lru.begin();
+    ent.first.resize(m, n);
+    _bytes += sz;
+    return &(ent.first);
+}
+
+//-----------------------------------------------------------
+void M2LCache::clear() {
+#ifndef RELEASE
+    CallStackEntry entry("M2LCache::clear");
+#endif
+    _mats.clear();
+    _lru.clear();
+    _bytes = 0;
+    reset_counts();
+}
+
+//-----------------------------------------------------------
+void SpectrumCache::add(const BoxKey& key, double sz) {
+#ifndef RELEASE
+    CallStackEntry entry("SpectrumCache::add");
+#endif
+    grow(sz);
+    _lru.push_front(key);
+    _pos[key] = _lru.begin();
+}
+
+//-----------------------------------------------------------
+void SpectrumCache::touch(const BoxKey& key) {
+#ifndef RELEASE
+    CallStackEntry entry("SpectrumCache::touch");
+#endif
+    std::map<BoxKey, std::list<BoxKey>::iterator>::iterator mi = _pos.find(key);
+    if (mi != _pos.end()) {
+        _lru.splice(_lru.begin(), _lru, mi->second);
+    }
+}
+
+//-----------------------------------------------------------
+void SpectrumCache::remove(const BoxKey& key, double sz) {
+#ifndef RELEASE
+    CallStackEntry entry("SpectrumCache::remove");
+#endif
+    std::map<BoxKey, std::list<BoxKey>::iterator>::iterator mi = _pos.find(key);
+    if (mi != _pos.end()) {
+        _lru.erase(mi->second);
+        _pos.erase(mi);
+        shrink(sz);
+    }
+}
+
+//-----------------------------------------------------------
+void SpectrumCache::clear() {
+#ifndef RELEASE
+    CallStackEntry entry("SpectrumCache::clear");
+#endif
+    _lru.clear();
+    _pos.clear();
+    _bytes = 0;
+    _peak = 0;
+}
+
 //--------------------------------------------------------------------------------------------------------
 
 //-----------------------------------------------------------
@@ -63,17 +63,10 @@ int Wave3d::check(ParVec<int, cpx, PtPrtn>& den, ParVec<int, cpx, PtPrtn>& val,
     DblNumMat trgpos(3, tmptrgpos.size(), false, (double*)&(tmptrgpos[0]));
     CpxNumVec trgval(tmptrgpos.size());
 
-    CpxNumMat inter;
-    SAFE_FUNC_EVAL( _kernel.kernel(trgpos, srcpos, srcpos, inter) );
     // If no points were assigned to this processor, then the trgval
-    // should be zero.
-    if (inter.n() != 0) {
-	SAFE_FUNC_EVAL( zgemv(1.0, inter, srcden, 0.0, trgval) );
-    } else {
-	for (int i = 0; i < trgval.m(); ++i) {
-	    trgval(i) = 0;
-	}
-    }
+    // stays zero.
+    setvalue(trgval, cpx(0, 0));
+    SAFE_FUNC_EVAL( _kernel.apply(trgpos, srcpos, srcden, trgval) );
 
     CpxNumVec allval(trgval.m());
     SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
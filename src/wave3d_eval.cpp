@@ -18,11 +18,35 @@
 #include "wave3d.hpp"
 #include "vecmatop.hpp"
 #include "DataCollection.hpp"
+#include "simdmath.hpp"
 
 #include <algorithm>
 #include <list>
 
-#define DVMAX 400
+// Number of boxes whose translations are batched into one zgemm in the high
+// frequency M2M and L2L passes.
+#define HF_BATCH 256
+// Number of (target, source) pairs per zgemm in the dense low frequency M2L.
+#define DENSE_BATCH 512
+
+// Z-order of boxes on the same level.  Targets visited in this order share
+// most of their V list sources with the previous targets, so each spectrum
+// is used within a short stretch of the traversal.
+static bool MortonLess(const BoxKey& a, const BoxKey& b) {
+    if (a.first != b.first) {
+        return a.first < b.first;
+    }
+    for (int bit = 30; bit >= 0; --bit) {
+        for (int d = 0; d < 3; ++d) {
+            int ba = (a.second(d) >> bit) & 1;
+            int bb = (b.second(d) >> bit) & 1;
+            if (ba != bb) {
+                return ba < bb;
+            }
+        }
+    }
+    return false;
+}
 
 #ifdef LIMITED_MEMORY
 bool CompareDownwardHighInfo(std::pair<double, Index3> a,
@@ -44,6 +68,10 @@ int Wave3d::LevelCommunication(std::map< double, std::vector<HFBoxAndDirectionKe
     std::ostringstream sent_msg;
     sent_msg << "kbytes sent (W = " << W << ")";
     PrintCommData(GatherCommData(_bndvec.kbytes_sent()), sent_msg.str());
+    std::ostringstream copy_msg;
+    copy_msg << "kbytes of buffer copies saved (W = " << W << ")";
+    PrintCommData(GatherCommData(_bndvec.kbytes_copy_saved()), copy_msg.str());
+    return 0;
 }
 #endif
 
@@ -67,25 +95,54 @@ int Wave3d::LowFreqUpwardPass(ldmap_t& ldmap, std::set<BoxKey>& reqboxset) {
     return 0;
 }
 
-int Wave3d::LowFreqDownwardComm(std::set<BoxKey>& reqboxset) {
+int Wave3d::LowFreqDownwardCommBegin(std::set<BoxKey>& reqboxset) {
 #ifndef RELEASE
-    CallStackEntry entry("Wave3d::LowFreqDownwardComm");
+    CallStackEntry entry("Wave3d::LowFreqDownwardCommBegin");
 #endif
-    time_t t0 = time(0);
     std::vector<BoxKey> reqbox;
     reqbox.insert(reqbox.begin(), reqboxset.begin(), reqboxset.end());
     std::vector<int> mask(BoxDat_Number,0);
     mask[BoxDat_extden] = 1;
     mask[BoxDat_upeqnden] = 1;
     _boxvec.initialize_data();
-    SAFE_FUNC_EVAL( _boxvec.getBegin(reqbox, mask) );
-    SAFE_FUNC_EVAL( _boxvec.getEnd(mask) );
-    time_t t1 = time(0);
-    PrintParData(GatherParData(t0, t1), "Low frequency downward communication");
+    SAFE_FUNC_EVAL( _boxvec.getStart(reqbox, mask, _boxhandle,
+                                     _commplans ? &_boxplan : NULL) );
+    return 0;
+}
+
+int Wave3d::LowFreqDownwardCommTest() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LowFreqDownwardCommTest");
+#endif
+    bool done;
+    SAFE_FUNC_EVAL( _boxhandle.test(done) );
+    return 0;
+}
+
+int Wave3d::LowFreqDownwardCommEnd() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LowFreqDownwardCommEnd");
+#endif
+    SAFE_FUNC_EVAL( _boxhandle.wait() );
+    PrintParData(GatherParData(_boxhandle.startsecs() + _boxhandle.waitsecs()),
+                 "Low frequency downward communication (secs not hidden)");
+    PrintParData(GatherParData(_boxhandle.hiddensecs()),
+                 "Low frequency downward communication (secs hidden)");
+    if (getMPIRank() == 0 && _boxvec.sparse()) {
+        std::cout << "(sparse exchange)" << std::endl;
+    }
+    if (getMPIRank() == 0 && _boxvec.node()) {
+        std::cout << "(node exchange)" << std::endl;
+    }
+    if (getMPIRank() == 0 && _boxvec.replayed()) {
+        std::cout << "(plan replay)" << std::endl;
+    }
     PrintCommData(GatherCommData(_boxvec.kbytes_received()),
                   "kbytes received");
     PrintCommData(GatherCommData(_boxvec.kbytes_sent()),
                   "kbytes sent");
+    PrintCommData(GatherCommData(_boxvec.kbytes_copy_saved()),
+                  "kbytes of buffer copies saved");
     return 0;
 }
 
@@ -94,12 +151,22 @@ int Wave3d::LowFreqDownwardPass(ldmap_t& ldmap) {
     CallStackEntry entry("Wave3d::LowFreqDownwardPass");
 #endif
     time_t t0 = time(0);
+    SAFE_FUNC_EVAL( U_list_symmetric(ldmap) );
     for (ldmap_t::reverse_iterator mi = ldmap.rbegin();
         mi != ldmap.rend(); ++mi) {
         SAFE_FUNC_EVAL( EvalDownwardLow(mi->first, mi->second) );
     }
     time_t t1 = time(0);
     PrintParData(GatherParData(t0, t1), "Low frequency downward pass");
+    std::map<double, double> specmb;
+    for (std::map<double, double>::iterator mi = _specpeak.begin(); mi != _specpeak.end(); ++mi) {
+        specmb[mi->first] = mi->second / (1024 * 1024);
+    }
+    SAFE_FUNC_EVAL( LevelReport(specmb, "Peak V list spectrum MB") );
+    _specpeak.clear();
+    SAFE_FUNC_EVAL( LowFreqM2LReport() );
+    SAFE_FUNC_EVAL( NearFieldCacheReport() );
+    SAFE_FUNC_EVAL( LeafOpsReport() );
     return 0;
 }
 
@@ -139,6 +206,7 @@ int Wave3d::HighFreqPass(hdmap_t& hdmap) {
     }
     t1 = time(0);
     PrintParData(GatherParData(t0, t1), "High frequency upward pass");
+    SAFE_FUNC_EVAL( HighFreqRateReport(_m2mrate, "High frequency M2M") );
 
     t0 = time(0);
     std::vector<HFBoxAndDirectionKey> reqbnd;
@@ -163,7 +231,7 @@ int Wave3d::HighFreqPass(hdmap_t& hdmap) {
 
     // Level by level communication and computation
     for (double W = max_W; W >= 1; W /= 2) {
-        LevelCommunication(request_bnds, W);
+        SAFE_FUNC_EVAL( LevelCommunication(request_bnds, W) );
         time_t t2 = time(0);
         for (std::list< std::vector< std::pair<double, Index3> > >::iterator it = all_info.begin();
              it != all_info.end(); ++it) {
@@ -182,6 +250,8 @@ int Wave3d::HighFreqPass(hdmap_t& hdmap) {
     }
     t1 = time(0);
     PrintParData(GatherParData(t0, t1), "High frequency downward pass");
+    SAFE_FUNC_EVAL( HighFreqRateReport(_l2lrate, "High frequency L2L") );
+    SAFE_FUNC_EVAL( M2LCacheReport() );
     return 0;
 }
 #else
@@ -212,16 +282,30 @@ int Wave3d::HighFreqPass(hdmap_t& hdmap) {
     }
     t1 = time(0);
     PrintParData(GatherParData(t0, t1), "High frequency upward pass");
+    SAFE_FUNC_EVAL( HighFreqRateReport(_m2mrate, "High frequency M2M") );
 
     t0 = time(0);
     std::vector<int> mask(HFBoxAndDirectionDat_Number,0);
     mask[HFBoxAndDirectionDat_dirupeqnden] = 1;
     std::vector<HFBoxAndDirectionKey> reqbnd;
     reqbnd.insert(reqbnd.begin(), reqbndset.begin(), reqbndset.end());
-    SAFE_FUNC_EVAL( _bndvec.getBegin(reqbnd, mask) );
+    if (_commplans) {
+        SAFE_FUNC_EVAL( _bndvec.getBegin(reqbnd, mask, _bndplan) );
+    } else {
+        SAFE_FUNC_EVAL( _bndvec.getBegin(reqbnd, mask) );
+    }
     SAFE_FUNC_EVAL( _bndvec.getEnd(mask) );
     t1 = time(0);
     PrintParData(GatherParData(t0, t1), "High frequency communication");
+    if (mpirank == 0 && _bndvec.sparse()) {
+        std::cout << "(sparse exchange)" << std::endl;
+    }
+    if (mpirank == 0 && _bndvec.node()) {
+        std::cout << "(node exchange)" << std::endl;
+    }
+    if (mpirank == 0 && _bndvec.replayed()) {
+        std::cout << "(plan replay)" << std::endl;
+    }
 
     t0 = time(0);
     for (int i = 0; i < basedirs.size(); ++i) {
@@ -231,15 +315,21 @@ int Wave3d::HighFreqPass(hdmap_t& hdmap) {
     t1 = time(0);
 
     PrintParData(GatherParData(t0, t1), "High frequency downward pass");
+    SAFE_FUNC_EVAL( HighFreqRateReport(_l2lrate, "High frequency L2L") );
+    SAFE_FUNC_EVAL( M2LCacheReport() );
     return 0;
 }
 #endif
 
-int Wave3d::GatherDensities(std::vector<int>& reqpts, ParVec<int,cpx,PtPrtn>& den) {
+int Wave3d::GatherDensities(std::vector<int>& reqpts, ParVec<int,CpxNumVec,PtPrtn>& den) {
     int mpirank = getMPIRank();
     std::vector<int> all(1, 1);
     time_t t0 = time(0);
-    SAFE_FUNC_EVAL( den.getBegin(reqpts, all) );
+    if (_commplans) {
+        SAFE_FUNC_EVAL( den.getBegin(reqpts, all, _denplan) );
+    } else {
+        SAFE_FUNC_EVAL( den.getBegin(reqpts, all) );
+    }
     SAFE_FUNC_EVAL( den.getEnd(all) );
     time_t t1 = time(0);
     if (mpirank == 0) {
@@ -297,6 +387,36 @@ int Wave3d::ConstructMaps(ldmap_t& ldmap, hdmap_t& hdmap) {
 
 //---------------------------------------------------------------------
 int Wave3d::eval(ParVec<int,cpx,PtPrtn>& den, ParVec<int,cpx,PtPrtn>& val) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::eval");
+#endif
+    // A single right-hand side is a block of one column.
+    ParVec<int, CpxNumVec, PtPrtn> blkden;
+    ParVec<int, CpxNumVec, PtPrtn> blkval;
+    blkden.prtn() = den.prtn();
+    blkval.prtn() = val.prtn();
+    for (std::map<int,cpx>::iterator mi = den.lclmap().begin();
+         mi != den.lclmap().end(); ++mi) {
+        CpxNumVec& tmp = blkden.lclmap()[mi->first];
+        tmp.resize(1);
+        tmp(0) = mi->second;
+    }
+    for (std::map<int,cpx>::iterator mi = val.lclmap().begin();
+         mi != val.lclmap().end(); ++mi) {
+        CpxNumVec& tmp = blkval.lclmap()[mi->first];
+        tmp.resize(1);
+        tmp(0) = mi->second;
+    }
+    SAFE_FUNC_EVAL( eval(blkden, blkval) );
+    for (std::map<int,cpx>::iterator mi = val.lclmap().begin();
+         mi != val.lclmap().end(); ++mi) {
+        mi->second = blkval.access(mi->first)(0);
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Wave3d::eval(ParVec<int,CpxNumVec,PtPrtn>& den, ParVec<int,CpxNumVec,PtPrtn>& val) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::eval");
 #endif
@@ -305,6 +425,14 @@ int Wave3d::eval(ParVec<int,cpx,PtPrtn>& den, ParVec<int,cpx,PtPrtn>& val) {
     time_t t0, t1, t2, t3;
     int mpirank = getMPIRank();
     std::vector<int> all(1, 1);
+    // Number of right-hand sides
+    int lclnrhs = 0;
+    for (std::map<int,CpxNumVec>::iterator mi = den.lclmap().begin();
+         mi != den.lclmap().end(); ++mi) {
+        lclnrhs = std::max(lclnrhs, mi->second.m());
+    }
+    SAFE_FUNC_EVAL( MPI_Allreduce(&lclnrhs, &_nrhs, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD) );
+    CHECK_TRUE(_nrhs > 0);
     ParVec<int, Point3, PtPrtn>& pos = (*_posptr);
     // Go through posptr to get nonlocal points
     std::vector<int> reqpts;
@@ -322,12 +450,19 @@ int Wave3d::eval(ParVec<int,cpx,PtPrtn>& den, ParVec<int,cpx,PtPrtn>& val) {
         BoxDat& curdat = mi->second;
         if (HasPoints(curdat) && OwnBox(curkey, mpirank) && IsTerminal(curdat)) {
             std::vector<int>& curpis = curdat.ptidxvec();
-            CpxNumVec& extden = curdat.extden();
-            extden.resize(curpis.size());
+            CpxNumMat& extden = curdat.extden();
+            extden.resize(curpis.size(), _nrhs);
             for (int k = 0; k < curpis.size(); ++k) {
                 int poff = curpis[k];
-                extden(k) = den.access(poff);
+                CpxNumVec& ptden = den.access(poff);
+                CHECK_TRUE(ptden.m() == _nrhs);
+                for (int c = 0; c < _nrhs; ++c) {
+                    extden(k, c) = ptden(c);
+                }
             }
+            // potentials from a previous eval
+            curdat.extval().resize(curpis.size(), _nrhs);
+            setvalue(curdat.extval(), cpx(0,0));
         }
     }
     SAFE_FUNC_EVAL( den.discard(reqpts) );
@@ -375,13 +510,29 @@ int Wave3d::eval(ParVec<int,cpx,PtPrtn>& den, ParVec<int,cpx,PtPrtn>& val) {
     ldmap_t ldmap;
     hdmap_t hdmap;
     ConstructMaps(ldmap, hdmap);
+    // read the translation tables this process needs, if they are lazy
+    std::set<double> lws;
+    for (ldmap_t::iterator mi = ldmap.begin(); mi != ldmap.end(); ++mi) {
+        lws.insert(mi->first);
+    }
+    std::set<Index3> hdirs;
+    for (hdmap_t::iterator mi = hdmap.begin(); mi != hdmap.end(); ++mi) {
+        hdirs.insert(mi->first);
+    }
+    SAFE_FUNC_EVAL( _mlibptr->Prefetch(lws, hdirs) );
 
     // Main work of the algorithm
     std::set<BoxKey> reqboxset;
     LowFreqUpwardPass(ldmap, reqboxset);
     SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
-    HighFreqPass(hdmap);
-    LowFreqDownwardComm(reqboxset);
+    if (_overlap) {
+        SAFE_FUNC_EVAL( LowFreqDownwardCommBegin(reqboxset) );
+        HighFreqPass(hdmap);
+    } else {
+        HighFreqPass(hdmap);
+        SAFE_FUNC_EVAL( LowFreqDownwardCommBegin(reqboxset) );
+    }
+    SAFE_FUNC_EVAL( LowFreqDownwardCommEnd() );
     LowFreqDownwardPass(ldmap);
     SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
 
@@ -399,32 +550,179 @@ int Wave3d::eval(ParVec<int,cpx,PtPrtn>& den, ParVec<int,cpx,PtPrtn>& val) {
         BoxKey curkey = mi->first;
         BoxDat& curdat = mi->second;
         if (HasPoints(curdat) && OwnBox(curkey, mpirank) && IsTerminal(curdat)) {
-            CpxNumVec& extval = curdat.extval();
+            CpxNumMat& extval = curdat.extval();
             std::vector<int>& curpis = curdat.ptidxvec();
             for (int k = 0; k < curpis.size(); ++k) {
                 int poff = curpis[k];
-                val.access(poff) = extval(k);
+                CpxNumVec& ptval = val.access(poff);
+                ptval.resize(_nrhs);
+                for (int c = 0; c < _nrhs; ++c) {
+                    ptval(c) = extval(k, c);
+                }
             }
         }
     }
     //call val->put
-    val.putBegin(wrtpts, all);  val.putEnd(all);
+    if (_commplans) {
+        SAFE_FUNC_EVAL( val.putBegin(wrtpts, all, _valplan) );
+    } else {
+        SAFE_FUNC_EVAL( val.putBegin(wrtpts, all) );
+    }
+    val.putEnd(all);
     val.discard(wrtpts);
+    if (mpirank == 0 && _commplans) {
+        std::cout << "Communication plan replays (densities, boxes, boundaries, potentials): "
+                  << _denplan.replays() << ", " << _boxplan.replays() << ", "
+                  << _bndplan.replays() << ", " << _valplan.replays() << std::endl;
+        int skips = _denplan.skips() + _boxplan.skips() + _bndplan.skips() + _valplan.skips();
+        if (skips > 0) {
+            std::cout << "Node exchanges not recorded (densities, boxes, boundaries, potentials): "
+                      << _denplan.skips() << ", " << _boxplan.skips() << ", "
+                      << _bndplan.skips() << ", " << _valplan.skips() << std::endl;
+        }
+    }
+    SAFE_FUNC_EVAL( FetchCacheReport() );
     SAFE_FUNC_EVAL( MPI_Barrier(MPI_COMM_WORLD) );
     return 0;
 }
 
+//---------------------------------------------------------------------
+int Wave3d::ReleasePlans() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::ReleasePlans");
+#endif
+    SAFE_FUNC_EVAL( _denplan.clear() );
+    SAFE_FUNC_EVAL( _boxplan.clear() );
+    SAFE_FUNC_EVAL( _bndplan.clear() );
+    SAFE_FUNC_EVAL( _valplan.clear() );
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int Wave3d::FetchCacheReport() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::FetchCacheReport");
+#endif
+    Mlib3d& mlib = *_mlibptr;
+    PrintCommData(GatherCommData(int(mlib.fetchhits())), "Translation fetch cache hits");
+    PrintCommData(GatherCommData(int(mlib.fetchmisses())), "Translation fetch cache misses");
+    PrintCommData(GatherCommData(int(mlib.fetchbytes() / 1024)), "Translation fetch cache kbytes");
+    PrintCommData(GatherCommData(int(mlib.residentbytes() / 1024)),
+                  "Translation kbytes held (private tables and fetch cache)");
+    PrintParData(GatherParData(mlib.fetchsecs()), "Translation fetch build seconds");
+    PrintParData(GatherParData(mlib.fetchsaved()), "Translation fetch seconds saved by the cache");
+    mlib.reset_fetch_counts();
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// Columns aoff, ..., aoff + n - 1 of A to columns boff, ... of B
+static int CopyColumns(const CpxNumMat& A, int aoff, int n, CpxNumMat& B, int boff) {
+    CHECK_TRUE(A.m() == B.m() && aoff + n <= A.n() && boff + n <= B.n());
+    std::copy(A.data() + aoff * A.m(), A.data() + (aoff + n) * A.m(),
+              B.data() + boff * B.m());
+    return 0;
+}
+
+// Same as CopyColumns, but adds to B
+static int AddColumns(const CpxNumMat& A, int aoff, int n, CpxNumMat& B, int boff) {
+    CHECK_TRUE(A.m() == B.m() && aoff + n <= A.n() && boff + n <= B.n());
+    const cpx* a = A.data() + aoff * A.m();
+    cpx* b = B.data() + boff * B.m();
+    for (int i = 0; i < n * A.m(); ++i) {
+        b[i] += a[i];
+    }
+    return 0;
+}
+
+int Wave3d::LeafP2MSetup(BoxKey& key, BoxDat& dat, const FetchDat& fetch, LeafOpDat& op) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LeafP2MSetup");
+#endif
+    Point3 ctr = BoxCenter(key);
+    const DblNumMat& ucp = fetch.ucp();
+    DblNumMat upchkpos(ucp.m(), ucp.n());
+    for (int k = 0; k < ucp.n(); ++k) {
+        for (int d = 0; d < dim(); ++d) {
+            upchkpos(d,k) = ucp(d,k) + ctr(d);
+        }
+    }
+    CpxNumMat mat;
+    SAFE_FUNC_EVAL( _kernel.kernel(upchkpos, dat.extpos(), dat.extpos(), mat) );
+    op.p2mfold() = (fetch.neqn() <= mat.m());
+    if (op.p2mfold()) {
+        SAFE_FUNC_EVAL( fetch.uc2ue_apply(mat, op.p2m()) );
+    } else {
+        op.p2m() = mat;
+    }
+    return 0;
+}
+
+int Wave3d::LeafL2PSetup(BoxKey& key, BoxDat& dat, const FetchDat& fetch, LeafOpDat& op) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LeafL2PSetup");
+#endif
+    Point3 ctr = BoxCenter(key);
+    const DblNumMat& dep = fetch.dep();
+    DblNumMat dneqnpos(dep.m(), dep.n());
+    for (int k = 0; k < dep.n(); ++k) {
+        for (int d = 0; d < dim(); ++d) {
+            dneqnpos(d,k) = dep(d,k) + ctr(d);
+        }
+    }
+    CpxNumMat mat;
+    SAFE_FUNC_EVAL( _kernel.kernel(dat.extpos(), dneqnpos, dneqnpos, mat) );
+    op.l2pfold() = (fetch.neqn() <= mat.n());
+    if (op.l2pfold()) {
+        // mat * dc2de = (uc2ue * mat^T)^T
+        CpxNumMat matt(mat.n(), mat.m());
+        for (int j = 0; j < mat.n(); ++j) {
+            for (int i = 0; i < mat.m(); ++i) {
+                matt(j, i) = mat(i, j);
+            }
+        }
+        CpxNumMat res;
+        SAFE_FUNC_EVAL( fetch.uc2ue_apply(matt, res) );
+        op.l2p().resize(res.n(), res.m());
+        for (int j = 0; j < res.n(); ++j) {
+            for (int i = 0; i < res.m(); ++i) {
+                op.l2p()(j, i) = res(i, j);
+            }
+        }
+    } else {
+        op.l2p() = mat;
+    }
+    return 0;
+}
+
+int Wave3d::LeafOpsReport() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LeafOpsReport");
+#endif
+    if (!_leafopson) {
+        return 0;
+    }
+    double bytes = 0;
+    for (std::map<BoxKey, LeafOpDat>::iterator mi = _leafops.begin();
+         mi != _leafops.end(); ++mi) {
+        LeafOpDat& op = mi->second;
+        bytes += double(op.p2m().m()) * op.p2m().n() * sizeof(cpx);
+        bytes += double(op.l2p().m()) * op.l2p().n() * sizeof(cpx);
+    }
+    PrintCommData(GatherCommData(int(bytes / 1024)), "Leaf operator kbytes");
+    return 0;
+}
+
 //---------------------------------------------------------------------
 int Wave3d::EvalUpwardLow(double W, std::vector<BoxKey>& srcvec,
                           std::set<BoxKey>& reqboxset) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::EvalUpwardLow");
 #endif
-    DblNumMat uep;
-    DblNumMat ucp;
-    NumVec<CpxNumMat> uc2ue;
-    NumTns<CpxNumMat> ue2uc;
-    SAFE_FUNC_EVAL( _mlibptr->UpwardLowFetch(W, uep, ucp, uc2ue, ue2uc) );
+    const FetchDat* fetch = NULL;
+    SAFE_FUNC_EVAL( _mlibptr->UpwardLowFetch(W, fetch) );
+    const DblNumMat& ucp = fetch->ucp();
+    const NumTns<CpxNumMat>& ue2uc = fetch->ue2uc();
     //---------------
     int tdof = 1;
     for (int k = 0; k < srcvec.size(); ++k) {
@@ -434,11 +732,24 @@ int Wave3d::EvalUpwardLow(double W, std::vector<BoxKey>& srcvec,
 
         Point3 srcctr = BoxCenter(srckey);
         //get array
-        CpxNumVec upchkval(tdof*ucp.n());
+        CpxNumMat upchkval(tdof*ucp.n(), _nrhs);
         setvalue(upchkval,cpx(0,0));
-        CpxNumVec& upeqnden = srcdat.upeqnden();
+        CpxNumMat& upeqnden = srcdat.upeqnden();
         //ue2dc
-        if (IsTerminal(srcdat)) {
+        bool folded = false;
+        if (IsTerminal(srcdat) && _leafopson) {
+            LeafOpDat& op = _leafops[srckey];
+            if (op.p2m().m() == 0) {
+                SAFE_FUNC_EVAL( LeafP2MSetup(srckey, srcdat, *fetch, op) );
+            }
+            if (op.p2mfold()) {
+                upeqnden.resize(op.p2m().m(), _nrhs);
+                SAFE_FUNC_EVAL( zgemm(1.0, op.p2m(), srcdat.extden(), 0.0, upeqnden) );
+                folded = true;
+            } else {
+                SAFE_FUNC_EVAL( zgemm(1.0, op.p2m(), srcdat.extden(), 1.0, upchkval) );
+            }
+        } else if (IsTerminal(srcdat)) {
             DblNumMat upchkpos(ucp.m(), ucp.n());
             for (int k = 0; k < ucp.n(); ++k) {
                 for (int d = 0; d < dim(); ++d) {
@@ -446,9 +757,7 @@ int Wave3d::EvalUpwardLow(double W, std::vector<BoxKey>& srcvec,
                 }
             }
             //mul
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(upchkpos, srcdat.extpos(), srcdat.extpos(), mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, srcdat.extden(), 1.0, upchkval) );
+            SAFE_FUNC_EVAL( _kernel.apply(upchkpos, srcdat.extpos(), srcdat.extden(), upchkval) );
         } else {
             for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
                 int a = CHILD_IND1(ind);
@@ -458,24 +767,15 @@ int Wave3d::EvalUpwardLow(double W, std::vector<BoxKey>& srcvec,
                 std::pair<bool, BoxDat&> data = _boxvec.contains(key);
                 if (data.first) {
                     BoxDat& chddat = data.second;
-                    SAFE_FUNC_EVAL( zgemv(1.0, ue2uc(a, b, c), chddat.upeqnden(), 1.0, upchkval) );
+                    SAFE_FUNC_EVAL( zgemm(1.0, ue2uc(a, b, c), chddat.upeqnden(), 1.0, upchkval) );
                 }
             }
         }
 
         //uc2ue
-        CpxNumMat& v  = uc2ue(0);
-        CpxNumMat& is = uc2ue(1); //LEXING: it is stored as a matrix
-        CpxNumMat& up = uc2ue(2);
-        CpxNumVec mid(up.m());
-        setvalue(mid,cpx(0,0));
-        SAFE_FUNC_EVAL( zgemv(1.0, up, upchkval, 0.0, mid) );
-        for (int k = 0; k < mid.m(); ++k) {
-            mid(k) = mid(k) * is(k,0);
+        if (!folded) {
+            SAFE_FUNC_EVAL( fetch->uc2ue_apply(upchkval, upeqnden) );
         }
-        upeqnden.resize(v.m());
-        setvalue(upeqnden,cpx(0,0));
-        SAFE_FUNC_EVAL( zgemv(1.0, v, mid, 0.0, upeqnden) );
 
         //-------------------------
         //EXTRA WORK, change role now
@@ -494,15 +794,22 @@ int Wave3d::EvalDownwardLow(double W, std::vector<BoxKey>& trgvec) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::EvalDownwardLow");
 #endif
-    DblNumMat dep;
-    DblNumMat dcp;
-    NumVec<CpxNumMat> dc2de;
-    NumTns<CpxNumMat> de2dc;
-    NumTns<CpxNumTns> ue2dc;
-    DblNumMat uep;
-    SAFE_FUNC_EVAL( _mlibptr->DownwardLowFetch(W, dep, dcp, dc2de, de2dc, ue2dc, uep) );
+    const FetchDat* fetch = NULL;
+    SAFE_FUNC_EVAL( _mlibptr->DownwardLowFetch(W, fetch) );
+    const DblNumMat& dep = fetch->dep();
+    const DblNumMat& dcp = fetch->dcp();
+    const NumTns<CpxNumMat>& de2dc = fetch->de2dc();
+    const DblNumMat& uep = fetch->uep();
+    Ue2dcTable* ue2dc = fetch->ue2dc();
     //------------------
     int _P = P();
+    if (_vorder) {
+        std::sort(trgvec.begin(), trgvec.end(), MortonLess);
+    }
+    _speccache.reset_peak();
+    int engine = LOWM2L_FFT;
+    SAFE_FUNC_EVAL( LowFreqM2LSelect(W, _P, trgvec, uep, dcp, engine) );
+    SAFE_FUNC_EVAL( LowFreqM2L(W, _P, engine, trgvec, uep, dcp, *ue2dc) );
     for (int k = 0; k < trgvec.size(); ++k) {
         BoxKey trgkey = trgvec[k];
         BoxDat& trgdat = _boxvec.access(trgkey);
@@ -510,13 +817,13 @@ int Wave3d::EvalDownwardLow(double W, std::vector<BoxKey>& trgvec) {
 
         Point3 trgctr = BoxCenter(trgkey);
         //array
-        CpxNumVec& dnchkval = trgdat.dnchkval();
+        CpxNumMat& dnchkval = trgdat.dnchkval();
         if (dnchkval.m() == 0) {
-            dnchkval.resize(dcp.n());
+            dnchkval.resize(dcp.n(), _nrhs);
             setvalue(dnchkval,cpx(0,0));
         }
         if (trgdat.extval().m() == 0) {
-            trgdat.extval().resize( trgdat.extpos().n() );
+            trgdat.extval().resize( trgdat.extpos().n(), _nrhs );
             setvalue(trgdat.extval(), cpx(0,0));
         }
         DblNumMat dnchkpos(dcp.m(), dcp.n());
@@ -526,28 +833,33 @@ int Wave3d::EvalDownwardLow(double W, std::vector<BoxKey>& trgvec) {
             }
         }
         // List computations
-        SAFE_FUNC_EVAL( U_list_compute(trgdat) );
-        SAFE_FUNC_EVAL( V_list_compute(trgdat, W, _P, trgctr, uep, dcp, dnchkval, ue2dc) );
-        SAFE_FUNC_EVAL( W_list_compute(trgdat, W, uep) );
-        SAFE_FUNC_EVAL( X_list_compute(trgdat, dcp, dnchkpos, dnchkval) );
+        SAFE_FUNC_EVAL( U_list_compute(trgkey, trgdat) );
+        SAFE_FUNC_EVAL( W_list_compute(trgkey, trgdat, W, uep) );
+        SAFE_FUNC_EVAL( X_list_compute(trgkey, trgdat, dcp, dnchkpos, dnchkval) );
 
         //-------------
-        //dnchkval to dneqnden
-        CpxNumMat& v  = dc2de(0);
-        CpxNumMat& is = dc2de(1);
-        CpxNumMat& up = dc2de(2);
-        CpxNumVec mid(up.m());        setvalue(mid,cpx(0,0));
-        SAFE_FUNC_EVAL( zgemv(1.0, up, dnchkval, 0.0, mid) );
-        dnchkval.resize(0); //LEXING: SAVE SPACE
-        for (int k = 0; k < mid.m(); ++k) {
-            mid(k) = mid(k) * is(k,0);
+        //stored L2P, straight from dnchkval if folded
+        LeafOpDat* leafop = NULL;
+        if (IsTerminal(trgdat) && _leafopson) {
+            leafop = &(_leafops[trgkey]);
+            if (leafop->l2p().m() == 0) {
+                SAFE_FUNC_EVAL( LeafL2PSetup(trgkey, trgdat, *fetch, *leafop) );
+            }
+            if (leafop->l2pfold()) {
+                SAFE_FUNC_EVAL( zgemm(1.0, leafop->l2p(), dnchkval, 1.0, trgdat.extval()) );
+                dnchkval.resize(0, 0);
+                continue;
+            }
         }
-        CpxNumVec dneqnden(v.m());
-        setvalue(dneqnden,cpx(0,0));
-        SAFE_FUNC_EVAL( zgemv(1.0, v, mid, 0.0, dneqnden) );
+        //dnchkval to dneqnden
+        CpxNumMat dneqnden;
+        SAFE_FUNC_EVAL( fetch->dc2de_apply(dnchkval, dneqnden) );
+        dnchkval.resize(0, 0); //LEXING: SAVE SPACE
         //-------------
         //to children or to exact points
-        if (IsTerminal(trgdat)) {
+        if (leafop != NULL) {
+            SAFE_FUNC_EVAL( zgemm(1.0, leafop->l2p(), dneqnden, 1.0, trgdat.extval()) );
+        } else if (IsTerminal(trgdat)) {
             DblNumMat dneqnpos(dep.m(), dep.n());
             for (int k = 0; k < dep.n(); ++k) {
                 for (int d = 0; d < dim(); ++d) {
@@ -555,9 +867,7 @@ int Wave3d::EvalDownwardLow(double W, std::vector<BoxKey>& trgvec) {
                 }
             }
             //mul
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(trgdat.extpos(), dneqnpos, dneqnpos, mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, dneqnden, 1.0, trgdat.extval()) );
+            SAFE_FUNC_EVAL( _kernel.apply(trgdat.extpos(), dneqnpos, dneqnden, trgdat.extval()) );
         } else {
             //put stuff to children
             for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
@@ -572,96 +882,649 @@ int Wave3d::EvalDownwardLow(double W, std::vector<BoxKey>& trgvec) {
                 BoxDat& chddat = data.second;
                 //mul
                 if (chddat.dnchkval().m() == 0) {
-                    chddat.dnchkval().resize(de2dc(a,b,c).m());
+                    chddat.dnchkval().resize(de2dc(a,b,c).m(), _nrhs);
                     setvalue(chddat.dnchkval(), cpx(0,0));
                 }
-                SAFE_FUNC_EVAL( zgemv(1.0, de2dc(a, b, c), dneqnden, 1.0, chddat.dnchkval()) );
+                SAFE_FUNC_EVAL( zgemm(1.0, de2dc(a, b, c), dneqnden, 1.0, chddat.dnchkval()) );
+            }
+        }
+    }
+    _specpeak[W] = _speccache.peak();
+    return 0;
+}
+
+int Wave3d::NearFieldApply(BoxKey& trgkey, BoxKey& srckey,
+                           const DblNumMat& trgpos, const DblNumMat& srcpos,
+                           const CpxNumMat& den, CpxNumMat& val, bool single) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::NearFieldApply");
+#endif
+    if (_nearcache.enabled() && trgpos.n() > 0 && srcpos.n() > 0) {
+        CpxNumMat* op = _nearcache.find(trgkey, srckey);
+        if (op == NULL) {
+            op = _nearcache.insert(trgkey, srckey, trgpos.n(), srcpos.n());
+            if (op != NULL) {
+                SAFE_FUNC_EVAL( _kernel.kernel(trgpos, srcpos, srcpos, *op) );
+            }
+        }
+        if (op != NULL) {
+            SAFE_FUNC_EVAL( zgemm(1.0, *op, den, 1.0, val) );
+            return 0;
+        }
+    }
+    if (single) {
+        SAFE_FUNC_EVAL( _kernel.apply_float(trgpos, srcpos, den, val) );
+    } else {
+        SAFE_FUNC_EVAL( _kernel.apply(trgpos, srcpos, den, val) );
+    }
+    return 0;
+}
+
+int Wave3d::NearFieldApplySym(BoxKey& akey, BoxKey& bkey, BoxDat& adat, BoxDat& bdat) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::NearFieldApplySym");
+#endif
+    DblNumMat& apos = adat.extpos();
+    DblNumMat& bpos = bdat.extpos();
+    if (_nearcache.enabled() && apos.n() > 0 && bpos.n() > 0) {
+        // G(b, a) = G(a, b)^T, so one matrix serves both boxes
+        CpxNumMat* op = _nearcache.find(akey, bkey);
+        if (op == NULL) {
+            op = _nearcache.insert(akey, bkey, apos.n(), bpos.n());
+            if (op != NULL) {
+                SAFE_FUNC_EVAL( _kernel.kernel(apos, bpos, bpos, *op) );
             }
         }
+        if (op != NULL) {
+            SAFE_FUNC_EVAL( zgemm(1.0, *op, bdat.extden(), 1.0, adat.extval()) );
+            SAFE_FUNC_EVAL( zgemm_trans(1.0, *op, adat.extden(), 1.0, bdat.extval()) );
+            return 0;
+        }
+    }
+    SAFE_FUNC_EVAL( _kernel.apply_sym(apos, bpos, adat.extden(), bdat.extden(),
+                                      adat.extval(), bdat.extval(), _nearfloat) );
+    return 0;
+}
+
+int Wave3d::HighFreqRateReport(std::map<double, std::pair<double, double> >& rate,
+                               std::string name) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::HighFreqRateReport");
+#endif
+    std::map<double, double> gflops;
+    for (std::map<double, std::pair<double, double> >::iterator mi = rate.begin();
+         mi != rate.end(); ++mi) {
+        gflops[mi->first] = (mi->second.second > 0) ? 1e-9 * mi->second.first / mi->second.second : 0;
     }
+    SAFE_FUNC_EVAL( LevelReport(gflops, name + " GFLOP/s") );
+    rate.clear();
     return 0;
 }
 
-int Wave3d::U_list_compute(BoxDat& trgdat) {
+int Wave3d::LevelReport(std::map<double, double>& vals, std::string name) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LevelReport");
+#endif
+    // levels are powers of two, the same on all processes
+    double local_max_W = 0;
+    double local_min_W = DBL_MAX;
+    for (std::map<double, double>::iterator mi = vals.begin(); mi != vals.end(); ++mi) {
+        local_max_W = std::max(local_max_W, mi->first);
+        local_min_W = std::min(local_min_W, mi->first);
+    }
+    double max_W = 0;
+    double min_W = DBL_MAX;
+    SAFE_FUNC_EVAL( MPI_Allreduce(&local_max_W, &max_W, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD) );
+    SAFE_FUNC_EVAL( MPI_Allreduce(&local_min_W, &min_W, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD) );
+    for (double W = max_W; W >= min_W && max_W > 0; W /= 2) {
+        double val = 0;
+        std::map<double, double>::iterator mi = vals.find(W);
+        if (mi != vals.end()) {
+            val = mi->second;
+        }
+        std::ostringstream msg;
+        msg << name << " (W = " << W << ")";
+        PrintParData(GatherParData(val), msg.str());
+    }
+    return 0;
+}
+
+int Wave3d::M2LCacheReport() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::M2LCacheReport");
+#endif
+    if (!_m2lcache.enabled()) {
+        return 0;
+    }
+    PrintCommData(GatherCommData(int(_m2lcache.bytes() / 1024)),
+                  "M2L operator cache kbytes");
+    PrintCommData(GatherCommData(int(_m2lcache.evictions())),
+                  "M2L operator cache evictions");
+    PrintParData(GatherParData(_m2lcache.hit_rate()), "M2L operator cache hit rate");
+    _m2lcache.reset_counts();
+    return 0;
+}
+
+int Wave3d::NearFieldCacheReport() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::NearFieldCacheReport");
+#endif
+    if (!_nearcache.enabled()) {
+        return 0;
+    }
+    PrintCommData(GatherCommData(int(_nearcache.bytes() / 1024)),
+                  "Near-field cache kbytes");
+    PrintParData(GatherParData(_nearcache.hit_rate()), "Near-field cache hit rate");
+    _nearcache.reset_counts();
+    return 0;
+}
+
+bool Wave3d::SymmetricUPair(BoxKey& trgkey, BoxKey& neikey, int mpirank) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::SymmetricUPair");
+#endif
+    // The self interaction stays in U_list_compute.  Both boxes must be
+    // owned leaves in the low frequency regime, so that both extvals are
+    // computed here, and each must be in the U list of the other.
+    double eps = 1e-12;
+    if (neikey == trgkey || !OwnBox(neikey, mpirank) || BoxWidth(neikey) >= 1 - eps) {
+        return false;
+    }
+    BoxDat& neidat = _boxvec.access(neikey);
+    if (!IsTerminal(neidat)) {
+        return false;
+    }
+    std::vector<BoxKey>& neilist = neidat.undeidxvec();
+    return std::find(neilist.begin(), neilist.end(), trgkey) != neilist.end();
+}
+
+int Wave3d::U_list_symmetric(ldmap_t& ldmap) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::U_list_symmetric");
+#endif
+    int mpirank = getMPIRank();
+    for (ldmap_t::iterator mi = ldmap.begin(); mi != ldmap.end(); ++mi) {
+        std::vector<BoxKey>& trgvec = mi->second;
+        for (int k = 0; k < trgvec.size(); ++k) {
+            BoxKey trgkey = trgvec[k];
+            BoxDat& trgdat = _boxvec.access(trgkey);
+            if (!IsTerminal(trgdat)) {
+                continue;
+            }
+            for (std::vector<BoxKey>::iterator vi = trgdat.undeidxvec().begin();
+                 vi != trgdat.undeidxvec().end(); ++vi) {
+                BoxKey neikey = (*vi);
+                // each unordered pair once
+                if (!(trgkey < neikey) || !SymmetricUPair(trgkey, neikey, mpirank)) {
+                    continue;
+                }
+                BoxDat& neidat = _boxvec.access(neikey);
+                CHECK_TRUE(HasPoints(neidat));
+                if (trgdat.extval().m() == 0) {
+                    trgdat.extval().resize( trgdat.extpos().n(), _nrhs );
+                    setvalue(trgdat.extval(), cpx(0,0));
+                }
+                if (neidat.extval().m() == 0) {
+                    neidat.extval().resize( neidat.extpos().n(), _nrhs );
+                    setvalue(neidat.extval(), cpx(0,0));
+                }
+                SAFE_FUNC_EVAL( NearFieldApplySym(trgkey, neikey, trgdat, neidat) );
+            }
+        }
+    }
+    return 0;
+}
+
+int Wave3d::U_list_compute(BoxKey& trgkey, BoxDat& trgdat) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::U_list_compute");
 #endif
+    int mpirank = getMPIRank();
     for (std::vector<BoxKey>::iterator vi = trgdat.undeidxvec().begin();
         vi != trgdat.undeidxvec().end(); ++vi) {
         BoxKey neikey = (*vi);
+        if (SymmetricUPair(trgkey, neikey, mpirank)) {
+            continue;  // done in U_list_symmetric
+        }
         BoxDat& neidat = _boxvec.access(neikey);
         CHECK_TRUE(HasPoints(neidat));
         //mul
-        CpxNumMat mat;
-        SAFE_FUNC_EVAL( _kernel.kernel(trgdat.extpos(), neidat.extpos(), neidat.extpos(), mat) );
-        SAFE_FUNC_EVAL( zgemv(1.0, mat, neidat.extden(), 1.0, trgdat.extval()) );
+        SAFE_FUNC_EVAL( NearFieldApply(trgkey, neikey, trgdat.extpos(), neidat.extpos(),
+                                       neidat.extden(), trgdat.extval(), _nearfloat) );
     }
     return 0;
 }
 
-int Wave3d::V_list_compute(BoxDat& trgdat, double W, int _P, Point3& trgctr, DblNumMat& uep,
-                           DblNumMat& dcp, CpxNumVec& dnchkval, NumTns<CpxNumTns>& ue2dc) {
+int Wave3d::V_list_compute(BoxDat& trgdat, double W, int _P, Point3& trgctr, const DblNumMat& uep,
+                           const DblNumMat& dcp, CpxNumMat& dnchkval, Ue2dcTable& ue2dc) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::V_list_compute");
 #endif
     double step = W / (_P - 1);
-    setvalue(_valfft,cpx(0, 0));
-    //LEXING: SPECIAL
-    for (std::vector<BoxKey>::iterator vi = trgdat.vndeidxvec().begin();
-         vi != trgdat.vndeidxvec().end(); ++vi) {
-        BoxKey neikey = (*vi);
-        BoxDat& neidat = _boxvec.access(neikey);
-        CHECK_TRUE(HasPoints(neidat));
-        //mul
-        Point3 neictr = BoxCenter(neikey);
-        Index3 idx;
-        for (int d = 0; d < dim(); ++d) {
-            idx(d) = int(round( (trgctr[d]-neictr[d]) / W )); //LEXING:CHECK
-        }
-        //create if it is missing
-        if (neidat.fftcnt() == 0) {
-            setvalue(_denfft, cpx(0,0));
-            CpxNumVec& neiden = neidat.upeqnden();
-            for (int k = 0; k < uep.n(); ++k) {
-                int a = int( round((uep(0, k) + W / 2) / step) ) + _P;
-                int b = int( round((uep(1, k) + W / 2) / step) ) + _P;
-                int c = int( round((uep(2, k) + W / 2) / step) ) + _P;
-                _denfft(a,b,c) = neiden(k);
+    double specsz = double(_nrhs) * _denfft.m() * _denfft.n() * _denfft.p() * sizeof(cpx);
+    //one pass per right-hand side, the plans work on _denfft/_valfft
+    std::vector<const double*> dens(trgdat.vndeidxvec().size());
+    std::vector<const double*> inttns(trgdat.vndeidxvec().size());
+    std::vector<const float*> inttnsf(trgdat.vndeidxvec().size());
+    std::vector<const int*> intmap(trgdat.vndeidxvec().size());
+    for (int rhs = 0; rhs < _nrhs; ++rhs) {
+        setvalue(_valfft,cpx(0, 0));
+        //LEXING: SPECIAL
+        for (int i = 0; i < trgdat.vndeidxvec().size(); ++i) {
+            BoxKey neikey = trgdat.vndeidxvec()[i];
+            BoxDat& neidat = _boxvec.access(neikey);
+            CHECK_TRUE(HasPoints(neidat));
+            //mul
+            Point3 neictr = BoxCenter(neikey);
+            Index3 idx;
+            for (int d = 0; d < dim(); ++d) {
+                idx(d) = int(round( (trgctr[d]-neictr[d]) / W )); //LEXING:CHECK
             }
-            fftw_execute(_fplan);
-            neidat.upeqnden_fft() = _denfft; //COPY to the right place
-        }
-        CpxNumTns& neidenfft = neidat.upeqnden_fft();
-        //TODO: LEXING GET THE INTERACTION TENSOR
-        CpxNumTns& inttns = ue2dc(idx[0]+3,idx[1]+3,idx[2]+3);
-        for (int a = 0; a < 2 * _P; ++a) {
-            for (int b = 0; b < 2 * _P; ++b) {
-                for (int c = 0; c < 2 * _P; ++c) {
-                    _valfft(a, b, c) += (neidenfft(a, b, c) * inttns(a, b, c));
+            //create if it is missing (or was dropped by the spectrum cache)
+            if (neidat.upeqnden_fft().m() == 0) {
+                _speccache.add(neikey, specsz);
+                neidat.upeqnden_fft().resize(_nrhs);
+                CpxNumMat& neiden = neidat.upeqnden();
+                for (int col = 0; col < _nrhs; ++col) {
+                    setvalue(_denfft, cpx(0,0));
+                    for (int k = 0; k < uep.n(); ++k) {
+                        int a = int( round((uep(0, k) + W / 2) / step) ) + _P;
+                        int b = int( round((uep(1, k) + W / 2) / step) ) + _P;
+                        int c = int( round((uep(2, k) + W / 2) / step) ) + _P;
+                        _denfft(a,b,c) = neiden(k, col);
+                    }
+                    fftw_execute(_fplan);
+                    neidat.upeqnden_fft()(col) = _denfft; //COPY to the right place
                 }
+            } else if (rhs == 0) {
+                _speccache.touch(neikey);
+            }
+            dens[i] = (const double*) (neidat.upeqnden_fft()(rhs).data());
+            //TODO: LEXING GET THE INTERACTION TENSOR
+            if (ue2dc.single()) {
+                inttnsf[i] = ue2dc.ftensor(idx[0]+3,idx[1]+3,idx[2]+3);
+            } else {
+                inttns[i] = (const double*) (ue2dc.tensor(idx[0]+3,idx[1]+3,idx[2]+3).data());
             }
+            intmap[i] = ue2dc.map(idx[0]+3,idx[1]+3,idx[2]+3);
         }
-        //clean if necessary
-        neidat.fftcnt()++;
-        if (neidat.fftcnt() == neidat.fftnum()) {
-            neidat.upeqnden_fft().resize(0,0,0);
-            neidat.fftcnt() = 0;//reset, LEXING
+        if (!dens.empty() && ue2dc.single()) {
+            SAFE_FUNC_EVAL( vz_mulacc_map_f(_valfft.m() * _valfft.n() * _valfft.p(), dens.size(),
+                                            &dens[0], &inttnsf[0], &intmap[0],
+                                            (double*) (_valfft.data())) );
+        } else if (!dens.empty()) {
+            SAFE_FUNC_EVAL( vz_mulacc_map(_valfft.m() * _valfft.n() * _valfft.p(), dens.size(),
+                                          &dens[0], &inttns[0], &intmap[0],
+                                          (double*) (_valfft.data())) );
+        }
+        //clean if necessary, after the last right-hand side
+        for (int i = 0; i < trgdat.vndeidxvec().size() && rhs == _nrhs - 1; ++i) {
+            BoxKey neikey = trgdat.vndeidxvec()[i];
+            BoxDat& neidat = _boxvec.access(neikey);
+            neidat.fftcnt()++;
+            bool last = (neidat.fftcnt() == neidat.fftnum());
+            if (last) {
+                neidat.fftcnt() = 0;//reset, LEXING
+            }
+            if (last || _speccache.policy() == SPECTRUM_RECOMPUTE) {
+                neidat.upeqnden_fft().resize(0);
+                _speccache.remove(neikey, specsz);
+            }
+        }
+        while (rhs == _nrhs - 1 && _speccache.over_budget()) {
+            BoxKey oldkey = _speccache.lru_key();
+            _boxvec.access(oldkey).upeqnden_fft().resize(0);
+            _speccache.remove(oldkey, specsz);
+        }
+        fftw_execute(_bplan);
+        //add back
+        double coef = 1.0 / (2 * _P * 2 * _P * 2 * _P);
+        for (int k = 0; k < dcp.n(); ++k) {
+            int a = int( round((dcp(0, k) + W / 2) / step) ) + _P;
+            int b = int( round((dcp(1, k) + W / 2) / step) ) + _P;
+            int c = int( round((dcp(2, k) + W / 2) / step) ) + _P;
+            dnchkval(k, rhs) += (_valfft(a, b, c) * coef); //LEXING: VERY IMPORTANT
         }
     }
-    fftw_execute(_bplan);
-    //add back
-    double coef = 1.0 / (2 * _P * 2 * _P * 2 * _P);
+    return 0;
+}
+
+int Wave3d::V_list_batch(double W, int _P, std::vector<BoxKey>& trgvec,
+                         const DblNumMat& uep, const DblNumMat& dcp, Ue2dcTable& ue2dc) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::V_list_batch");
+#endif
+    double step = W / (_P - 1);
+    int nfft = 2 * _P;
+    int tsz = nfft * nfft * nfft;
+    //grid offsets of the equivalent and check points
+    std::vector<int> ueoff(uep.n());
+    for (int k = 0; k < uep.n(); ++k) {
+        int a = int( round((uep(0, k) + W / 2) / step) ) + _P;
+        int b = int( round((uep(1, k) + W / 2) / step) ) + _P;
+        int c = int( round((uep(2, k) + W / 2) / step) ) + _P;
+        ueoff[k] = a + nfft * (b + nfft * c);
+    }
+    std::vector<int> dcoff(dcp.n());
     for (int k = 0; k < dcp.n(); ++k) {
         int a = int( round((dcp(0, k) + W / 2) / step) ) + _P;
         int b = int( round((dcp(1, k) + W / 2) / step) ) + _P;
         int c = int( round((dcp(2, k) + W / 2) / step) ) + _P;
-        dnchkval(k) += (_valfft(a, b, c) * coef); //LEXING: VERY IMPORTANT
+        dcoff[k] = a + nfft * (b + nfft * c);
+    }
+    int n[3] = {nfft, nfft, nfft};
+    // bytes of the spectra of one box, all right-hand sides
+    double specsz = double(_nrhs) * tsz * sizeof(cpx);
+
+    std::vector<BoxKey> vtrgall;
+    for (int k = 0; k < trgvec.size(); ++k) {
+        if (!_boxvec.access(trgvec[k]).vndeidxvec().empty()) {
+            vtrgall.push_back(trgvec[k]);
+        }
+    }
+    for (int t0 = 0; t0 < vtrgall.size(); ) {
+        //1. take targets, in order, while the spectra of the batch fit in
+        //the budget, and number their sources
+        std::vector<BoxKey> vtrgvec;
+        std::vector<BoxKey> vsrcvec;
+        std::map<BoxKey, int> srcidx;
+        for (; t0 < vtrgall.size(); ++t0) {
+            std::vector<BoxKey>& tmpvec = _boxvec.access(vtrgall[t0]).vndeidxvec();
+            int nnew = 0;
+            for (int i = 0; i < tmpvec.size(); ++i) {
+                nnew += (srcidx.find(tmpvec[i]) == srcidx.end());
+            }
+            double sz = (vsrcvec.size() + nnew + vtrgvec.size() + 1) * specsz;
+            if (!vtrgvec.empty() && _speccache.budget() > 0 && sz > _speccache.budget()) {
+                break;
+            }
+            vtrgvec.push_back(vtrgall[t0]);
+            for (int i = 0; i < tmpvec.size(); ++i) {
+                if (srcidx.find(tmpvec[i]) == srcidx.end()) {
+                    srcidx[tmpvec[i]] = vsrcvec.size();
+                    vsrcvec.push_back(tmpvec[i]);
+                }
+            }
+        }
+        double batchsz = (vsrcvec.size() + vtrgvec.size()) * specsz;
+        _speccache.grow(batchsz);
+
+        //2. scatter the upward densities and transform all of them
+        int nsrc = vsrcvec.size() * _nrhs;
+        CpxNumVec denbatch(nsrc * tsz);
+        setvalue(denbatch, cpx(0,0));
+        for (int s = 0; s < vsrcvec.size(); ++s) {
+            BoxDat& srcdat = _boxvec.access(vsrcvec[s]);
+            CHECK_TRUE(HasPoints(srcdat));
+            CpxNumMat& srcden = srcdat.upeqnden();
+            for (int col = 0; col < _nrhs; ++col) {
+                cpx* den = denbatch.data() + (s * _nrhs + col) * tsz;
+                for (int k = 0; k < uep.n(); ++k) {
+                    den[ueoff[k]] = srcden(k, col);
+                }
+            }
+        }
+        fftw_plan fplan = fftw_plan_many_dft(3, n, nsrc,
+                                             (fftw_complex*) (denbatch.data()), NULL, 1, tsz,
+                                             (fftw_complex*) (denbatch.data()), NULL, 1, tsz,
+                                             FFTW_FORWARD, FFTW_ESTIMATE);
+        CHECK_TRUE(fplan != NULL);
+        fftw_execute(fplan);
+        fftw_destroy_plan(fplan);
+
+        //3. Hadamard products with the interaction tensors
+        int ntrg = vtrgvec.size() * _nrhs;
+        CpxNumVec valbatch(ntrg * tsz);
+        setvalue(valbatch, cpx(0,0));
+        for (int t = 0; t < vtrgvec.size(); ++t) {
+            BoxDat& trgdat = _boxvec.access(vtrgvec[t]);
+            Point3 trgctr = BoxCenter(vtrgvec[t]);
+            std::vector<BoxKey>& tmpvec = trgdat.vndeidxvec();
+            std::vector<int> srcoff(tmpvec.size());
+            std::vector<const double*> inttns(tmpvec.size());
+            std::vector<const float*> inttnsf(tmpvec.size());
+            std::vector<const int*> intmap(tmpvec.size());
+            std::vector<const double*> dens(tmpvec.size());
+            for (int i = 0; i < tmpvec.size(); ++i) {
+                Point3 neictr = BoxCenter(tmpvec[i]);
+                Index3 idx;
+                for (int d = 0; d < dim(); ++d) {
+                    idx(d) = int(round( (trgctr[d]-neictr[d]) / W )); //LEXING:CHECK
+                }
+                if (ue2dc.single()) {
+                    inttnsf[i] = ue2dc.ftensor(idx[0]+3,idx[1]+3,idx[2]+3);
+                } else {
+                    inttns[i] = (const double*) (ue2dc.tensor(idx[0]+3,idx[1]+3,idx[2]+3).data());
+                }
+                intmap[i] = ue2dc.map(idx[0]+3,idx[1]+3,idx[2]+3);
+                srcoff[i] = srcidx[tmpvec[i]] * _nrhs * tsz;
+            }
+            for (int col = 0; col < _nrhs; ++col) {
+                for (int i = 0; i < tmpvec.size(); ++i) {
+                    dens[i] = (const double*) (denbatch.data() + srcoff[i] + col * tsz);
+                }
+                cpx* val = valbatch.data() + (t * _nrhs + col) * tsz;
+                if (ue2dc.single()) {
+                    SAFE_FUNC_EVAL( vz_mulacc_map_f(tsz, tmpvec.size(), &dens[0], &inttnsf[0],
+                                                    &intmap[0], (double*) val) );
+                } else {
+                    SAFE_FUNC_EVAL( vz_mulacc_map(tsz, tmpvec.size(), &dens[0], &inttns[0],
+                                                  &intmap[0], (double*) val) );
+                }
+            }
+        }
+        denbatch.resize(0);
+
+        //4. transform back and add to the check values
+        fftw_plan bplan = fftw_plan_many_dft(3, n, ntrg,
+                                             (fftw_complex*) (valbatch.data()), NULL, 1, tsz,
+                                             (fftw_complex*) (valbatch.data()), NULL, 1, tsz,
+                                             FFTW_BACKWARD, FFTW_ESTIMATE);
+        CHECK_TRUE(bplan != NULL);
+        fftw_execute(bplan);
+        fftw_destroy_plan(bplan);
+        double coef = 1.0 / tsz;
+        for (int t = 0; t < vtrgvec.size(); ++t) {
+            BoxDat& trgdat = _boxvec.access(vtrgvec[t]);
+            CpxNumMat& dnchkval = trgdat.dnchkval();
+            if (dnchkval.m() == 0) {
+                dnchkval.resize(dcp.n(), _nrhs);
+                setvalue(dnchkval,cpx(0,0));
+            }
+            for (int col = 0; col < _nrhs; ++col) {
+                const cpx* val = valbatch.data() + (t * _nrhs + col) * tsz;
+                for (int k = 0; k < dcp.n(); ++k) {
+                    dnchkval(k, col) += (val[dcoff[k]] * coef); //LEXING: VERY IMPORTANT
+                }
+            }
+        }
+        _speccache.shrink(batchsz);
+    }
+    return 0;
+}
+
+int Wave3d::DenseM2LFetch(double W, Index3 off, const DblNumMat& uep, const DblNumMat& dcp,
+                          DenseM2LOp*& op) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::DenseM2LFetch");
+#endif
+    std::map<Index3, DenseM2LOp>& ops = _densem2l[W];
+    std::map<Index3, DenseM2LOp>::iterator mi = ops.find(off);
+    if (mi != ops.end()) {
+        op = &(mi->second);
+        return 0;
+    }
+    op = &(ops[off]);
+    DblNumMat trgpos(dcp.m(), dcp.n());
+    for (int k = 0; k < dcp.n(); ++k) {
+        for (int d = 0; d < dim(); ++d) {
+            trgpos(d, k) = dcp(d, k) + off(d) * W;
+        }
+    }
+    CpxNumMat mat(dcp.n(), uep.n());
+    SAFE_FUNC_EVAL( _kernel.kernel(trgpos, uep, uep, mat) );
+    CpxNumMat U, VT;
+    DblNumVec S;
+    SAFE_FUNC_EVAL( zgesvd(mat, U, S, VT) );
+    int r = 0;
+    while (r < S.m() && S(r) > _densetol * S(0)) {
+        ++r;
+    }
+    r = std::max(r, 1);
+    op->L().resize(U.m(), r);
+    for (int j = 0; j < r; ++j) {
+        for (int i = 0; i < U.m(); ++i) {
+            op->L()(i, j) = U(i, j) * S(j);
+        }
+    }
+    op->R().resize(r, VT.n());
+    for (int j = 0; j < VT.n(); ++j) {
+        for (int i = 0; i < r; ++i) {
+            op->R()(i, j) = VT(i, j);
+        }
+    }
+    return 0;
+}
+
+int Wave3d::V_list_dense(double W, std::vector<BoxKey>& trgvec, const DblNumMat& uep, const DblNumMat& dcp) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::V_list_dense");
+#endif
+    //group the (target, source) pairs by offset
+    std::map<Index3, std::vector< std::pair<BoxKey, BoxKey> > > pairs;
+    for (int t = 0; t < trgvec.size(); ++t) {
+        BoxKey trgkey = trgvec[t];
+        BoxDat& trgdat = _boxvec.access(trgkey);
+        std::vector<BoxKey>& tmpvec = trgdat.vndeidxvec();
+        if (tmpvec.empty()) {
+            continue;
+        }
+        if (trgdat.dnchkval().m() == 0) {
+            trgdat.dnchkval().resize(dcp.n(), _nrhs);
+            setvalue(trgdat.dnchkval(), cpx(0,0));
+        }
+        Point3 trgctr = BoxCenter(trgkey);
+        for (int i = 0; i < tmpvec.size(); ++i) {
+            Point3 neictr = BoxCenter(tmpvec[i]);
+            Index3 idx;
+            for (int d = 0; d < dim(); ++d) {
+                idx(d) = int(round( (trgctr[d]-neictr[d]) / W ));
+            }
+            pairs[idx].push_back(std::make_pair(trgkey, tmpvec[i]));
+        }
+    }
+    //per offset: densities of up to DENSE_BATCH sources, through R then L
+    for (std::map<Index3, std::vector< std::pair<BoxKey, BoxKey> > >::iterator mi = pairs.begin();
+         mi != pairs.end(); ++mi) {
+        DenseM2LOp* op = NULL;
+        SAFE_FUNC_EVAL( DenseM2LFetch(W, mi->first, uep, dcp, op) );
+        std::vector< std::pair<BoxKey, BoxKey> >& grp = mi->second;
+        for (int i0 = 0; i0 < grp.size(); i0 += DENSE_BATCH) {
+            int nb = std::min(int(grp.size()) - i0, DENSE_BATCH);
+            CpxNumMat den(uep.n(), nb * _nrhs);
+            for (int i = 0; i < nb; ++i) {
+                BoxDat& srcdat = _boxvec.access(grp[i0 + i].second);
+                CHECK_TRUE(HasPoints(srcdat));
+                SAFE_FUNC_EVAL( CopyColumns(srcdat.upeqnden(), 0, _nrhs, den, i * _nrhs) );
+            }
+            CpxNumMat mid(op->rank(), den.n());
+            SAFE_FUNC_EVAL( zgemm(1.0, op->R(), den, 0.0, mid) );
+            CpxNumMat chk(dcp.n(), den.n());
+            SAFE_FUNC_EVAL( zgemm(1.0, op->L(), mid, 0.0, chk) );
+            for (int i = 0; i < nb; ++i) {
+                BoxDat& trgdat = _boxvec.access(grp[i0 + i].first);
+                SAFE_FUNC_EVAL( AddColumns(chk, i * _nrhs, _nrhs, trgdat.dnchkval(), 0) );
+            }
+        }
+    }
+    return 0;
+}
+
+int Wave3d::LowFreqM2LSelect(double W, int _P, std::vector<BoxKey>& trgvec,
+                             const DblNumMat& uep, const DblNumMat& dcp, int& engine) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LowFreqM2LSelect");
+#endif
+    std::set<BoxKey> srcset;
+    double ntrg = 0;
+    double npairs = 0;
+    for (int k = 0; k < trgvec.size(); ++k) {
+        std::vector<BoxKey>& tmpvec = _boxvec.access(trgvec[k]).vndeidxvec();
+        if (!tmpvec.empty()) {
+            ntrg += 1;
+            npairs += tmpvec.size();
+            srcset.insert(tmpvec.begin(), tmpvec.end());
+        }
+    }
+    _vlistlen[W] = (ntrg > 0) ? npairs / ntrg : 0;
+    engine = _lowm2l;
+    if (engine == LOWM2L_AUTO) {
+        //FFT: one forward transform per source, one inverse per target and
+        //the Hadamard products.  Dense: two zgemm per pair, with the rank of
+        //the nearest offset, which is the largest.
+        double tsz = 8.0 * _P * _P * _P;
+        double fftflops = (srcset.size() + ntrg) * 5 * tsz * log(tsz) / log(2.0)
+            + npairs * 8 * tsz;
+        DenseM2LOp* op = NULL;
+        if (ntrg > 0) {
+            SAFE_FUNC_EVAL( DenseM2LFetch(W, Index3(2, 0, 0), uep, dcp, op) );
+        }
+        double rank = (op != NULL) ? op->rank() : std::min(uep.n(), dcp.n());
+        double denseflops = npairs * 8 * rank * (uep.n() + dcp.n());
+        engine = (denseflops < fftflops) ? LOWM2L_DENSE : LOWM2L_FFT;
+    }
+    _lowm2lsel[W] = engine;
+    return 0;
+}
+
+int Wave3d::LowFreqM2L(double W, int _P, int engine, std::vector<BoxKey>& trgvec,
+                       const DblNumMat& uep, const DblNumMat& dcp, Ue2dcTable& ue2dc) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LowFreqM2L");
+#endif
+    if (engine == LOWM2L_DENSE) {
+        SAFE_FUNC_EVAL( V_list_dense(W, trgvec, uep, dcp) );
+    } else if (_vbatch) {
+        SAFE_FUNC_EVAL( V_list_batch(W, _P, trgvec, uep, dcp, ue2dc) );
+    } else {
+        for (int k = 0; k < trgvec.size(); ++k) {
+            BoxKey trgkey = trgvec[k];
+            BoxDat& trgdat = _boxvec.access(trgkey);
+            CHECK_TRUE(HasPoints(trgdat));
+            CpxNumMat& dnchkval = trgdat.dnchkval();
+            if (dnchkval.m() == 0) {
+                dnchkval.resize(dcp.n(), _nrhs);
+                setvalue(dnchkval,cpx(0,0));
+            }
+            Point3 trgctr = BoxCenter(trgkey);
+            SAFE_FUNC_EVAL( V_list_compute(trgdat, W, _P, trgctr, uep, dcp, dnchkval, ue2dc) );
+        }
+    }
+    return 0;
+}
+
+int Wave3d::LowFreqM2LReport() {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::LowFreqM2LReport");
+#endif
+    SAFE_FUNC_EVAL( LevelReport(_vlistlen, "Average V list length") );
+    SAFE_FUNC_EVAL( LevelReport(_lowm2lsel, "Low frequency M2L engine (0 FFT, 1 dense)") );
+    _vlistlen.clear();
+    _lowm2lsel.clear();
+    double sz = 0;
+    for (std::map<double, std::map<Index3, DenseM2LOp> >::iterator mi = _densem2l.begin();
+         mi != _densem2l.end(); ++mi) {
+        for (std::map<Index3, DenseM2LOp>::iterator oi = mi->second.begin();
+             oi != mi->second.end(); ++oi) {
+            sz += oi->second.bytes();
+        }
     }
+    PrintCommData(GatherCommData(int(sz / 1024)), "Dense M2L operator kbytes");
     return 0;
 }
 
-int Wave3d::X_list_compute(BoxDat& trgdat, DblNumMat& dcp, DblNumMat& dnchkpos,
-                           CpxNumVec& dnchkval) {
+int Wave3d::X_list_compute(BoxKey& trgkey, BoxDat& trgdat, const DblNumMat& dcp, DblNumMat& dnchkpos,
+                           CpxNumMat& dnchkval) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::X_list_compute");
 #endif
@@ -672,20 +1535,18 @@ int Wave3d::X_list_compute(BoxDat& trgdat, DblNumMat& dcp, DblNumMat& dnchkpos,
         CHECK_TRUE(HasPoints(neidat));
         Point3 neictr = BoxCenter(neikey);
         if(IsTerminal(trgdat) && trgdat.extpos().n() < dcp.n()) {
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(trgdat.extpos(), neidat.extpos(), neidat.extpos(), mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, neidat.extden(), 1.0, trgdat.extval()) );
+            SAFE_FUNC_EVAL( NearFieldApply(trgkey, neikey, trgdat.extpos(), neidat.extpos(),
+                                           neidat.extden(), trgdat.extval(), _nearfloat) );
         } else {
             //mul
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(dnchkpos, neidat.extpos(), neidat.extpos(), mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, neidat.extden(), 1.0, dnchkval) );
+            SAFE_FUNC_EVAL( NearFieldApply(trgkey, neikey, dnchkpos, neidat.extpos(),
+                                           neidat.extden(), dnchkval, false) );
         }
     }
     return 0;
 }
 
-int Wave3d::W_list_compute(BoxDat& trgdat, double W, DblNumMat& uep) {
+int Wave3d::W_list_compute(BoxKey& trgkey, BoxDat& trgdat, double W, const DblNumMat& uep) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::W_list_compute");
 #endif
@@ -697,9 +1558,8 @@ int Wave3d::W_list_compute(BoxDat& trgdat, double W, DblNumMat& uep) {
         Point3 neictr = BoxCenter(neikey);
         //upchkpos
         if (IsTerminal(neidat) && neidat.extpos().n() < uep.n()) {
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(trgdat.extpos(), neidat.extpos(), neidat.extpos(), mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, neidat.extden(), 1.0, trgdat.extval()) );
+            SAFE_FUNC_EVAL( NearFieldApply(trgkey, neikey, trgdat.extpos(), neidat.extpos(),
+                                           neidat.extden(), trgdat.extval(), _nearfloat) );
         } else {
             double coef = BoxWidth(neikey) / W; //LEXING: SUPER IMPORTANT
             DblNumMat upeqnpos(uep.m(), uep.n()); //local version
@@ -709,9 +1569,8 @@ int Wave3d::W_list_compute(BoxDat& trgdat, double W, DblNumMat& uep) {
                 }
             }
             //mul
-            CpxNumMat mat;
-            SAFE_FUNC_EVAL( _kernel.kernel(trgdat.extpos(), upeqnpos, upeqnpos, mat) );
-            SAFE_FUNC_EVAL( zgemv(1.0, mat, neidat.upeqnden(), 1.0, trgdat.extval()) );
+            SAFE_FUNC_EVAL( NearFieldApply(trgkey, neikey, trgdat.extpos(), upeqnpos,
+                                           neidat.upeqnden(), trgdat.extval(), false) );
         }
     }
     return 0;
@@ -775,79 +1634,81 @@ int Wave3d::EvalUpwardHigh(double W, Index3 dir, box_lists_t& hdvecs,
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::EvalUpwardHigh");
 #endif
+    SAFE_FUNC_EVAL( LowFreqDownwardCommTest() );
     double eps = 1e-12;
-    DblNumMat uep;
-    DblNumMat ucp;
-    NumVec<CpxNumMat> uc2ue;
-    NumTns<CpxNumMat> ue2uc;
-    SAFE_FUNC_EVAL( _mlibptr->UpwardHighFetch(W, dir, uep, ucp, uc2ue, ue2uc) );
+    const FetchDat* fetch = NULL;
+    SAFE_FUNC_EVAL( _mlibptr->UpwardHighFetch(W, dir, fetch) );
+    const NumTns<CpxNumMat>& ue2uc = fetch->ue2uc();
     //---------------
+    // The boxes are done HF_BATCH at a time, with the right-hand sides of
+    // all of them side by side, so that each operator is one zgemm.
     std::vector<BoxKey>& srcvec = hdvecs.first;
-    for (int k = 0; k < srcvec.size(); ++k) {
-        BoxKey srckey = srcvec[k];
-        BoxDat& srcdat = _boxvec.access(srckey);
-        CHECK_TRUE(HasPoints(srcdat));  // Should have points
-
-        Point3 srcctr = BoxCenter(srckey);
-        HFBoxAndDirectionKey bndkey(srckey, dir);
-        HFBoxAndDirectionDat& bnddat = _bndvec.access( bndkey );
-        CpxNumVec& upeqnden = bnddat.dirupeqnden();
-        //eval
-        CpxNumVec upchkval(ue2uc(0,0,0).m());
+    Index3 pdir = ParentDir(dir);
+    double t0 = MPI_Wtime();
+    double flops = 0;
+    for (int k0 = 0; k0 < srcvec.size(); k0 += HF_BATCH) {
+        int nb = std::min(HF_BATCH, int(srcvec.size()) - k0);
+        CpxNumMat upchkval(ue2uc(0,0,0).m(), nb * _nrhs);
         setvalue(upchkval,cpx(0,0));
-        // High-frequency M2M
-        if (abs(W-1) < eps) {
-            // The children boxes only have non-directional equivalent densities
-            for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
-                int a = CHILD_IND1(ind);
-                int b = CHILD_IND2(ind);
-                int c = CHILD_IND3(ind);
-                BoxKey key = ChildKey(srckey, Index3(a, b, c));
-                // Do not compute unless _boxvec has the child key
-                std::pair<bool, BoxDat&> data = _boxvec.contains(key);
-                if (data.first) {
-                    BoxDat& chddat = data.second;
-                    CHECK_TRUE(HasPoints(chddat));
-                    CpxNumVec& chdued = chddat.upeqnden();
-                    SAFE_FUNC_EVAL( zgemv(1.0, ue2uc(a,b,c), chdued, 1.0, upchkval) );
-                }
-            }
-        } else {
-            // Pick the direction such that the child wedges in that direction
-            // contain the parent wedge in direction dir
-            Index3 pdir = ParentDir(dir);
-            for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
-                int a = CHILD_IND1(ind);
-                int b = CHILD_IND2(ind);
-                int c = CHILD_IND3(ind);
+        // High-frequency M2M, one octant at a time
+        for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
+            int a = CHILD_IND1(ind);
+            int b = CHILD_IND2(ind);
+            int c = CHILD_IND3(ind);
+            std::vector<int> cols;
+            std::vector<CpxNumMat*> dens;
+            for (int k = 0; k < nb; ++k) {
+                BoxKey srckey = srcvec[k0 + k];
                 BoxKey chdkey = ChildKey(srckey, Index3(a, b, c));
+                // Do not compute unless _boxvec has the child key
                 std::pair<bool, BoxDat&> data = _boxvec.contains(chdkey);
-                if (data.first) {
-                    BoxDat& chddat = data.second;
-                    CHECK_TRUE(HasPoints(chddat));
+                if (!data.first) {
+                    continue;
+                }
+                BoxDat& chddat = data.second;
+                CHECK_TRUE(HasPoints(chddat));
+                if (abs(W-1) < eps) {
+                    // The children boxes only have non-directional equivalent densities
+                    dens.push_back(&chddat.upeqnden());
+                } else {
+                    // Pick the direction such that the child wedges in that direction
+                    // contain the parent wedge in direction dir
                     HFBoxAndDirectionKey bndkey(chdkey, pdir);
-                    HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-                    CpxNumVec& chdued = bnddat.dirupeqnden();
-                    SAFE_FUNC_EVAL( zgemv(1.0, ue2uc(a,b,c), chdued, 1.0, upchkval) );
+                    dens.push_back(&_bndvec.access(bndkey).dirupeqnden());
                 }
+                cols.push_back(k * _nrhs);
+            }
+            if (cols.empty()) {
+                continue;
+            }
+            const CpxNumMat& op = ue2uc(a,b,c);
+            CpxNumMat chdued(op.n(), cols.size() * _nrhs);
+            for (int i = 0; i < cols.size(); ++i) {
+                SAFE_FUNC_EVAL( CopyColumns(*dens[i], 0, _nrhs, chdued, i * _nrhs) );
+            }
+            CpxNumMat chdchk(op.m(), chdued.n());
+            SAFE_FUNC_EVAL( zgemm(1.0, op, chdued, 0.0, chdchk) );
+            flops += 8.0 * op.m() * op.n() * chdued.n();
+            for (int i = 0; i < cols.size(); ++i) {
+                SAFE_FUNC_EVAL( AddColumns(chdchk, i * _nrhs, _nrhs, upchkval, cols[i]) );
             }
         }
 
         // Upward check to upward equivalency (uc2ue)
-        CpxNumMat& E1 = uc2ue(0);
-        CpxNumMat& E2 = uc2ue(1);
-        CpxNumMat& E3 = uc2ue(2);
-        cpx dat0[DVMAX], dat1[DVMAX];
-        CpxNumVec tmp0(E3.m(), false, dat0);
-        CHECK_TRUE(DVMAX >= E3.m());
-        CpxNumVec tmp1(E2.m(), false, dat1);
-        CHECK_TRUE(DVMAX >= E2.m());
-        upeqnden.resize(E1.m());
-        setvalue(upeqnden,cpx(0,0));
-        SAFE_FUNC_EVAL( zgemv(1.0, E3, upchkval, 0.0, tmp0) );
-        SAFE_FUNC_EVAL( zgemv(1.0, E2, tmp0, 0.0, tmp1) );
-        SAFE_FUNC_EVAL( zgemv(1.0, E1, tmp1, 0.0, upeqnden) );
+        CpxNumMat upeqnden;
+        SAFE_FUNC_EVAL( fetch->uc2ue_apply(upchkval, upeqnden) );
+        flops += 8.0 * fetch->applymuls() * upchkval.n();
+        for (int k = 0; k < nb; ++k) {
+            BoxKey srckey = srcvec[k0 + k];
+            CHECK_TRUE(HasPoints(_boxvec.access(srckey)));  // Should have points
+            HFBoxAndDirectionKey bndkey(srckey, dir);
+            CpxNumMat& dirupeqnden = _bndvec.access(bndkey).dirupeqnden();
+            dirupeqnden.resize(fetch->neqn(), _nrhs);
+            SAFE_FUNC_EVAL( CopyColumns(upeqnden, k * _nrhs, _nrhs, dirupeqnden, 0) );
+        }
     }
+    _m2mrate[W].first += flops;
+    _m2mrate[W].second += MPI_Wtime() - t0;
 
     SAFE_FUNC_EVAL( GetInteractionListKeys(dir, hdvecs.second, reqbndset) );
     return 0;
@@ -874,7 +1735,7 @@ int Wave3d::GetInteractionListKeys(Index3 dir, std::vector<BoxKey>& target_boxes
 
 //---------------------------------------------------------------------
 int Wave3d::HighFrequencyM2L(double W, Index3 dir, BoxKey trgkey, BoxDat& trgdat,
-                             DblNumMat& dcp, DblNumMat& uep) {
+                             const DblNumMat& dcp, const DblNumMat& uep) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::HighFrequencyM2L");
 #endif
@@ -890,105 +1751,133 @@ int Wave3d::HighFrequencyM2L(double W, Index3 dir, BoxKey trgkey, BoxDat& trgdat
     }
     HFBoxAndDirectionKey bndkey(trgkey, dir);
     HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-    CpxNumVec& dcv = bnddat.dirdnchkval();
+    CpxNumMat& dcv = bnddat.dirdnchkval();
     std::vector<BoxKey>& tmpvec = trgdat.fndeidxvec()[dir];
     for (int i = 0; i < tmpvec.size(); ++i) {
         BoxKey srckey = tmpvec[i];
 	Point3 srcctr = BoxCenter(srckey);
 	//difference vector
 	Point3 diff = trgctr - srcctr;
+	Index3 off;
+	for (int d = 0; d < 3; ++d) {
+	    off(d) = int(round(diff(d) / W));
+	}
 	diff /= diff.l2(); //LEXING: see wave3d_setup.cpp
 	CHECK_TRUE( nml2dir(diff, W) == dir );
-	//get source
-	DblNumMat tmpuep(uep.m(),uep.n());
-	for (int k = 0; k < tmpuep.n(); ++k) {
-	    for (int d = 0; d < 3; ++d) {
-	        tmpuep(d, k) = uep(d, k) + srcctr(d);
-	    }
-	}
 	HFBoxAndDirectionKey bndkey(srckey, dir);
 	HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-	CpxNumVec& ued = bnddat.dirupeqnden();
-	//mateix
-	CpxNumMat Mts;
-	SAFE_FUNC_EVAL( _kernel.kernel(tmpdcp, tmpuep, tmpuep, Mts) );
+	CpxNumMat& ued = bnddat.dirupeqnden();
 	//allocate space if necessary
 	if (dcv.m() == 0) {
-	    dcv.resize(Mts.m());
+	    dcv.resize(tmpdcp.n(), _nrhs);
 	    setvalue(dcv, cpx(0,0)); //LEXING: CHECK
 	}
 	//SAFE_FUNC_EVAL( ued.m() != 0 );
 	if (ued.m() == 0) {
-	    ued.resize(Mts.n());
+	    ued.resize(uep.n(), _nrhs);
 	    setvalue(ued, cpx(0, 0));
 	}
-	SAFE_FUNC_EVAL( zgemv(1.0, Mts, ued, 1.0, dcv) );
+	CpxNumMat* op = NULL;
+	if (_m2lcache.enabled()) {
+	    op = _m2lcache.find(W, dir, off);
+	    if (op != NULL) {
+	        SAFE_FUNC_EVAL( zgemm(1.0, *op, ued, 1.0, dcv) );
+	        continue;
+	    }
+	}
+	//get source
+	DblNumMat tmpuep(uep.m(),uep.n());
+	for (int k = 0; k < tmpuep.n(); ++k) {
+	    for (int d = 0; d < 3; ++d) {
+	        tmpuep(d, k) = uep(d, k) + srcctr(d);
+	    }
+	}
+	if (_m2lcache.enabled()) {
+	    op = _m2lcache.insert(W, dir, off, tmpdcp.n(), tmpuep.n());
+	}
+	if (op != NULL) {
+	    SAFE_FUNC_EVAL( _kernel.kernel(tmpdcp, tmpuep, tmpuep, *op) );
+	    SAFE_FUNC_EVAL( zgemm(1.0, *op, ued, 1.0, dcv) );
+	} else {
+	    SAFE_FUNC_EVAL( _kernel.apply(tmpdcp, tmpuep, ued, dcv) );
+	}
     }
     return 0;
 }
 
 //---------------------------------------------------------------------
-int Wave3d::HighFrequencyL2L(double W, Index3 dir, BoxKey trgkey,
-                             NumVec<CpxNumMat>& dc2de,
-                             NumTns<CpxNumMat>& de2dc) {
+int Wave3d::HighFrequencyL2L(double W, Index3 dir, std::vector<BoxKey>& trgvec,
+                             const FetchDat& fetch) {
+#ifndef RELEASE
+    CallStackEntry entry("Wave3d::HighFrequencyL2L");
+#endif
     double eps = 1e-12;
-    HFBoxAndDirectionKey bndkey(trgkey, dir);
-    HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-    CpxNumVec& dnchkval = bnddat.dirdnchkval();
-    CpxNumMat& E1 = dc2de(0);
-    CpxNumMat& E2 = dc2de(1);
-    CpxNumMat& E3 = dc2de(2);
-    cpx dat0[DVMAX], dat1[DVMAX], dat2[DVMAX];
-    CpxNumVec tmp0(E3.m(), false, dat0);
-    CpxNumVec tmp1(E2.m(), false, dat1);
-    CpxNumVec dneqnden(E1.m(), false, dat2);
-    SAFE_FUNC_EVAL( zgemv(1.0, E3, dnchkval, 0.0, tmp0) );
-    SAFE_FUNC_EVAL( zgemv(1.0, E2, tmp0, 0.0, tmp1) );
-    SAFE_FUNC_EVAL( zgemv(1.0, E1, tmp1, 0.0, dneqnden) );
-    dnchkval.resize(0); //LEXING: SAVE SPACE
-
-    if (abs(W - 1) < eps) {
+    Index3 pdir = ParentDir(dir); //LEXING: CHECK
+    const NumTns<CpxNumMat>& de2dc = fetch.de2dc();
+    double t0 = MPI_Wtime();
+    double flops = 0;
+    for (int k0 = 0; k0 < trgvec.size(); k0 += HF_BATCH) {
+        int nb = std::min(HF_BATCH, int(trgvec.size()) - k0);
+        CpxNumMat dnchkval(fetch.neqn(), nb * _nrhs);
+        setvalue(dnchkval,cpx(0,0));
+        for (int k = 0; k < nb; ++k) {
+            HFBoxAndDirectionKey bndkey(trgvec[k0 + k], dir);
+            CpxNumMat& dcv = _bndvec.access(bndkey).dirdnchkval();
+            if (dcv.m() > 0) {
+                SAFE_FUNC_EVAL( CopyColumns(dcv, 0, _nrhs, dnchkval, k * _nrhs) );
+            }
+            dcv.resize(0, 0); //LEXING: SAVE SPACE
+        }
+        CpxNumMat dneqnden;
+        SAFE_FUNC_EVAL( fetch.dc2de_apply(dnchkval, dneqnden) );
+        flops += 8.0 * fetch.applymuls() * dnchkval.n();
+
+        // High-frequency L2L, one octant at a time
         for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
-	    int a = CHILD_IND1(ind);
-	    int b = CHILD_IND2(ind);
-	    int c = CHILD_IND3(ind);             
-	    BoxKey key = ChildKey(trgkey, Index3(a,b,c));
-	    std::pair<bool, BoxDat&> data = _boxvec.contains(key);
-	    // If the box was empty, it will not be stored
-	    if (!data.first) {
-	        continue;
-	    }
-	    BoxDat& chddat = data.second;
-	    CpxNumVec& chddcv = chddat.dnchkval();
-	    if (chddcv.m() == 0) {
-	        chddcv.resize(de2dc(a,b,c).m());
-		setvalue(chddcv,cpx(0,0));
-	    }
-	    SAFE_FUNC_EVAL( zgemv(1.0, de2dc(a,b,c), dneqnden, 1.0, chddcv) );
-	}
-    } else {
-        Index3 pdir = ParentDir(dir); //LEXING: CHECK
-	for (int ind = 0; ind < NUM_CHILDREN; ++ind) {
-	    int a = CHILD_IND1(ind);
-	    int b = CHILD_IND2(ind);
-	    int c = CHILD_IND3(ind);             
-	    BoxKey chdkey = ChildKey(trgkey, Index3(a,b,c));
-	    std::pair<bool, BoxDat&> data = _boxvec.contains(chdkey);
-	    // If the box was empty, it will not be stored
-	    if (!data.first) {
-	        continue;
-	    }
-	    BoxDat& chddat = data.second;
-	    HFBoxAndDirectionKey bndkey(chdkey, pdir);
-	    HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-	    CpxNumVec& chddcv = bnddat.dirdnchkval();
-	    if (chddcv.m() == 0) {
-	        chddcv.resize(de2dc(a,b,c).m());
-		setvalue(chddcv,cpx(0,0));
-	    }
-	    SAFE_FUNC_EVAL( zgemv(1.0, de2dc(a,b,c), dneqnden, 1.0, chddcv) );
-	}
+            int a = CHILD_IND1(ind);
+            int b = CHILD_IND2(ind);
+            int c = CHILD_IND3(ind);
+            std::vector<int> cols;
+            std::vector<CpxNumMat*> vals;
+            for (int k = 0; k < nb; ++k) {
+                BoxKey chdkey = ChildKey(trgvec[k0 + k], Index3(a,b,c));
+                std::pair<bool, BoxDat&> data = _boxvec.contains(chdkey);
+                // If the box was empty, it will not be stored
+                if (!data.first) {
+                    continue;
+                }
+                BoxDat& chddat = data.second;
+                if (abs(W - 1) < eps) {
+                    vals.push_back(&chddat.dnchkval());
+                } else {
+                    HFBoxAndDirectionKey bndkey(chdkey, pdir);
+                    vals.push_back(&_bndvec.access(bndkey).dirdnchkval());
+                }
+                cols.push_back(k * _nrhs);
+            }
+            if (cols.empty()) {
+                continue;
+            }
+            const CpxNumMat& op = de2dc(a,b,c);
+            CpxNumMat chdeqn(op.n(), cols.size() * _nrhs);
+            for (int i = 0; i < cols.size(); ++i) {
+                SAFE_FUNC_EVAL( CopyColumns(dneqnden, cols[i], _nrhs, chdeqn, i * _nrhs) );
+            }
+            CpxNumMat chddcv(op.m(), chdeqn.n());
+            SAFE_FUNC_EVAL( zgemm(1.0, op, chdeqn, 0.0, chddcv) );
+            flops += 8.0 * op.m() * op.n() * chdeqn.n();
+            for (int i = 0; i < cols.size(); ++i) {
+                CpxNumMat& val = *vals[i];
+                if (val.m() == 0) {
+                    val.resize(op.m(), _nrhs);
+                    setvalue(val,cpx(0,0));
+                }
+                SAFE_FUNC_EVAL( AddColumns(chddcv, i * _nrhs, _nrhs, val, 0) );
+            }
+        }
     }
+    _l2lrate[W].first += flops;
+    _l2lrate[W].second += MPI_Wtime() - t0;
     return 0;
 }
 
@@ -997,22 +1886,21 @@ int Wave3d::EvalDownwardHigh(double W, Index3 dir, box_lists_t& hdvecs) {
 #ifndef RELEASE
     CallStackEntry entry("Wave3d::EvalDownwardHigh");
 #endif
+    SAFE_FUNC_EVAL( LowFreqDownwardCommTest() );
     int mpirank = getMPIRank();
 
-    DblNumMat dep;
-    DblNumMat dcp;
-    NumVec<CpxNumMat> dc2de;
-    NumTns<CpxNumMat> de2dc;
-    DblNumMat uep;
-    SAFE_FUNC_EVAL( _mlibptr->DownwardHighFetch(W, dir, dep, dcp, dc2de, de2dc, uep) );
+    const FetchDat* fetch = NULL;
+    SAFE_FUNC_EVAL( _mlibptr->DownwardHighFetch(W, dir, fetch) );
+    const DblNumMat& dcp = fetch->dcp();
+    const DblNumMat& uep = fetch->uep();
     //LEXING: IMPORTANT
     std::vector<BoxKey>& trgvec = hdvecs.second;
     for (int k = 0; k < trgvec.size(); ++k) {
         BoxKey trgkey = trgvec[k];
         BoxDat& trgdat = _boxvec.access(trgkey);
 	SAFE_FUNC_EVAL( HighFrequencyM2L(W, dir, trgkey, trgdat, dcp, uep) );
-	SAFE_FUNC_EVAL( HighFrequencyL2L(W, dir, trgkey, dc2de, de2dc) );
-     }
+    }
+    SAFE_FUNC_EVAL( HighFrequencyL2L(W, dir, trgvec, *fetch) );
 
     // Now that we are done at this level, clear data to save on memory.
     std::vector<BoxKey>& srcvec = hdvecs.first;
@@ -1022,7 +1910,7 @@ int Wave3d::EvalDownwardHigh(double W, Index3 dir, box_lists_t& hdvecs) {
         CHECK_TRUE(HasPoints(srcdat));  // should have points
         HFBoxAndDirectionKey bndkey(srckey, dir);
         HFBoxAndDirectionDat& bnddat = _bndvec.access( bndkey );
-        bnddat.dirupeqnden().resize(0);
+        bnddat.dirupeqnden().resize(0, 0);
     }
     for (int k = 0; k < trgvec.size(); ++k) {
         BoxKey trgkey = trgvec[k];
@@ -1033,7 +1921,7 @@ int Wave3d::EvalDownwardHigh(double W, Index3 dir, box_lists_t& hdvecs) {
             BoxKey srckey = tmpvec[i];
             HFBoxAndDirectionKey bndkey(srckey, dir);
             HFBoxAndDirectionDat& bnddat = _bndvec.access(bndkey);
-            bnddat.dirupeqnden().resize(0);
+            bnddat.dirupeqnden().resize(0, 0);
         }
     }
     return 0;
@@ -59,6 +59,98 @@ int Wave3d::setup(std::map<std::string, std::string>& opts) {
         std::istringstream ss(mi->second);
         ss >> _maxlevel;
     }
+    // Single-precision near field.  Only used at ACCU=1, where the target
+    // accuracy (about 1e-4) is well above float round-off.
+    int nearfloat = 0;
+    mi = opts.find("-" + prefix() + "NEARFLOAT");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> nearfloat;
+    }
+    _nearfloat = (nearfloat != 0 && _ACCU == 1);
+    if (mpirank == 0 && nearfloat != 0 && !_nearfloat) {
+        std::cout << "NEARFLOAT ignored for ACCU " << _ACCU
+                  << ", using double precision near field" << std::endl;
+    }
+    // Memory budget (MB per process) for the near-field operator cache.
+    // The cached matrices are only valid for this geometry.
+    double nearcache_mb = 0;
+    mi = opts.find("-" + prefix() + "NEARCACHE");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> nearcache_mb;
+    }
+    _nearcache.clear();
+    _nearcache.budget() = nearcache_mb * 1024 * 1024;
+    // Keep the leaf P2M/L2P operators, built during the first eval.
+    int leafops = 0;
+    mi = opts.find("-" + prefix() + "LEAFOPS");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> leafops;
+    }
+    _leafopson = (leafops != 0);
+    _leafops.clear();
+    // Memory budget (MB per process) for the high frequency M2L operators.
+    double m2lcache_mb = 0;
+    mi = opts.find("-" + prefix() + "M2LCACHE");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> m2lcache_mb;
+    }
+    _m2lcache.clear();
+    _m2lcache.budget() = m2lcache_mb * 1024 * 1024;
+    // Batch the V list FFTs of a whole level (default), or transform one
+    // box at a time.
+    int vbatch = 1;
+    mi = opts.find("-" + prefix() + "VBATCH");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> vbatch;
+    }
+    _vbatch = (vbatch != 0);
+    // V list spectra: budget (MB per process), policy (0 keep all until the
+    // last use, 1 LRU within the budget, 2 recompute) and target ordering.
+    double speccache_mb = 0;
+    mi = opts.find("-" + prefix() + "SPECCACHE");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> speccache_mb;
+    }
+    int specpolicy = SPECTRUM_KEEPALL;
+    mi = opts.find("-" + prefix() + "SPECPOLICY");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> specpolicy;
+    }
+    CHECK_TRUE(specpolicy >= SPECTRUM_KEEPALL && specpolicy <= SPECTRUM_RECOMPUTE);
+    _speccache.clear();
+    _speccache.policy() = specpolicy;
+    _speccache.budget() = speccache_mb * 1024 * 1024;
+    int vorder = 0;
+    mi = opts.find("-" + prefix() + "VORDER");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> vorder;
+    }
+    _vorder = (vorder != 0);
+    // Low frequency M2L engine (0 FFT, 1 dense, 2 chosen per level) and the
+    // relative SVD truncation of the dense operators, by default two digits
+    // below the accuracy of the tables.
+    _lowm2l = LOWM2L_AUTO;
+    mi = opts.find("-" + prefix() + "LOWM2L");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> _lowm2l;
+    }
+    CHECK_TRUE(_lowm2l >= LOWM2L_FFT && _lowm2l <= LOWM2L_AUTO);
+    _densetol = pow(10.0, -2.0 * _ACCU - 4);
+    mi = opts.find("-" + prefix() + "DENSETOL");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> _densetol;
+    }
+    _densem2l.clear();
     //
     if (mpirank == 0) {
         std::cout << _K <<      " | "
@@ -66,7 +158,8 @@ int Wave3d::setup(std::map<std::string, std::string>& opts) {
                   << _NPQ <<    " | "
                   << _ctr <<    " | "
                   << _ptsmax << " | "
-                  << _maxlevel
+                  << _maxlevel << " | "
+                  << _nearfloat
                   << std::endl;
     }
     //
@@ -75,6 +168,36 @@ int Wave3d::setup(std::map<std::string, std::string>& opts) {
     _boxvec.prtn() = bp;
     HFBoxAndDirectionPrtn tp;  tp.ownerinfo() = _geomprtn;
     _bndvec.prtn() = tp;
+    // Message exchange of the parvecs: 0 sparse whenever the pattern is,
+    // else by node on multi-node runs (default), 1 always all-to-all, 2
+    // always sparse, 3 always by node.
+    int exchange = PARVEC_EXCHANGE_AUTO;
+    mi = opts.find("-" + prefix() + "EXCHANGE");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> exchange;
+    }
+    CHECK_TRUE(exchange >= PARVEC_EXCHANGE_AUTO && exchange <= PARVEC_EXCHANGE_NODE);
+    _boxvec.exchange() = exchange;
+    _bndvec.exchange() = exchange;
+    // Replay the communication of the first eval in later ones (default).
+    int commplans = 1;
+    mi = opts.find("-" + prefix() + "COMMPLANS");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> commplans;
+    }
+    _commplans = (commplans != 0);
+    // Overlap the low frequency downward exchange with the high frequency
+    // pass (default).
+    int overlap = 1;
+    mi = opts.find("-" + prefix() + "OVERLAP");
+    if (mi != opts.end()) {
+        std::istringstream ss(mi->second);
+        ss >> overlap;
+    }
+    _overlap = (overlap != 0);
+    SAFE_FUNC_EVAL( ReleasePlans() );
     //generate octree
     SAFE_FUNC_EVAL( setup_tree() );
     //plans